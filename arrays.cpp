@@ -0,0 +1,248 @@
+#include "arrays.h"
+#include "ast.h"
+#include "kernels.h"
+#include "memory_account.h"
+#include <climits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+const BuiltinInfo kBuiltins[kBuiltinCount] = {
+    {"len", 1, "an array"},
+    {"sum", 1, "an array"},
+    {"min", 1, "an array"},
+    {"max", 1, "an array"},
+    {"dot", 2, "two arrays"},
+    {"scale", 2, "an array and a number"},
+    {"add", 2, "two arrays"},
+    {"less", 2, "an array and an array or a number"},
+    {"greater", 2, "an array and an array or a number"},
+    {"equal", 2, "an array and an array or a number"},
+    {"fill", 2, "a length and a number"},
+    {"range", 1, "a length"},
+};
+
+size_t lengthOf(const Value& array) {
+    return array.isIntArray() ? array.ints().size() : array.floats().size();
+}
+
+void requireSameLength(const Value& left, const Value& right) {
+    if (lengthOf(left) != lengthOf(right)) throw std::runtime_error("Array lengths differ");
+}
+
+// An array's elements as doubles; an int[] is converted into scratch
+const double* doublesOf(const Value& array, std::vector<double>& scratch) {
+    if (array.isFloatArray()) return array.floats().data();
+    scratch.assign(array.ints().begin(), array.ints().end());
+    return scratch.data();
+}
+
+std::vector<double> copyAsDoubles(const Value& array) {
+    if (array.isFloatArray()) return array.floats();
+    return std::vector<double>(array.ints().begin(), array.ints().end());
+}
+
+double asDouble(const Value& number) {
+    return number.isInt() ? number.asInt() : number.asDouble();
+}
+
+// A numeric index truncated toward zero, checked against length
+size_t position(const Value& index, size_t length) {
+    if (index.isInt()) {
+        if (index.asInt() < 0 || static_cast<size_t>(index.asInt()) >= length) throw std::runtime_error("Index out of range");
+        return static_cast<size_t>(index.asInt());
+    }
+    if (!index.isDouble()) throw std::runtime_error("Array index must be numeric");
+    double at = index.asDouble();
+    // Also false for NaN
+    if (!(at > -1.0 && at < static_cast<double>(length))) throw std::runtime_error("Index out of range");
+    return static_cast<size_t>(at);
+}
+
+// fill()'s and range()'s length, truncated toward zero
+size_t lengthArgument(const Value& count) {
+    double length = asDouble(count);
+    // Also true for NaN
+    if (!(length > -1.0)) throw std::runtime_error("Array length must not be negative");
+    if (length > INT_MAX) throw std::runtime_error("Array too long");
+    return static_cast<size_t>(length);
+}
+
+// less/greater/equal: right is an array of the same length or one number
+Value compare(BinaryOp relation, const Value& left, const Value& right) {
+    size_t count = lengthOf(left);
+    std::vector<int> out(count);
+    if (right.isArray()) requireSameLength(left, right);
+    if (left.isIntArray() && (right.isIntArray() || right.isInt())) {
+        const int* other = right.isInt() ? nullptr : right.ints().data();
+        int scalar = right.isInt() ? right.asInt() : 0;
+        compareInts(relation, left.ints().data(), other ? other : &scalar, other ? 1 : 0, out.data(), count);
+        return out;
+    }
+    std::vector<double> leftScratch, rightScratch;
+    double scalar = right.isArray() ? 0.0 : asDouble(right);
+    const double* other = right.isArray() ? doublesOf(right, rightScratch) : &scalar;
+    compareDoubles(relation, doublesOf(left, leftScratch), other, right.isArray() ? 1 : 0, out.data(), count);
+    return out;
+}
+
+} // namespace
+
+const BuiltinInfo& builtinInfo(Builtin builtin) {
+    return kBuiltins[static_cast<size_t>(builtin)];
+}
+
+bool builtinNamed(std::string_view name, Builtin& out) {
+    for (uint32_t i = 0; i < kBuiltinCount; ++i) {
+        if (name == kBuiltins[i].name) {
+            out = static_cast<Builtin>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string builtinTypeError(Builtin builtin) {
+    const BuiltinInfo& info = builtinInfo(builtin);
+    return std::string(info.name) + " expects " + info.expects;
+}
+
+Value callBuiltin(Builtin builtin, const Value* args) {
+    const Value& first = args[0];
+    switch (builtin) {
+        case Builtin::Len:
+            if (!first.isArray()) break;
+            return static_cast<int>(lengthOf(first));
+        case Builtin::Sum:
+            if (first.isIntArray()) return sumInts(first.ints().data(), first.ints().size());
+            if (first.isFloatArray()) return sumDoubles(first.floats().data(), first.floats().size());
+            break;
+        case Builtin::Min:
+        case Builtin::Max: {
+            if (!first.isArray()) break;
+            if (lengthOf(first) == 0) throw std::runtime_error(std::string(builtinInfo(builtin).name) + " of an empty array");
+            bool min = builtin == Builtin::Min;
+            if (first.isIntArray()) {
+                const std::vector<int>& data = first.ints();
+                return min ? minInts(data.data(), data.size()) : maxInts(data.data(), data.size());
+            }
+            const std::vector<double>& data = first.floats();
+            return min ? minDoubles(data.data(), data.size()) : maxDoubles(data.data(), data.size());
+        }
+        case Builtin::Dot: {
+            const Value& second = args[1];
+            if (!first.isArray() || !second.isArray()) break;
+            requireSameLength(first, second);
+            if (first.isIntArray() && second.isIntArray()) {
+                return dotInts(first.ints().data(), second.ints().data(), first.ints().size());
+            }
+            std::vector<double> leftScratch, rightScratch;
+            return dotDoubles(doublesOf(first, leftScratch), doublesOf(second, rightScratch), lengthOf(first));
+        }
+        case Builtin::Scale: {
+            const Value& factor = args[1];
+            if (!first.isArray() || !factor.isNumber()) break;
+            if (first.isIntArray() && factor.isInt()) {
+                std::vector<int> out(first.ints().size());
+                scaleInts(first.ints().data(), factor.asInt(), out.data(), out.size());
+                return out;
+            }
+            std::vector<double> out = copyAsDoubles(first);
+            scaleDoubles(out.data(), asDouble(factor), out.data(), out.size());
+            return out;
+        }
+        case Builtin::Add: {
+            const Value& second = args[1];
+            if (!first.isArray() || !second.isArray()) break;
+            requireSameLength(first, second);
+            if (first.isIntArray() && second.isIntArray()) {
+                std::vector<int> out(first.ints().size());
+                addInts(first.ints().data(), second.ints().data(), out.data(), out.size());
+                return out;
+            }
+            std::vector<double> out = copyAsDoubles(first);
+            std::vector<double> scratch;
+            addDoubles(out.data(), doublesOf(second, scratch), out.data(), out.size());
+            return out;
+        }
+        case Builtin::Less:
+        case Builtin::Greater:
+        case Builtin::Equal: {
+            const Value& second = args[1];
+            if (!first.isArray() || second.isString()) break;
+            BinaryOp relation = builtin == Builtin::Less ? BinaryOp::Less
+                              : builtin == Builtin::Greater ? BinaryOp::Greater : BinaryOp::Equal;
+            return compare(relation, first, second);
+        }
+        case Builtin::Fill: {
+            const Value& value = args[1];
+            if (!first.isNumber() || !value.isNumber()) break;
+            size_t count = lengthArgument(first);
+            if (value.isInt()) {
+                requireMemory(count * sizeof(int));
+                return std::vector<int>(count, value.asInt());
+            }
+            requireMemory(count * sizeof(double));
+            return std::vector<double>(count, value.asDouble());
+        }
+        case Builtin::Range: {
+            if (!first.isNumber()) break;
+            size_t count = lengthArgument(first);
+            requireMemory(count * sizeof(int));
+            std::vector<int> out(count);
+            std::iota(out.begin(), out.end(), 0);
+            return out;
+        }
+    }
+    throw std::runtime_error(builtinTypeError(builtin));
+}
+
+Value elementAt(const Value& array, const Value& index) {
+    if (!array.isArray()) throw std::runtime_error("Only arrays can be indexed");
+    size_t at = position(index, lengthOf(array));
+    if (array.isIntArray()) return array.ints()[at];
+    return array.floats()[at];
+}
+
+void storeElement(Value& array, const Value& index, const Value& value) {
+    // Every type check before the range check, so the TypeChecker knows
+    // which error a statement that always fails raises
+    if (!array.isArray()) throw std::runtime_error("Only arrays can be indexed");
+    if (!index.isNumber()) throw std::runtime_error("Array index must be numeric");
+    if (!value.isNumber()) throw std::runtime_error("Array elements must be numeric");
+    size_t at = position(index, lengthOf(array));
+    if (array.isIntArray()) array.mutableInts()[at] = value.isInt() ? value.asInt() : static_cast<int>(value.asDouble());
+    else array.mutableFloats()[at] = asDouble(value);
+}
+
+Value makeArray(const Value* elements, size_t count) {
+    bool ints = true;
+    for (size_t i = 0; i < count; ++i) {
+        if (!elements[i].isNumber()) throw std::runtime_error("Array elements must be numeric");
+        ints = ints && elements[i].isInt();
+    }
+    if (ints) {
+        std::vector<int> out(count);
+        for (size_t i = 0; i < count; ++i) out[i] = elements[i].asInt();
+        return out;
+    }
+    std::vector<double> out(count);
+    for (size_t i = 0; i < count; ++i) out[i] = asDouble(elements[i]);
+    return out;
+}
+
+Value declareArray(TokenType type, const Value& value) {
+    if (value.isIntArray()) {
+        if (type == TokenType::IntArrayType) return value;
+        return copyAsDoubles(value);
+    }
+    if (value.isFloatArray()) {
+        if (type == TokenType::FloatArrayType) return value;
+        const std::vector<double>& elements = value.floats();
+        std::vector<int> out(elements.size());
+        for (size_t i = 0; i < elements.size(); ++i) out[i] = static_cast<int>(elements[i]);
+        return out;
+    }
+    throw std::runtime_error(std::string("Type mismatch assigning to ") + declaredTypeName(type) + " variable");
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "lexer.h"
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Array operations shared by both engines. Element types follow the scalar
+// rules: an index is truncated to int like a '%' operand, a value written to
+// an int[] is truncated like 'int x = ...', and an array literal or fill()
+// with any double in it is a float[]. Writing an element copies the elements
+// first when another variable still shares them, so arrays behave as values.
+//
+// The builtins work on whole arrays in one call (see kernels.h), so a script
+// that uses them never goes through the engines once per element:
+//
+//   len(a)                       element count
+//   sum(a), min(a), max(a)       int for an int[], float for a float[]
+//   dot(a, b)                    sum of the products; int only for two int[]
+//   scale(a, k)                  every element times k
+//   add(a, b)                    element by element
+//   less/greater/equal(a, b)     int[] of 0/1 per element, b an array or a number
+//   fill(n, v)                   n copies of v
+//   range(n)                     0, 1, ..., n - 1
+//
+// Arrays given to one call must have the same length.
+enum class Builtin : uint8_t {
+    Len, Sum, Min, Max, Dot, Scale, Add, Less, Greater, Equal, Fill, Range,
+};
+constexpr uint32_t kBuiltinCount = static_cast<uint32_t>(Builtin::Range) + 1;
+
+struct BuiltinInfo {
+    const char* name;
+    uint8_t arity;
+    const char* expects; // arguments, for the type error
+};
+const BuiltinInfo& builtinInfo(Builtin builtin);
+// False for a name that is not a builtin
+bool builtinNamed(std::string_view name, Builtin& out);
+// "sum expects an array", raised whenever the argument types don't fit
+std::string builtinTypeError(Builtin builtin);
+
+// args holds builtinInfo(builtin).arity values
+Value callBuiltin(Builtin builtin, const Value* args);
+
+// array[index]
+Value elementAt(const Value& array, const Value& index);
+// array[index] = value, where array is a variable's own Value
+void storeElement(Value& array, const Value& index, const Value& value);
+// [elements...]
+Value makeArray(const Value* elements, size_t count);
+// What 'int[] x = value;' or 'float[] x = value;' stores
+Value declareArray(TokenType type, const Value& value);
@@ -1,82 +1,132 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
 #include <string>
-#include <memory>
+#include <vector>
 #include "lexer.h"
-// Base class for expressions
-struct Expr {
-    virtual ~Expr() = default;
-};
+#include "value.h"
 
-struct NumberExpr : Expr {
-    double value;
-    NumberExpr(double v) : value(v) {}
-};
+// The whole program lives in one Ast: nodes sit in a single contiguous
+// array and refer to each other by 32-bit index, so parsing costs a handful
+// of vector growths instead of one heap allocation per node, and teardown
+// frees a few buffers instead of walking the tree.
 
-struct VariableExpr : Expr {
-    std::string name;
-    VariableExpr(const std::string& n) : name(n) {}
-};
+using NodeId = uint32_t;
+constexpr NodeId kNoNode = UINT32_MAX;
 
-struct BinaryExpr : Expr {
-    std::unique_ptr<Expr> left, right;
-    std::string  op;
-    BinaryExpr(std::unique_ptr<Expr> l, std::string o, std::unique_ptr<Expr> r)
-        : left(std::move(l)), op(o), right(std::move(r)) {}
+enum class NodeKind : uint8_t {
+    // Expressions
+    Number,   // a = constant
+    String,   // a = constant
+    Variable, // a = name, b = slot
+    Binary,   // op, a = left, b = right
+    Hoisted,  // a = loop-invariant expr, b = cache (evaluated once per loop entry)
+    Index,    // a = array, b = index
+    Call,     // a = first argument in Ast::lists, b = argument count, c = Builtin
+    ArrayLiteral, // a = first element in Ast::lists, b = element count
+    // Statements
+    Print,    // a = expr
+    Assign,   // a = value, b = slot, c = name
+    Decl,     // varType, a = value, b = slot, c = name
+    StoreElement, // a = value, b = index, c = the array's Variable node
+    If,       // a = condition, b = then, c = else (or kNoNode)
+    While,    // a = condition, b = body, c = loop (or kNoNode)
+    Block,    // a = first entry in Ast::lists, b = statement count
 };
 
-// Base class for statements
-struct Stmt {
-    virtual ~Stmt() = default;
+// 16 bytes per node. Slots are filled in by the Resolver.
+struct Node {
+    NodeKind kind;
+    BinaryOp op = BinaryOp::Add;
+    TokenType varType = TokenType::End;
+    uint8_t reserved = 0; // no padding: program images write nodes as raw bytes
+    uint32_t a = kNoNode;
+    uint32_t b = kNoNode;
+    uint32_t c = kNoNode;
 };
+static_assert(sizeof(Node) == 16, "keep AST nodes compact");
+
+// How a Decl's varType is spelled in the source: "int", "float[]", ...
+inline const char* declaredTypeName(TokenType type) {
+    switch (type) {
+        case TokenType::IntType: return "int";
+        case TokenType::FloatType: return "float";
+        case TokenType::IntArrayType: return "int[]";
+        case TokenType::FloatArrayType: return "float[]";
+        default: return "string";
+    }
+}
 
-// Print statement
-struct PrintStmt : Stmt {
-    std::unique_ptr<Expr> expr;
-    PrintStmt(std::unique_ptr<Expr> e) : expr(std::move(e)) {}
+// A 'fun' loop of the form
+//     fun (i < bound) { acc = acc + i * 2; n = n + 1; i = i + step; }
+// that the engines can finish in O(1) (see LoopRuntime::tryClosedForm)
+struct ClosedForm {
+    struct Accumulator {
+        uint32_t slot;
+        bool afterStep;       // the update comes after i = i + step in the body
+        bool scalesInduction; // adds factor * i, otherwise adds factor
+        Value factor;
+    };
+    uint32_t induction = 0;
+    Value step;               // already negated for i = i - c
+    BinaryOp relation = BinaryOp::Less; // i relation bound
+    NodeId bound = kNoNode;   // Number or Variable
+    std::vector<Accumulator> accumulators;
 };
-struct IfStmt : Stmt {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> thenBranch;
-    std::unique_ptr<Stmt> elseBranch;
 
-    IfStmt(std::unique_ptr<Expr> cond,
-        std::unique_ptr<Stmt> thenStmt,
-        std::unique_ptr<Stmt> elseStmt = nullptr)
-        : condition(std::move(cond)),
-        thenBranch(std::move(thenStmt)),
-        elseBranch(std::move(elseStmt)) {}
+struct LoopInfo {
+    bool hasClosedForm = false;
+    ClosedForm closedForm;
 };
 
+struct Ast {
+    std::vector<Node> nodes;
+    std::vector<NodeId> lists;        // children of every Block, Call and ArrayLiteral, each run contiguous
+    std::vector<Value> constants;     // Number and String literals
+    std::vector<std::string> names;   // identifier spellings, one entry per distinct name
+    std::vector<NodeId> statements;   // top-level statements in order
+    // Where each statement starts, sorted by NodeId: a statement is added
+    // right after everything inside it. Expressions have no entry.
+    std::vector<std::pair<NodeId, SourcePos>> statementPositions;
 
-// Assignment statement
-struct AssignStmt : Stmt {
-    std::string name;
-    std::unique_ptr<Expr> value;
-    AssignStmt(const std::string& n, std::unique_ptr<Expr> v)
-        : name(n), value(std::move(v)) {}
-};
-struct DeclStmt : Stmt {
-    TokenType varType;
-    std::string name;
-    std::unique_ptr<Expr> value;
+    // Filled in by the loop optimizer (-O2)
+    std::vector<LoopInfo> loops;      // indexed by While::c
+    std::vector<uint32_t> hoistLoops; // owning loop of each Hoisted cache
 
-    DeclStmt(TokenType varType, const std::string& name, std::unique_ptr<Expr> value)
-        : varType(varType), name(name), value(std::move(value)) {}
-};
-struct StringExpr : Expr {
-    std::string value;
-    StringExpr(const std::string& value) : value(std::move(value)) {}
-};
-struct WhileStmt : Stmt {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> body;
+    const Node& operator[](NodeId id) const { return nodes[id]; }
+    Node& operator[](NodeId id) { return nodes[id]; }
 
-    WhileStmt(std::unique_ptr<Expr> cond, std::unique_ptr<Stmt> body)
-        : condition(std::move(cond)), body(std::move(body)) {}
-};
-struct BlockStmt : Stmt {
-    std::vector<std::unique_ptr<Stmt>> statements;
-    BlockStmt(std::vector<std::unique_ptr<Stmt>> stmts)
-        : statements(std::move(stmts)) {}
-};
+    NodeId add(const Node& node) {
+        nodes.push_back(node);
+        return static_cast<NodeId>(nodes.size() - 1);
+    }
+
+    // Children of a Block, Call or ArrayLiteral node
+    const NodeId* begin(const Node& block) const { return lists.data() + block.a; }
+    const NodeId* end(const Node& block) const { return lists.data() + block.a + block.b; }
 
+    const std::string& nameOf(const Node& node) const {
+        return names[node.kind == NodeKind::Variable ? node.a : node.c];
+    }
+
+    // Heap bytes held, for charging a MemoryAccount
+    size_t memoryBytes() const {
+        size_t bytes = nodes.capacity() * sizeof(Node) + lists.capacity() * sizeof(NodeId) +
+                       constants.capacity() * sizeof(Value) + names.capacity() * sizeof(std::string) +
+                       statements.capacity() * sizeof(NodeId) +
+                       statementPositions.capacity() * sizeof(statementPositions[0]) +
+                       loops.capacity() * sizeof(LoopInfo) + hoistLoops.capacity() * sizeof(uint32_t);
+        for (const Value& constant : constants) {
+            if (constant.isString()) bytes += constant.str().capacity();
+        }
+        for (const std::string& name : names) bytes += name.capacity();
+        for (const LoopInfo& loop : loops) bytes += loop.closedForm.accumulators.capacity() * sizeof(ClosedForm::Accumulator);
+        return bytes;
+    }
+
+    SourcePos positionOf(NodeId stmt) const {
+        auto it = std::lower_bound(statementPositions.begin(), statementPositions.end(), stmt,
+                                   [](const auto& entry, NodeId id) { return entry.first < id; });
+        return it != statementPositions.end() && it->first == stmt ? it->second : SourcePos{};
+    }
+};
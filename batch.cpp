@@ -0,0 +1,201 @@
+#include "batch.h"
+#include "compiler.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "resolver.h"
+#include "source.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+WorkStealingPool::WorkStealingPool(unsigned threads) : threadCount(std::max(1u, threads)) {
+    for (unsigned i = 0; i < threadCount; ++i) queues.push_back(std::make_unique<Queue>());
+}
+
+void WorkStealingPool::start(size_t count, std::function<void(size_t)> task) {
+    wait();
+    body = std::move(task);
+    for (size_t i = 0; i < count; ++i) queues[i % threadCount]->tasks.push_back(i);
+    for (unsigned i = 0; i < threadCount; ++i) workers.emplace_back(&WorkStealingPool::work, this, i);
+}
+
+void WorkStealingPool::wait() {
+    for (std::thread& worker : workers) worker.join();
+    workers.clear();
+}
+
+void WorkStealingPool::work(unsigned self) {
+    size_t task;
+    while (next(self, task)) body(task);
+}
+
+// Tasks never add tasks, so once every deque is empty the pool is done
+bool WorkStealingPool::next(unsigned self, size_t& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < threadCount; ++i) {
+        Queue& victim = *queues[(self + i) % threadCount];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+// Collects a script's output in a string that outlives its engine
+class CaptureSink : public OutputSink {
+public:
+    explicit CaptureSink(std::string& target) : OutputSink(FlushPolicy::WhenFull), target(target) {}
+    ~CaptureSink() override { flush(); }
+
+protected:
+    void write(const char* data, size_t size) override { keep(target, data, size); }
+
+private:
+    std::string& target;
+};
+
+struct ScriptResult {
+    std::string output;
+    std::string error;  // empty on success
+    double milliseconds = 0;
+    bool done = false;  // guarded by the batch's mutex
+};
+
+// The same pipeline as main() without the diagnostics
+void runScript(const std::string& path, const BatchOptions& options, std::string& output) {
+    SourceBuffer source = SourceBuffer::fromFile(path);
+    Ast program;
+    {
+        Lexer lexer(source.view());
+        auto tokens = lexer.tokenize();
+        Parser parser(tokens, lexer.symbols());
+        program = parser.parseProgram();
+    }
+    Resolver resolver;
+    resolver.resolve(program);
+    Optimizer optimizer(options.optLevel);
+    optimizer.optimize(program);
+
+    MemoryCharge programBytes;
+    if (options.useVM) {
+        Chunk chunk = Compiler().compile(program, resolver.slotNames());
+        VM vm;
+        vm.setOutput(std::make_unique<CaptureSink>(output));
+        vm.setJit(options.useJit && kJitAvailable);
+        vm.memory().setLimit(options.memoryLimit);
+        programBytes.set(vm.memory(), program.memoryBytes());
+        vm.run(chunk);
+    } else {
+        Interpreter interpreter;
+        interpreter.setOutput(std::make_unique<CaptureSink>(output));
+        interpreter.setJit(options.useJit && kJitAvailable);
+        interpreter.memory().setLimit(options.memoryLimit);
+        programBytes.set(interpreter.memory(), program.memoryBytes());
+        interpreter.interpret(program, resolver.slotCount());
+    }
+}
+
+} // namespace
+
+std::vector<std::string> batchScripts(const std::string& target) {
+    std::vector<std::string> scripts;
+    if (std::filesystem::is_directory(target)) {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(target)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".happy") {
+                scripts.push_back(entry.path().string());
+            }
+        }
+        std::sort(scripts.begin(), scripts.end());
+        return scripts;
+    }
+    std::ifstream list(target);
+    if (!list) throw std::runtime_error("Could not open file: " + target);
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) scripts.push_back(line);
+    }
+    return scripts;
+}
+
+int runBatch(const std::vector<std::string>& scripts, const BatchOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point batchStart = Clock::now();
+    unsigned jobs = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<ScriptResult> results(scripts.size());
+    std::mutex lock;
+    std::condition_variable finished;
+
+    WorkStealingPool pool(jobs);
+    pool.start(scripts.size(), [&](size_t i) {
+        ScriptResult& result = results[i];
+        Clock::time_point start = Clock::now();
+        try {
+            runScript(scripts[i], options, result.output);
+        }
+        catch (const std::exception& e) {
+            result.error = e.what();
+        }
+        result.milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> guard(lock);
+        result.done = true;
+        finished.notify_all();
+    });
+
+    // Emit in input order as soon as each script and all before it are done,
+    // releasing each buffer once written
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&] { return results[i].done; });
+        }
+        std::cout << "==> " << scripts[i] << " <==\n";
+        std::cout.write(results[i].output.data(), static_cast<std::streamsize>(results[i].output.size()));
+        std::string().swap(results[i].output);
+    }
+    pool.wait();
+    std::cout.flush();
+
+    size_t failed = 0;
+    double scriptMs = 0;
+    char line[64];
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        const ScriptResult& result = results[i];
+        scriptMs += result.milliseconds;
+        std::snprintf(line, sizeof line, "%10.3f ms  %-4s  ", result.milliseconds, result.error.empty() ? "ok" : "FAIL");
+        std::cerr << line << scripts[i];
+        if (!result.error.empty()) {
+            ++failed;
+            std::cerr << ": Error: " << result.error;
+        }
+        std::cerr << "\n";
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - batchStart).count();
+    std::cerr << "batch: " << scripts.size() << " scripts, " << failed << " failed, " << jobs << " threads, ";
+    std::snprintf(line, sizeof line, "%.3f ms wall, %.3f ms in scripts\n", wallMs, scriptMs);
+    std::cerr << line;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs task(0) .. task(count - 1) on a fixed set of threads. Every worker
+// owns a deque of task indices, dealt out round-robin so that work proceeds
+// roughly in index order; it takes from the front of its own deque and, once
+// that is empty, steals from the back of another worker's.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads);
+    ~WorkStealingPool() { wait(); }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Returns at once; the tasks run in the background until wait()
+    void start(size_t count, std::function<void(size_t)> task);
+    void wait();
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    unsigned threadCount;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::function<void(size_t)> body;
+
+    void work(unsigned self);
+    bool next(unsigned self, size_t& task);
+};
+
+struct BatchOptions {
+    bool useVM = true;
+    int optLevel = 1;
+    bool useJit = true;
+    unsigned jobs = 0; // 0: one per hardware thread
+    size_t memoryLimit = 0; // bytes per script, Ast included; 0 for no limit
+};
+
+// The scripts named by target: every *.happy file under a directory (sorted),
+// or the paths listed one per line in a file. Throws std::runtime_error.
+std::vector<std::string> batchScripts(const std::string& target);
+
+// Runs every script in its own engine on a WorkStealingPool. Each script's
+// 'smile' output is captured separately and written to stdout in input
+// order, after a "==> path <==" line. A summary of every script's time and
+// error goes to stderr. Returns the exit status: 1 if any script failed.
+int runBatch(const std::vector<std::string>& scripts, const BatchOptions& options);
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Times every bench/*.happy workload on the tree-walker and on the bytecode VM.
+# usage: bench/compare_engines.sh [path/to/happyscript] [-O0|-O1|-O2]
+BIN=${1:-./build/happyscript}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+
+for script in "$DIR"/*.happy; do
+    for engine in tree vm; do
+        start=$(date +%s.%N)
+        "$BIN" --engine=$engine "$@" "$script" > /dev/null || exit 1
+        end=$(date +%s.%N)
+        awk -v s="$(basename "$script")" -v e=$engine -v a="$start" -v b="$end" \
+            'BEGIN { printf "%-24s %-5s %8.3fs\n", s, e, b - a }'
+    done
+done
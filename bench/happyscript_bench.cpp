@@ -0,0 +1,365 @@
+// Micro-benchmarks for the lexer, the parser and both engines, run over every
+// bench/*.happy workload plus a generated straight-line program. Workloads
+// big enough for parseSource to cut are also lexed and parsed with 1, 2, 4,
+// ... threads (phases frontend-j1, frontend-j2, ...) up to --threads, and the
+// speedup over one thread is printed.
+//
+// Results go to stdout (or --out) as JSON. With --baseline the run is compared
+// against an earlier result file and the exit status is 1 when any benchmark
+// got slower than --threshold percent, so a build can be checked before it
+// replaces the previous one:
+//
+//   happyscript_bench --out=before.json
+//   ... rebuild ...
+//   happyscript_bench --baseline=before.json
+#include "compiler.h"
+#include "frontend.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "output.h"
+#include "parser.h"
+#include "resolver.h"
+#include "source.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef HAPPYSCRIPT_BENCH_DIR
+#define HAPPYSCRIPT_BENCH_DIR "bench"
+#endif
+
+namespace {
+
+struct Options {
+    std::string corpus = HAPPYSCRIPT_BENCH_DIR;
+    std::string filter;
+    std::string baseline;
+    std::string out;
+    double minTime = 0.3;    // seconds per benchmark
+    double threshold = 10;   // percent slowdown reported as a regression
+    int optLevel = 1;
+    bool jit = true;
+    size_t generatedLines = 200000;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency()); // most for the frontend phases
+};
+
+struct Workload {
+    std::string name;
+    SourceBuffer source;
+    size_t tokens = 0;
+};
+
+struct Result {
+    std::string name;   // workload/phase
+    std::string workload;
+    std::string phase;  // lex, parse, frontend-jN, tree or vm
+    uint64_t iterations = 0;
+    double nsPerOp = 0;
+    size_t bytes = 0;
+    size_t tokens = 0;
+};
+
+// Swallows 'smile' output so the engines are timed without I/O
+class NullSink : public OutputSink {
+public:
+    NullSink() : OutputSink(FlushPolicy::WhenFull) {}
+    ~NullSink() override { flush(); }
+
+protected:
+    void write(const char*, size_t) override {}
+};
+
+volatile size_t keepAlive; // results are stored here so the work is not optimized away
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Runs op in batches of at least a millisecond until minTime has passed (and
+// at least three batches ran) and reports the median batch, which shrugs off
+// the odd descheduled batch better than the mean
+Result measure(const std::function<void()>& op, double minTime) {
+    Clock::time_point start = Clock::now();
+    op(); // warm-up, also sizes the batches
+    double single = std::max(secondsSince(start), 1e-9);
+    uint64_t batch = std::max<uint64_t>(1, static_cast<uint64_t>(1e-3 / single));
+
+    std::vector<double> samples;
+    double spent = 0;
+    Result result;
+    while (samples.size() < 3 || spent < minTime) {
+        Clock::time_point t = Clock::now();
+        for (uint64_t i = 0; i < batch; ++i) op();
+        double elapsed = secondsSince(t);
+        samples.push_back(elapsed * 1e9 / batch);
+        spent += elapsed;
+        result.iterations += batch;
+    }
+    std::sort(samples.begin(), samples.end());
+    result.nsPerOp = samples[samples.size() / 2];
+    return result;
+}
+
+// A long program without loops, the shape of machine-generated scripts:
+// declarations and assignments over a window of 1000 variables, with an
+// 'ana'/'elsa' every tenth line
+std::string generateStraightLine(size_t lines) {
+    std::string text;
+    text.reserve(lines * 40);
+    const size_t window = 1000;
+    for (size_t k = 0; k < lines; ++k) {
+        std::string var = "v" + std::to_string(k % window);
+        std::string prev = "v" + std::to_string((k + window - 1) % window);
+        if (k == 0) {
+            text += "int v0 = 1;\n";
+        } else if (k < window) {
+            text += "int " + var + " = " + prev + " + " + std::to_string(k % 97) + " * 2;\n";
+        } else if (k % 10 == 0) {
+            text += "ana (" + var + " < " + prev + ") { " + var + " = " + prev + " - 1; } elsa { "
+                  + var + " = " + var + " % 1000; }\n";
+        } else {
+            text += var + " = " + prev + " + " + std::to_string(k % 97) + " * 2 - " + var + " % 13;\n";
+        }
+    }
+    text += "smile(v" + std::to_string((lines - 1) % window) + ");\n";
+    return text;
+}
+
+std::vector<Workload> loadWorkloads(const Options& options) {
+    std::vector<std::string> paths;
+    for (const auto& entry : std::filesystem::directory_iterator(options.corpus)) {
+        if (entry.path().extension() == ".happy") paths.push_back(entry.path().string());
+    }
+    if (paths.empty()) throw std::runtime_error("No .happy files in " + options.corpus);
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<Workload> workloads;
+    for (const std::string& path : paths) {
+        workloads.push_back({std::filesystem::path(path).filename().string(), SourceBuffer::fromFile(path)});
+    }
+    if (options.generatedLines > 0) {
+        workloads.push_back({"straight_line.generated",
+                             SourceBuffer::fromString(generateStraightLine(options.generatedLines))});
+    }
+    return workloads;
+}
+
+bool selected(const Options& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+void benchWorkload(Workload& workload, const Options& options, std::vector<Result>& results) {
+    std::string_view text = workload.source.view();
+    Lexer lexer(text);
+    std::vector<Token> tokens = lexer.tokenize();
+    workload.tokens = tokens.size();
+
+    auto record = [&](const std::string& phase, const std::function<void()>& op) {
+        std::string name = workload.name + "/" + phase;
+        if (!selected(options, name)) return false;
+        Result result = measure(op, options.minTime);
+        result.name = name;
+        result.workload = workload.name;
+        result.phase = phase;
+        result.bytes = text.size();
+        result.tokens = workload.tokens;
+        if (phase == "lex") {
+            std::fprintf(stderr, "%s: %.0f ns/op, %.1f MB/s\n", name.c_str(), result.nsPerOp,
+                         result.bytes / (result.nsPerOp * 1e-3));
+        } else {
+            std::fprintf(stderr, "%s: %.0f ns/op\n", name.c_str(), result.nsPerOp);
+        }
+        results.push_back(std::move(result));
+        return true;
+    };
+
+    record("lex", [&] {
+        Lexer fresh(text);
+        keepAlive = fresh.tokenize().size();
+    });
+    record("parse", [&] {
+        Parser parser(tokens, lexer.symbols());
+        keepAlive = parser.parseProgram().nodes.size();
+    });
+
+    // Lex and parse together, which is what parseSource splits across threads
+    if (text.size() >= kParallelParseBytes) {
+        std::vector<unsigned> counts;
+        for (unsigned threads = 1; threads < options.threads; threads *= 2) counts.push_back(threads);
+        counts.push_back(options.threads);
+        double single = 0;
+        for (unsigned threads : counts) {
+            bool ran = record("frontend-j" + std::to_string(threads), [&] {
+                keepAlive = parseSource(text, threads).nodes.size();
+            });
+            if (!ran) continue;
+            if (threads == 1) single = results.back().nsPerOp;
+            else if (single > 0) std::fprintf(stderr, "  %ux speedup over 1 thread: %.2f\n", threads, single / results.back().nsPerOp);
+        }
+    }
+
+    // The engines run the program as main() would at the chosen -O level
+    Ast program = Parser(tokens, lexer.symbols()).parseProgram();
+    Resolver resolver;
+    resolver.resolve(program);
+    Optimizer optimizer(options.optLevel);
+    optimizer.optimize(program);
+
+    record("tree", [&] {
+        Interpreter interpreter;
+        interpreter.setOutput(std::make_unique<NullSink>());
+        interpreter.setJit(options.jit && kJitAvailable);
+        interpreter.interpret(program, resolver.slotCount());
+    });
+    Chunk chunk = Compiler().compile(program, resolver.slotNames());
+    record("vm", [&] {
+        VM vm;
+        vm.setOutput(std::make_unique<NullSink>());
+        vm.setJit(options.jit && kJitAvailable);
+        vm.run(chunk);
+    });
+}
+
+// Names never need more than this; they come from file names in the corpus
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string toJson(const std::vector<Result>& results, const Options& options) {
+    std::ostringstream json;
+    json.precision(10);
+    json << "{\n  \"context\": {\"opt_level\": " << options.optLevel
+         << ", \"jit\": " << (options.jit && kJitAvailable ? "true" : "false")
+         << ", \"min_time\": " << options.minTime << "},\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        json << "    {\"name\": " << quoted(r.name) << ", \"workload\": " << quoted(r.workload)
+             << ", \"phase\": " << quoted(r.phase) << ", \"iterations\": " << r.iterations
+             << ", \"ns_per_op\": " << r.nsPerOp << ", \"bytes\": " << r.bytes
+             << ", \"tokens\": " << r.tokens
+             << ", \"tokens_per_sec\": " << r.tokens / (r.nsPerOp * 1e-9)
+             << ", \"mb_per_sec\": " << r.bytes / (r.nsPerOp * 1e-3) << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+    return json.str();
+}
+
+// Reads name -> ns_per_op back from a file written by toJson
+std::map<std::string, double> readBaseline(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("Could not open file: " + path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string text = contents.str();
+
+    std::map<std::string, double> times;
+    const std::string nameKey = "\"name\": \"";
+    const std::string timeKey = "\"ns_per_op\": ";
+    for (size_t pos = text.find(nameKey); pos != std::string::npos; pos = text.find(nameKey, pos)) {
+        pos += nameKey.size();
+        size_t end = text.find('"', pos);
+        size_t time = text.find(timeKey, end);
+        if (end == std::string::npos || time == std::string::npos) break;
+        times[text.substr(pos, end - pos)] = std::strtod(text.c_str() + time + timeKey.size(), nullptr);
+    }
+    if (times.empty()) throw std::runtime_error("No benchmarks in " + path);
+    return times;
+}
+
+// Prints one line per benchmark found in both runs; returns the regression count
+int compareWithBaseline(const std::vector<Result>& results, const Options& options) {
+    std::map<std::string, double> baseline = readBaseline(options.baseline);
+    int regressions = 0;
+    std::fprintf(stderr, "\n%-40s %14s %14s %9s\n", "benchmark", "baseline ns", "current ns", "change");
+    for (const Result& r : results) {
+        auto old = baseline.find(r.name);
+        if (old == baseline.end() || old->second <= 0) continue;
+        double change = (r.nsPerOp / old->second - 1) * 100;
+        bool regressed = change > options.threshold;
+        regressions += regressed;
+        std::fprintf(stderr, "%-40s %14.0f %14.0f %+8.1f%%%s\n", r.name.c_str(), old->second, r.nsPerOp,
+                     change, regressed ? "  REGRESSION" : "");
+    }
+    std::fprintf(stderr, "%d regression(s) over %.1f%%\n", regressions, options.threshold);
+    return regressions;
+}
+
+bool parseOption(const char* arg, const char* name, std::string& value) {
+    size_t length = std::strlen(name);
+    if (std::strncmp(arg, name, length) != 0) return false;
+    value = arg + length;
+    return true;
+}
+
+const char* kUsage =
+    "Usage: happyscript_bench [--corpus=DIR] [--filter=TEXT] [--min-time=SECONDS] [--lines=N]\n"
+    "                         [--threads=N] [-O0|-O1|-O2] [--jit=on|off] [--out=FILE]\n"
+    "                         [--baseline=FILE] [--threshold=PERCENT]\n";
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string value;
+        if (parseOption(argv[i], "--corpus=", value)) options.corpus = value;
+        else if (parseOption(argv[i], "--filter=", value)) options.filter = value;
+        else if (parseOption(argv[i], "--baseline=", value)) options.baseline = value;
+        else if (parseOption(argv[i], "--out=", value)) options.out = value;
+        else if (parseOption(argv[i], "--min-time=", value)) options.minTime = std::atof(value.c_str());
+        else if (parseOption(argv[i], "--threshold=", value)) options.threshold = std::atof(value.c_str());
+        else if (parseOption(argv[i], "--lines=", value)) options.generatedLines = std::strtoul(value.c_str(), nullptr, 10);
+        else if (parseOption(argv[i], "--threads=", value)) options.threads = static_cast<unsigned>(std::max(1ul, std::strtoul(value.c_str(), nullptr, 10)));
+        else if (std::strcmp(argv[i], "--jit=on") == 0) options.jit = true;
+        else if (std::strcmp(argv[i], "--jit=off") == 0) options.jit = false;
+        else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' && !argv[i][3])
+            options.optLevel = argv[i][2] - '0';
+        else {
+            std::cerr << (std::strcmp(argv[i], "--help") == 0 ? "" : "Unknown option: " + std::string(argv[i]) + "\n")
+                      << kUsage;
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    try {
+        std::vector<Workload> workloads = loadWorkloads(options);
+        std::vector<Result> results;
+        for (Workload& workload : workloads) benchWorkload(workload, options, results);
+
+        std::string json = toJson(results, options);
+        if (options.out.empty()) {
+            std::cout << json;
+        } else {
+            std::ofstream file(options.out);
+            if (!file) throw std::runtime_error("Could not open file: " + options.out);
+            file << json;
+        }
+        if (!options.baseline.empty() && compareWithBaseline(results, options) > 0) return 1;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compiles every bench/*.happy workload and a generated 1.5 MB script (big
+# enough to be parsed on several threads) to a .happyc image twice. The two
+# images must be byte for byte the same, and the image must run like the source.
+# usage: bench/image_reproducible.sh [path/to/happyscript]
+BIN=${1:-./build/happyscript}
+BENCH=$(dirname "$0")
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+awk 'BEGIN {
+    print "int total = 0;"
+    for (i = 0; i < 40000; i++) {
+        printf "ana (total %% 3 == %d) { total = total + %d; } elsa { total = total - 1; }\n", i % 3, i
+    }
+    print "smile(total);"
+}' > "$DIR/generated.happy"
+
+status=0
+for script in "$BENCH"/*.happy "$DIR/generated.happy"; do
+    name=$(basename "$script" .happy)
+    "$BIN" --compile="$DIR/$name.1.happyc" "$script" || { status=1; continue; }
+    "$BIN" --compile="$DIR/$name.2.happyc" "$script" || { status=1; continue; }
+    if ! cmp -s "$DIR/$name.1.happyc" "$DIR/$name.2.happyc"; then
+        echo "$name.happy: images differ in $(cmp -l "$DIR/$name.1.happyc" "$DIR/$name.2.happyc" | wc -l) bytes"
+        status=1
+    fi
+    if ! "$BIN" "$script" > "$DIR/source.out" 2>&1 ||
+       ! "$BIN" "$DIR/$name.1.happyc" > "$DIR/image.out" 2>&1 ||
+       ! cmp -s "$DIR/source.out" "$DIR/image.out"; then
+        echo "$name.happy: the image does not run like the source"
+        status=1
+    fi
+done
+[ $status = 0 ] && echo "images reproducible"
+exit $status
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs scripts that print or build strings without end through --batch with
+# --max-memory=1M, on both engines, inside a 512 MB address-space cap. Each
+# must fail with the memory limit error, the well-behaved script alongside
+# must pass, and the process must stay within the cap.
+# usage: bench/memory_limits.sh [path/to/happyscript]
+BIN=${1:-./build/happyscript}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+cat > "$DIR/chatty.happy" <<'EOF'
+string line = "0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890";
+int i = 0;
+fun (i < 3000000) {
+    smile(line);
+    i = i + 1;
+}
+EOF
+cat > "$DIR/doubling.happy" <<'EOF'
+string s = "ab";
+fun (0 < 1) {
+    s = s + s;
+}
+EOF
+printf 'smile(42);\n' > "$DIR/well_behaved.happy"
+
+status=0
+for engine in vm tree; do
+    summary=$( (ulimit -v 524288; "$BIN" --batch "$DIR" --max-memory=1M --engine=$engine) 2>&1 > /dev/null)
+    for script in chatty doubling; do
+        if ! echo "$summary" | grep -q "FAIL  $DIR/$script.happy: Error: Memory limit of 1048576 bytes exceeded"; then
+            echo "$engine: $script.happy did not fail on the memory limit"
+            status=1
+        fi
+    done
+    if ! echo "$summary" | grep -q "ok    $DIR/well_behaved.happy"; then
+        echo "$engine: well_behaved.happy failed"
+        status=1
+    fi
+done
+[ $status = 0 ] && echo "memory limits ok"
+exit $status
@@ -0,0 +1,227 @@
+// Throughput and latency of the Scheduler under a mixed load: short scripts
+// (a counted loop of a few hundred to a few thousand iterations) arriving at
+// a steady rate, with some scripts among them that loop forever until their
+// deadline, and some that print forever under a memory limit and must fail
+// on it. The load is run once per slice budget, and for each the rate of
+// short scripts finished and their latency from submit() to the end are
+// printed, along with how long the endless ones overran their deadline. The
+// process's peak RSS goes last, showing that the printing ones stayed
+// within their limits.
+//
+//   scheduler_bench --tasks=4000 --rate=8000 --endless=2 --chatty=1 --timeout=20 --slices=100,1000,10000
+#include "happyscript.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+    size_t tasks = 4000;
+    double rate = 8000;          // arrivals per second
+    double endlessPercent = 2;   // of the tasks
+    double chattyPercent = 1;    // of the tasks
+    double timeoutMs = 20;       // deadline of the endless scripts
+    size_t chattyLimit = 1 << 20; // memory limit of the printing ones
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint64_t> budgets = {100, 1000, 10000, 100000};
+};
+
+const char* const kUsage =
+    "Usage: scheduler_bench [--tasks=N] [--rate=PER_SECOND] [--endless=PERCENT] [--chatty=PERCENT]\n"
+    "                       [--timeout=MS] [--workers=N] [--slices=B1,B2,...]\n";
+
+const char* const kShortScript =
+    "int i = 0;\n"
+    "int sum = 0;\n"
+    "fun (i < n) {\n"
+    "    sum = sum + i % 7;\n"
+    "    i = i + 1;\n"
+    "}\n"
+    "smile(sum);\n";
+
+const char* const kEndlessScript =
+    "int x = 0;\n"
+    "fun (0 < 1) {\n"
+    "    x = x + 1;\n"
+    "}\n";
+
+const char* const kChattyScript =
+    "string line = \"all work and no play makes a script a dull script, all work and no play\";\n"
+    "fun (0 < 1) {\n"
+    "    smile(line);\n"
+    "}\n";
+
+bool parseOption(const char* arg, const char* name, std::string& value) {
+    size_t length = std::strlen(name);
+    if (std::strncmp(arg, name, length) != 0) return false;
+    value = arg + length;
+    return true;
+}
+
+std::vector<uint64_t> parseList(const std::string& text) {
+    std::vector<uint64_t> values;
+    std::stringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) values.push_back(std::max(1ul, std::strtoul(item.c_str(), nullptr, 10)));
+    return values;
+}
+
+double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p / 100 * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int expectedSum(int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i) sum += i % 7;
+    return sum;
+}
+
+// One run; returns the number of scripts that ended other than expected
+size_t runLoad(uint64_t budget, const Options& options,
+                const std::shared_ptr<const CompiledProgram>& shortProgram,
+                const std::shared_ptr<const CompiledProgram>& endlessProgram,
+                const std::shared_ptr<const CompiledProgram>& chattyProgram) {
+    using Clock = std::chrono::steady_clock;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> iterations(200, 4000);
+    std::uniform_real_distribution<double> pick(0, 100);
+    auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::duration<double, std::milli>(options.timeoutMs));
+
+    SchedulerOptions schedulerOptions;
+    schedulerOptions.workers = options.workers;
+    schedulerOptions.sliceBudget = budget;
+    Scheduler scheduler(schedulerOptions);
+
+    struct Submitted {
+        TaskId id;
+        int n; // -1 for an endless script, -2 for a printing one
+    };
+    std::vector<Submitted> submitted;
+    submitted.reserve(options.tasks);
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < options.tasks; ++i) {
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(static_cast<double>(i) / options.rate)));
+        double kind = pick(random);
+        if (kind < options.endlessPercent) {
+            submitted.push_back({scheduler.submit(std::make_unique<ProgramInstance>(endlessProgram), timeout), -1});
+        } else if (kind < options.endlessPercent + options.chattyPercent) {
+            // No deadline: only the memory limit can stop it
+            auto instance = std::make_unique<ProgramInstance>(chattyProgram);
+            instance->setMemoryLimit(options.chattyLimit);
+            submitted.push_back({scheduler.submit(std::move(instance)), -2});
+        } else {
+            int n = iterations(random);
+            auto instance = std::make_unique<ProgramInstance>(shortProgram);
+            instance->set("n", n);
+            submitted.push_back({scheduler.submit(std::move(instance)), n});
+        }
+    }
+
+    std::vector<double> latencies;  // ms, short scripts that finished
+    std::vector<double> overruns;   // ms past the deadline, endless scripts
+    size_t unexpected = 0;
+    uint64_t slices = 0;
+    Clock::time_point lastShort = start;
+    for (const Submitted& task : submitted) {
+        TaskResult result = scheduler.wait(task.id);
+        slices += result.slices;
+        double ms = std::chrono::duration<double, std::milli>(result.latency).count();
+        if (task.n == -2) {
+            if (result.state != TaskState::Failed || result.error.rfind("Memory limit", 0) != 0 ||
+                result.output.size() > options.chattyLimit)
+                ++unexpected;
+            continue;
+        }
+        if (task.n < 0) {
+            if (result.state != TaskState::TimedOut) ++unexpected;
+            overruns.push_back(ms - options.timeoutMs);
+            continue;
+        }
+        if (result.state == TaskState::Finished &&
+            result.output == std::to_string(expectedSum(task.n)) + "\n") {
+            latencies.push_back(ms);
+            lastShort = std::max(lastShort, Clock::now());
+        } else {
+            ++unexpected;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(lastShort - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(overruns.begin(), overruns.end());
+    std::printf("%10llu %9.0f %9.2f %9.2f %9.2f %9.2f %12.2f %9.1f\n",
+                static_cast<unsigned long long>(budget),
+                seconds > 0 ? static_cast<double>(latencies.size()) / seconds : 0.0, percentile(latencies, 50),
+                percentile(latencies, 99), percentile(latencies, 99.9),
+                latencies.empty() ? 0.0 : latencies.back(), percentile(overruns, 99),
+                static_cast<double>(slices) / static_cast<double>(options.tasks));
+    return unexpected;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string value;
+        if (parseOption(argv[i], "--tasks=", value)) options.tasks = std::strtoul(value.c_str(), nullptr, 10);
+        else if (parseOption(argv[i], "--rate=", value)) options.rate = std::max(1.0, std::atof(value.c_str()));
+        else if (parseOption(argv[i], "--endless=", value)) options.endlessPercent = std::atof(value.c_str());
+        else if (parseOption(argv[i], "--chatty=", value)) options.chattyPercent = std::atof(value.c_str());
+        else if (parseOption(argv[i], "--timeout=", value)) options.timeoutMs = std::atof(value.c_str());
+        else if (parseOption(argv[i], "--workers=", value)) options.workers = static_cast<unsigned>(std::max(1ul, std::strtoul(value.c_str(), nullptr, 10)));
+        else if (parseOption(argv[i], "--slices=", value)) options.budgets = parseList(value);
+        else {
+            std::cerr << (std::strcmp(argv[i], "--help") == 0 ? "" : "Unknown option: " + std::string(argv[i]) + "\n")
+                      << kUsage;
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    try {
+        CompileOptions compileOptions;
+        compileOptions.inputs = {"n"};
+        auto shortProgram = CompiledProgram::compile(kShortScript, compileOptions);
+        auto endlessProgram = CompiledProgram::compile(kEndlessScript);
+        auto chattyProgram = CompiledProgram::compile(kChattyScript);
+
+        std::printf("%zu tasks at %.0f/s, %.1f%% endless with a %.1f ms deadline, %.1f%% printing forever "
+                    "with a %zu byte limit, %u workers\n",
+                    options.tasks, options.rate, options.endlessPercent, options.timeoutMs, options.chattyPercent,
+                    options.chattyLimit, options.workers);
+        std::printf("%10s %9s %9s %9s %9s %9s %12s %9s\n", "slice", "short/s", "p50 ms", "p99 ms", "p99.9 ms",
+                    "max ms", "overrun p99", "slices");
+        size_t unexpected = 0;
+        for (uint64_t budget : options.budgets)
+            unexpected += runLoad(budget, options, shortProgram, endlessProgram, chattyProgram);
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        std::printf("peak RSS %ld MB\n", usage.ru_maxrss / 1024);
+        if (unexpected > 0) {
+            std::cerr << "Error: " << unexpected << " scripts ended other than expected\n";
+            return 1;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,320 @@
+#include "compiler.h"
+#include "arrays.h"
+#include "jit.h"
+#include <algorithm>
+#include <stdexcept>
+
+Chunk Compiler::compile(const Ast& program, const std::vector<std::string>& slotNames) {
+    ast = &program;
+    chunk = Chunk{};
+    chunk.slotNames = slotNames;
+    chunk.constants = program.constants;
+    chunk.program = &program;
+    chunk.loopExits.assign(program.loops.size(), 0);
+    chunk.hoistEnds.assign(program.hoistLoops.size(), 0);
+    depth = 0;
+    // After the optimizer, so folded and hoisted nodes have types too
+    std::vector<TypeSet> start = slotTypes;
+    start.resize(slotNames.size(), kUnsetType);
+    types.infer(program, std::move(start));
+    for (NodeId stmt : program.statements) {
+        compileStmt(stmt);
+    }
+    emit(OpCode::Halt);
+    std::sort(chunk.statementPcs.begin(), chunk.statementPcs.end());
+    return std::move(chunk);
+}
+
+uint32_t Chunk::pcOf(NodeId stmt) const {
+    auto it = std::lower_bound(statementPcs.begin(), statementPcs.end(), std::make_pair(stmt, uint32_t(0)));
+    return it->second;
+}
+
+void Compiler::compileStmt(NodeId id) {
+    const Node& node = (*ast)[id];
+    if (kJitAvailable && loopDepth > 0) {
+        chunk.statementPcs.emplace_back(id, static_cast<uint32_t>(chunk.code.size()));
+    }
+    bool profiled = profiling && node.kind != NodeKind::Block;
+    if (profiled) emit(OpCode::ProfileEnter, id);
+    switch (node.kind) {
+        case NodeKind::Print:
+            compileExpr(node.a);
+            emit(OpCode::Print);
+            break;
+        case NodeKind::Assign: {
+            const Node& value = (*ast)[node.a];
+            // x = x + e: the LoadVar still checks x is defined, in order. Two
+            // numbers of different types take the typed path instead.
+            if (value.kind == NodeKind::Binary && value.op == BinaryOp::Add &&
+                (*ast)[value.a].kind == NodeKind::Variable && (*ast)[value.a].b == node.b &&
+                !(provenNumbers(value) && valueType(value.a) != valueType(value.b))) {
+                compileExpr(value.a);
+                compileExpr(value.b);
+                emit(OpCode::AddToVar, node.b);
+                break;
+            }
+            compileExpr(node.a);
+            emit(OpCode::StoreVar, node.b);
+            break;
+        }
+        case NodeKind::Decl: {
+            // A value of known type converts (or not) without a check
+            TypeSet value = valueType(node.a);
+            bool number = value == kIntType || value == kDoubleType;
+            if (node.varType == TokenType::IntType && number) {
+                compileAs(node.a, kIntType);
+                emit(OpCode::StoreVar, node.b);
+                break;
+            }
+            if (node.varType == TokenType::FloatType && number) {
+                compileAs(node.a, kDoubleType);
+                emit(OpCode::StoreVar, node.b);
+                break;
+            }
+            compileExpr(node.a);
+            if ((node.varType == TokenType::StringType && value == kStringType) ||
+                (node.varType == TokenType::IntArrayType && value == kIntArrayType) ||
+                (node.varType == TokenType::FloatArrayType && value == kFloatArrayType)) {
+                emit(OpCode::StoreVar, node.b);
+            } else if (node.varType == TokenType::IntType) {
+                emit(OpCode::DeclInt, node.b);
+            } else if (node.varType == TokenType::FloatType) {
+                emit(OpCode::DeclFloat, node.b);
+            } else if (node.varType == TokenType::StringType) {
+                emit(OpCode::DeclString, node.b);
+            } else if (node.varType == TokenType::IntArrayType) {
+                emit(OpCode::DeclIntArray, node.b);
+            } else if (node.varType == TokenType::FloatArrayType) {
+                emit(OpCode::DeclFloatArray, node.b);
+            } else {
+                throw std::runtime_error("Unknown variable type");
+            }
+            break;
+        }
+        case NodeKind::StoreElement:
+            // Index, then value, like the interpreter; the VM checks the
+            // array's variable is defined
+            compileExpr(node.b);
+            compileExpr(node.a);
+            emit(OpCode::StoreElement, (*ast)[node.c].b);
+            break;
+        case NodeKind::If: {
+            size_t toElse = emitConditionJump(node.a);
+            if (node.b != kNoNode) compileStmt(node.b);
+            if (node.c != kNoNode) {
+                size_t toEnd = emitJump(OpCode::Jump);
+                patchJump(toElse);
+                compileStmt(node.c);
+                patchJump(toEnd);
+            } else {
+                patchJump(toElse);
+            }
+            break;
+        }
+        case NodeKind::While: {
+            if (node.c != kNoNode) emit(OpCode::EnterLoop, node.c);
+            size_t loopStart = chunk.code.size();
+            if (node.c != kNoNode) emit(OpCode::ClosedForm, node.c);
+            size_t jitLoop = chunk.jitLoops.size();
+            if (kJitAvailable) {
+                chunk.jitLoops.push_back({id, 0});
+                emit(OpCode::LoopHead, static_cast<uint32_t>(jitLoop));
+            }
+            size_t toExit = emitConditionJump(node.a);
+            ++loopDepth;
+            compileStmt(node.b);
+            --loopDepth;
+            emit(OpCode::LoopBack, static_cast<uint32_t>(loopStart));
+            patchJump(toExit);
+            if (node.c != kNoNode) chunk.loopExits[node.c] = static_cast<uint32_t>(chunk.code.size());
+            if (kJitAvailable) chunk.jitLoops[jitLoop].exitPc = static_cast<uint32_t>(chunk.code.size());
+            break;
+        }
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                compileStmt(*s);
+            }
+            break;
+        default:
+            throw std::runtime_error("Unknown statement type in execute");
+    }
+    // Loop exits (closed forms, native loops) land here too
+    if (profiled) emit(OpCode::ProfileExit);
+}
+
+void Compiler::compileExpr(NodeId id) {
+    const Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Number:
+        case NodeKind::String:
+            emit(OpCode::Constant, node.a);
+            break;
+        case NodeKind::Variable:
+            emit(types.typeOf(id) & kUnsetType ? OpCode::LoadVar : OpCode::LoadAssigned, node.b);
+            break;
+        case NodeKind::Binary:
+            compileBinary(node);
+            break;
+        case NodeKind::Index:
+            compileExpr(node.a);
+            compileExpr(node.b);
+            emit(OpCode::Index);
+            break;
+        case NodeKind::Call:
+        case NodeKind::ArrayLiteral:
+            for (const NodeId* e = ast->begin(node); e != ast->end(node); ++e) {
+                compileExpr(*e);
+            }
+            if (node.kind == NodeKind::Call) emit(OpCode::Call, node.c);
+            else emit(OpCode::MakeArray, node.b);
+            break;
+        case NodeKind::Hoisted:
+            emit(OpCode::LoadHoisted, node.b);
+            compileExpr(node.a);
+            emit(OpCode::StoreHoisted, node.b);
+            chunk.hoistEnds[node.b] = static_cast<uint32_t>(chunk.code.size());
+            break;
+        default:
+            throw std::runtime_error("Invalid expression");
+    }
+}
+
+// Both operands of a numeric operator are a single known number type
+bool Compiler::provenNumbers(const Node& binary) const {
+    TypeSet left = valueType(binary.a);
+    TypeSet right = valueType(binary.b);
+    if ((left != kIntType && left != kDoubleType) || (right != kIntType && right != kDoubleType)) return false;
+    // 1 == 1.0 compares alternatives, which only the generic operator does
+    return left == right || (binary.op != BinaryOp::Equal && binary.op != BinaryOp::NotEqual);
+}
+
+// Typed when the operand types are proven, with the conversions
+// applyBinary would make spelled out, otherwise the generic operator that
+// checks them at run time
+void Compiler::compileBinary(const Node& node) {
+    if (!provenNumbers(node)) {
+        compileExpr(node.a);
+        compileExpr(node.b);
+        // OpCode::Add..GreaterEqual mirror BinaryOp in declaration order
+        emit(static_cast<OpCode>(static_cast<uint8_t>(OpCode::Add) + static_cast<uint8_t>(node.op)));
+        return;
+    }
+    // '%' truncates both sides; int op int stays int, except '/'
+    bool ints = node.op == BinaryOp::Mod ||
+                (valueType(node.a) == kIntType && valueType(node.b) == kIntType && node.op != BinaryOp::Div);
+    compileAs(node.a, ints ? kIntType : kDoubleType);
+    compileAs(node.b, ints ? kIntType : kDoubleType);
+    switch (node.op) {
+        case BinaryOp::Add: emit(ints ? OpCode::IntAdd : OpCode::DoubleAdd); break;
+        case BinaryOp::Sub: emit(ints ? OpCode::IntSub : OpCode::DoubleSub); break;
+        case BinaryOp::Mul: emit(ints ? OpCode::IntMul : OpCode::DoubleMul); break;
+        case BinaryOp::Div: emit(OpCode::DoubleDiv); break;
+        case BinaryOp::Mod: emit(OpCode::IntMod); break;
+        default: emit(ints ? OpCode::IntCompare : OpCode::DoubleCompare, static_cast<uint32_t>(node.op)); break;
+    }
+}
+
+// Pushes an expression proven to be an int or a double as the given one of
+// the two; a literal is converted here rather than on every run
+void Compiler::compileAs(NodeId id, TypeSet type) {
+    const Node& node = (*ast)[id];
+    if (valueType(id) == type) {
+        compileExpr(id);
+    } else if (node.kind == NodeKind::Number) {
+        const Value& value = chunk.constants[node.a];
+        chunk.constants.push_back(type == kIntType ? Value(static_cast<int>(value.asDouble()))
+                                                   : Value(static_cast<double>(value.asInt())));
+        emit(OpCode::Constant, static_cast<uint32_t>(chunk.constants.size() - 1));
+    } else {
+        compileExpr(id);
+        emit(type == kIntType ? OpCode::ToInt : OpCode::ToDouble);
+    }
+}
+
+// Jumps (once patched) when the condition is false. A comparison fuses
+// with the jump, and a variable compared with a literal or another variable
+// is not even pushed. The left operand must be the variable: swapping the
+// sides would change which operator an error message names.
+size_t Compiler::emitConditionJump(NodeId cond) {
+    const Node& node = (*ast)[cond];
+    if (node.kind != NodeKind::Binary || node.op < BinaryOp::Equal) {
+        compileExpr(cond);
+        return emitJump(OpCode::JumpIfFalse);
+    }
+    const Node& left = (*ast)[node.a];
+    const Node& right = (*ast)[node.b];
+    Chunk::Branch branch{node.op};
+    OpCode op = OpCode::JumpUnless;
+    if (left.kind == NodeKind::Variable && (right.kind == NodeKind::Number || right.kind == NodeKind::String)) {
+        op = OpCode::JumpUnlessVarConst;
+        branch.left = left.b;
+        branch.right = right.a;
+    } else if (left.kind == NodeKind::Variable && right.kind == NodeKind::Variable) {
+        op = OpCode::JumpUnlessVarVar;
+        branch.left = left.b;
+        branch.right = right.b;
+    } else {
+        compileExpr(node.a);
+        compileExpr(node.b);
+    }
+    chunk.branches.push_back(branch);
+    return emitJump(op, static_cast<uint32_t>(chunk.branches.size() - 1));
+}
+
+void Compiler::emit(OpCode op, uint32_t operand) {
+    chunk.code.push_back({op, operand});
+    switch (op) {
+        case OpCode::Constant:
+        case OpCode::LoadVar:
+        case OpCode::LoadAssigned:
+            if (++depth > chunk.maxStack) chunk.maxStack = depth;
+            break;
+        case OpCode::Jump:
+        case OpCode::LoopBack:
+        case OpCode::Halt:
+        case OpCode::EnterLoop:
+        case OpCode::ClosedForm:
+        case OpCode::StoreHoisted:
+        case OpCode::LoopHead:
+        case OpCode::JumpUnlessVarConst:
+        case OpCode::JumpUnlessVarVar:
+        case OpCode::ProfileEnter:
+        case OpCode::ProfileExit:
+        case OpCode::ToDouble:
+        case OpCode::ToInt:
+            break;
+        case OpCode::LoadHoisted:
+            // The push on a hit stands in for the expression it skips
+            break;
+        case OpCode::AddToVar:
+        case OpCode::JumpUnless:
+        case OpCode::StoreElement:
+            depth -= 2;
+            break;
+        case OpCode::Call:
+            depth -= builtinInfo(static_cast<Builtin>(operand)).arity - 1;
+            break;
+        case OpCode::MakeArray:
+            // An empty literal pushes one value
+            depth -= operand;
+            if (++depth > chunk.maxStack) chunk.maxStack = depth;
+            break;
+        default:
+            // stores, binary operators, Print and JumpIfFalse all pop one value
+            --depth;
+            break;
+    }
+}
+
+size_t Compiler::emitJump(OpCode op, uint32_t operand) {
+    emit(op, operand);
+    return chunk.code.size() - 1;
+}
+
+void Compiler::patchJump(size_t at) {
+    Instruction& jump = chunk.code[at];
+    uint32_t target = static_cast<uint32_t>(chunk.code.size());
+    if (jump.op == OpCode::Jump || jump.op == OpCode::JumpIfFalse) jump.operand = target;
+    else chunk.branches[jump.operand].target = target;
+}
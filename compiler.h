@@ -0,0 +1,118 @@
+#pragma once
+
+#include "ast.h"
+#include "type_checker.h"
+#include "value.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class OpCode : uint8_t {
+    Constant,       // push constants[operand]
+    LoadVar,        // push slots[operand]
+    LoadAssigned,   // same for a slot the TypeChecker proved assigned
+    StoreVar,       // pop into slots[operand]
+    AddToVar,       // pop right and the copy of slots[operand] under it; slots[operand] += right
+    DeclInt,        // pop, convert to int, store into slots[operand]
+    DeclFloat,      // pop, convert to double, store into slots[operand]
+    DeclString,     // pop, check string, store into slots[operand]
+    DeclIntArray,   // pop, convert to int[] (see declareArray), store into slots[operand]
+    DeclFloatArray, // same for float[]
+    Add, Sub, Mul, Div, Mod,
+    Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual,
+    // Typed forms, for operands whose types the TypeChecker has proven
+    IntAdd, IntSub, IntMul, IntMod,
+    DoubleAdd, DoubleSub, DoubleMul, DoubleDiv,
+    IntCompare,     // pop two ints, push 0/1 for BinaryOp operand
+    DoubleCompare,  // same for two doubles
+    ToDouble,       // convert the int on top of the stack
+    ToInt,          // truncate the double on top of the stack, as 'int' and '%' do
+    Index,          // pop index and array, push the element
+    Call,           // pop the arguments of Builtin operand, push its result
+    MakeArray,      // pop operand elements, push them as one array
+    StoreElement,   // pop value and index, store the element into the array in slots[operand]
+    Print,          // pop and print
+    Jump,           // pc = operand
+    LoopBack,       // pc = operand, the start of a 'fun' loop; where a run in slices may stop (see VM::resume)
+    JumpIfFalse,    // pop condition, pc = operand when falsy
+    JumpUnless,     // pop right and left, pc = branches[operand].target unless left relation right
+    JumpUnlessVarConst, // same for slots[left] and constants[right], without pushing them
+    JumpUnlessVarVar,   // same for slots[left] and slots[right]
+    EnterLoop,      // new stamp for loop operand (see LoopRuntime)
+    ClosedForm,     // finish loop operand at once if possible, then pc = loopExits[operand]
+    LoadHoisted,    // push cache operand and pc = hoistEnds[operand] if still valid
+    StoreHoisted,   // copy the top of the stack into cache operand
+    LoopHead,       // count an iteration of jitLoops[operand], run its native code once compiled
+    ProfileEnter,   // statement operand starts (only emitted for --profile)
+    ProfileExit,    // the innermost profiled statement ends
+    Halt,
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t operand;
+};
+
+// Flat bytecode for a whole program. Variables are global and already have
+// a fixed slot from the Resolver, so the VM never hashes strings.
+struct Chunk {
+    std::vector<Instruction> code;
+    std::vector<Value> constants;
+    std::vector<std::string> slotNames;
+    size_t maxStack = 0;
+    // Compare-and-branch for 'ana'/'fun' conditions that are comparisons
+    struct Branch {
+        BinaryOp relation;
+        uint32_t left = 0;   // slot (JumpUnlessVar*)
+        uint32_t right = 0;  // constant or slot (JumpUnlessVar*)
+        uint32_t target = 0; // taken when the comparison is false
+    };
+    std::vector<Branch> branches;
+    // Loop optimizer side tables, shared with the Ast (see loops.h)
+    const Ast* program = nullptr;
+    std::vector<uint32_t> loopExits;   // per loop
+    std::vector<uint32_t> hoistEnds;   // per Hoisted cache: just past its StoreHoisted
+    // JIT side tables (see jit.h), only filled where the JIT is available
+    struct JitLoop {
+        NodeId loop;
+        uint32_t exitPc;
+    };
+    std::vector<JitLoop> jitLoops;
+    std::vector<std::pair<NodeId, uint32_t>> statementPcs; // statements inside loops, sorted
+    uint32_t pcOf(NodeId stmt) const;
+};
+
+class Compiler {
+public:
+    // The program must have been through Resolver
+    Chunk compile(const Ast& program, const std::vector<std::string>& slotNames);
+
+    // Brackets every statement but Blocks with ProfileEnter/ProfileExit
+    void setProfiling(bool enabled) { profiling = enabled; }
+
+    // What each slot may hold when a run starts; unset (the default for
+    // slots past the end) unless the host binds variables (see
+    // ProgramInstance::set)
+    void setSlotTypes(std::vector<TypeSet> types) { slotTypes = std::move(types); }
+
+private:
+    const Ast* ast = nullptr;
+    bool profiling = false;
+    std::vector<TypeSet> slotTypes;
+    TypeChecker types;
+    Chunk chunk;
+    size_t depth = 0;
+    size_t loopDepth = 0;
+
+    void compileStmt(NodeId id);
+    void compileExpr(NodeId id);
+    void compileBinary(const Node& node);
+    void compileAs(NodeId id, TypeSet type);
+    bool provenNumbers(const Node& binary) const;
+    // What an expression may evaluate to, leaving out kUnsetType
+    TypeSet valueType(NodeId id) const { return types.typeOf(id) & kAnyType; }
+    size_t emitConditionJump(NodeId cond);
+    void emit(OpCode op, uint32_t operand = 0);
+    size_t emitJump(OpCode op, uint32_t operand = 0);
+    void patchJump(size_t at);
+};
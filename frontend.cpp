@@ -0,0 +1,243 @@
+#include "frontend.h"
+#include "batch.h"
+#include "lexer.h"
+#include "parser.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Pieces smaller than this are not worth a task of their own
+constexpr size_t kMinPieceBytes = 256 * 1024;
+// Pieces per thread, so a thread that finishes early can steal another
+constexpr size_t kPiecesPerThread = 4;
+
+struct Piece {
+    Piece(std::string_view text, uint32_t firstLine) : text(text), firstLine(firstLine) {}
+
+    std::string_view text;
+    uint32_t firstLine = 1;
+
+    Ast ast;
+    bool failed = false;
+    // Where the piece's ids land in the stitched Ast
+    std::vector<uint32_t> names;
+    std::vector<uint32_t> constants;
+    size_t nodeBase = 0;
+    size_t listBase = 0;
+    size_t statementBase = 0;
+    size_t positionBase = 0;
+};
+
+Ast parseWhole(std::string_view source, uint32_t firstLine = 1) {
+    Lexer lexer(source, firstLine);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens, lexer.symbols());
+    return parser.parseProgram();
+}
+
+bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Whether the next token after offset is 'elsa', which would make the
+// statement before it go on
+bool elsaFollows(std::string_view source, size_t offset) {
+    while (offset < source.size() && isSpace(source[offset])) ++offset;
+    return source.compare(offset, 4, "elsa") == 0 &&
+           (offset + 4 == source.size() || !std::isalnum(static_cast<unsigned char>(source[offset + 4])));
+}
+
+// Cuts source into at most count pieces of about the same size, each ending
+// with a line break after a top-level ';' or '}'. Follows just enough of the
+// Lexer to know where literals and blocks are and which line each piece
+// starts on; past anything the Lexer would reject (an unterminated literal,
+// a stray '}') it stops cutting and leaves the error to the parse.
+std::vector<Piece> cut(std::string_view source, size_t count) {
+    std::vector<Piece> pieces;
+    size_t size = source.size();
+    size_t target = size / count;
+    size_t start = 0;
+    uint32_t startLine = 1;
+    uint32_t line = 1;
+    size_t depth = 0;
+    char last = '\0'; // the last character of the last token
+    size_t i = 0;
+    while (i < size && pieces.size() + 1 < count) {
+        char c = source[i];
+        if (c == '\n') {
+            ++line;
+            ++i;
+            if (depth == 0 && (last == ';' || last == '}') && i - start >= target && !elsaFollows(source, i)) {
+                pieces.emplace_back(source.substr(start, i - start), startLine);
+                start = i;
+                startLine = line;
+            }
+            continue;
+        }
+        if (c == '"') {
+            size_t end = source.find('"', i + 1);
+            if (end == std::string_view::npos) break;
+            line += static_cast<uint32_t>(std::count(source.begin() + i + 1, source.begin() + end, '\n'));
+            i = end + 1;
+            last = '"';
+            continue;
+        }
+        if (c == '\'') {
+            // No line counted, as in the Lexer
+            size_t end = i + charLiteralLength(source.substr(i)) - 1;
+            if (end >= size || source[end] != '\'') break;
+            i = end + 1;
+            last = '\'';
+            continue;
+        }
+        if (c == '{') ++depth;
+        else if (c == '}' && depth-- == 0) break;
+        if (!isSpace(c)) last = c;
+        ++i;
+    }
+    pieces.emplace_back(source.substr(start), startLine);
+    return pieces;
+}
+
+// Gives every piece's names and constants their id in the stitched Ast, in
+// order of first appearance like one Lexer and Parser would, and works out
+// where each piece's nodes, lists and statements go
+void number(std::vector<Piece>& pieces, Ast& program) {
+    std::unordered_map<std::string, uint32_t> nameIds;
+    std::unordered_map<uint64_t, uint32_t> numberIds;
+    std::unordered_map<std::string, uint32_t> stringIds;
+    size_t nodes = 0, lists = 0, statements = 0, positions = 0;
+    for (Piece& piece : pieces) {
+        piece.names.reserve(piece.ast.names.size());
+        for (std::string& name : piece.ast.names) {
+            auto found = nameIds.emplace(name, static_cast<uint32_t>(program.names.size()));
+            if (found.second) program.names.push_back(std::move(name));
+            piece.names.push_back(found.first->second);
+        }
+        piece.constants.reserve(piece.ast.constants.size());
+        for (Value& constant : piece.ast.constants) {
+            uint32_t id = static_cast<uint32_t>(program.constants.size());
+            bool added;
+            if (constant.isString()) {
+                auto found = stringIds.emplace(constant.str(), id);
+                added = found.second;
+                id = found.first->second;
+            } else {
+                double value = constant.asDouble();
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof bits);
+                auto found = numberIds.emplace(bits, id);
+                added = found.second;
+                id = found.first->second;
+            }
+            if (added) program.constants.push_back(std::move(constant));
+            piece.constants.push_back(id);
+        }
+        piece.nodeBase = nodes;
+        piece.listBase = lists;
+        piece.statementBase = statements;
+        piece.positionBase = positions;
+        nodes += piece.ast.nodes.size();
+        lists += piece.ast.lists.size();
+        statements += piece.ast.statements.size();
+        positions += piece.ast.statementPositions.size();
+    }
+    program.nodes.resize(nodes);
+    program.lists.resize(lists);
+    program.statements.resize(statements);
+    program.statementPositions.resize(positions);
+}
+
+// Copies a numbered piece into its place in program, then frees it
+void stitch(Piece& piece, Ast& program) {
+    NodeId base = static_cast<NodeId>(piece.nodeBase);
+    auto child = [base](NodeId id) { return id == kNoNode ? id : id + base; };
+    Node* out = program.nodes.data() + piece.nodeBase;
+    for (Node node : piece.ast.nodes) {
+        switch (node.kind) {
+            case NodeKind::Number:
+            case NodeKind::String:
+                node.a = piece.constants[node.a];
+                break;
+            case NodeKind::Variable:
+                node.a = piece.names[node.a];
+                break;
+            case NodeKind::Call:
+            case NodeKind::ArrayLiteral:
+            case NodeKind::Block:
+                node.a += static_cast<uint32_t>(piece.listBase);
+                break;
+            case NodeKind::Print:
+                node.a = child(node.a);
+                break;
+            case NodeKind::Assign:
+            case NodeKind::Decl:
+                node.a = child(node.a);
+                node.c = piece.names[node.c];
+                break;
+            case NodeKind::Binary:
+            case NodeKind::Index:
+            case NodeKind::While: // c is not filled in until the loop optimizer runs
+                node.a = child(node.a);
+                node.b = child(node.b);
+                break;
+            case NodeKind::StoreElement:
+            case NodeKind::If:
+                node.a = child(node.a);
+                node.b = child(node.b);
+                node.c = child(node.c);
+                break;
+            case NodeKind::Hoisted: // made by the loop optimizer, never by the Parser
+                break;
+        }
+        *out++ = node;
+    }
+    std::transform(piece.ast.lists.begin(), piece.ast.lists.end(), program.lists.begin() + piece.listBase,
+                   [base](NodeId id) { return id + base; });
+    std::transform(piece.ast.statements.begin(), piece.ast.statements.end(),
+                   program.statements.begin() + piece.statementBase, [base](NodeId id) { return id + base; });
+    std::transform(piece.ast.statementPositions.begin(), piece.ast.statementPositions.end(),
+                   program.statementPositions.begin() + piece.positionBase,
+                   [base](const auto& entry) { return std::make_pair(entry.first + base, entry.second); });
+    piece.ast = Ast();
+}
+
+} // namespace
+
+Ast parseSource(std::string_view source, unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t count = std::min<size_t>(size_t{threads} * kPiecesPerThread, source.size() / kMinPieceBytes);
+    if (threads == 1 || source.size() < kParallelParseBytes || count < 2) return parseWhole(source);
+
+    std::vector<Piece> pieces = cut(source, count);
+    if (pieces.size() < 2) return parseWhole(source);
+
+    WorkStealingPool pool(static_cast<unsigned>(std::min<size_t>(threads, pieces.size())));
+    pool.start(pieces.size(), [&pieces](size_t i) {
+        try {
+            pieces[i].ast = parseWhole(pieces[i].text, pieces[i].firstLine);
+        }
+        catch (const std::exception&) {
+            pieces[i].failed = true;
+        }
+    });
+    pool.wait();
+    for (const Piece& piece : pieces) {
+        // The error one parse would raise first may be a lexer error in a
+        // later piece
+        if (piece.failed) return parseWhole(source);
+    }
+
+    Ast program;
+    number(pieces, program);
+    pool.start(pieces.size(), [&pieces, &program](size_t i) { stitch(pieces[i], program); });
+    pool.wait();
+    return program;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "ast.h"
+#include <cstddef>
+#include <string_view>
+
+// Sources smaller than this are lexed and parsed in one piece; below it the
+// threads cost more than they save
+constexpr size_t kParallelParseBytes = 1 << 20;
+
+// Lexes and parses source into an Ast, like Parser(Lexer(source).tokenize(),
+// ...).parseProgram(). A large source is cut after top-level statements (a
+// ';' or '}' ending a line outside braces and literals, not followed by
+// 'elsa'), the pieces are lexed and parsed on a WorkStealingPool, and their
+// Asts are stitched together in order, with names, constants and node ids
+// renumbered as one parse would have numbered them. The result is the same
+// Ast either way. When any piece fails the whole source is parsed again in
+// one piece, so errors read exactly as they would without threads.
+//
+// threads: 0 for one per hardware thread; 1 never starts any
+Ast parseSource(std::string_view source, unsigned threads = 0);
@@ -0,0 +1,89 @@
+#include "happyscript.h"
+#include "frontend.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "source.h"
+#include <stdexcept>
+
+std::shared_ptr<const CompiledProgram> CompiledProgram::compile(std::string_view source,
+                                                                const CompileOptions& options) {
+    // Not make_shared: the constructor is private, and the Chunk must be
+    // built in place because it points at the Ast
+    std::shared_ptr<CompiledProgram> compiled(new CompiledProgram());
+    compiled->program = parseSource(source);
+
+    Resolver resolver;
+    for (const std::string& input : options.inputs) resolver.declareInput(input);
+    resolver.resolve(compiled->program);
+
+    // The host reads variables back after a run, so no store is dead
+    Optimizer optimizer(options.optLevel);
+    optimizer.setKeepStores(true);
+    optimizer.optimize(compiled->program);
+
+    compiled->slotNames = resolver.slotNames();
+    // ProgramInstance::set can bind any variable before a run
+    Compiler compiler;
+    compiler.setSlotTypes(std::vector<TypeSet>(compiled->slotNames.size(), kAnyType | kUnsetType));
+    compiled->bytecode = compiler.compile(compiled->program, compiled->slotNames);
+    for (uint32_t slot = 0; slot < compiled->slotNames.size(); ++slot) {
+        compiled->slots.emplace(compiled->slotNames[slot], slot);
+    }
+    return compiled;
+}
+
+std::shared_ptr<const CompiledProgram> CompiledProgram::compileFile(const std::string& path,
+                                                                    const CompileOptions& options) {
+    SourceBuffer source = SourceBuffer::fromFile(path);
+    return compile(source.view(), options);
+}
+
+uint32_t CompiledProgram::slotOf(std::string_view name) const {
+    auto it = slots.find(name);
+    return it != slots.end() ? it->second : kNoSlot;
+}
+
+ProgramInstance::ProgramInstance(std::shared_ptr<const CompiledProgram> program)
+    : compiled(std::move(program)) {
+    if (!compiled) throw std::runtime_error("No program");
+}
+
+uint32_t ProgramInstance::requireSlot(std::string_view name) const {
+    uint32_t slot = compiled->slotOf(name);
+    if (slot == kNoSlot) throw std::runtime_error("Unknown variable: " + std::string(name));
+    return slot;
+}
+
+void ProgramInstance::set(std::string_view name, Value value) {
+    vm.bind(requireSlot(name), std::move(value));
+}
+
+void ProgramInstance::set(uint32_t slot, Value value) {
+    if (slot >= compiled->variables().size()) throw std::runtime_error("Unknown variable slot");
+    vm.bind(slot, std::move(value));
+}
+
+void ProgramInstance::run() {
+    vm.run(compiled->chunk());
+}
+
+void ProgramInstance::start() {
+    vm.start(compiled->chunk());
+}
+
+bool ProgramInstance::resume(uint64_t budget) {
+    return vm.resume(budget);
+}
+
+const Value& ProgramInstance::get(std::string_view name) const {
+    return get(requireSlot(name));
+}
+
+const Value& ProgramInstance::get(uint32_t slot) const {
+    const Value* value = vm.variable(slot);
+    if (!value) {
+        if (slot >= compiled->variables().size()) throw std::runtime_error("Unknown variable slot");
+        throw std::runtime_error("Undefined variable: " + compiled->variables()[slot]);
+    }
+    return *value;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// Embedding API: compile a script once, then run it any number of times with
+// different inputs, from as many threads as needed.
+//
+//   CompileOptions options;
+//   options.inputs = {"price", "qty"};
+//   auto program = CompiledProgram::compile("float total = price * qty;", options);
+//
+//   ProgramInstance instance(program);   // one per thread
+//   instance.set("price", 2.5);
+//   instance.set("qty", 4);
+//   instance.run();
+//   double total = instance.get("total").asDouble();
+//
+// A CompiledProgram is immutable once built and may be shared freely. An
+// instance owns all the state of a run (variables, stack, loop caches, native
+// loop code, output buffer), so instances never touch each other; a single
+// instance must not be used from two threads at once.
+
+#include "ast.h"
+#include "compiler.h"
+#include "output.h"
+#include "value.h"
+#include "vm.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct CompileOptions {
+    int optLevel = 1; // as -O on the command line
+    // Variables the host sets before each run. The script may read them
+    // without assigning them first.
+    std::vector<std::string> inputs;
+};
+
+constexpr uint32_t kNoSlot = UINT32_MAX;
+
+class CompiledProgram {
+public:
+    // Lex, parse, resolve, optimize and compile to bytecode. Errors are
+    // thrown as std::runtime_error with the messages the command line prints.
+    static std::shared_ptr<const CompiledProgram> compile(std::string_view source,
+                                                          const CompileOptions& options = {});
+    static std::shared_ptr<const CompiledProgram> compileFile(const std::string& path,
+                                                              const CompileOptions& options = {});
+
+    CompiledProgram(const CompiledProgram&) = delete;
+    CompiledProgram& operator=(const CompiledProgram&) = delete;
+
+    // Slot of a variable the program uses or an input, or kNoSlot. Looking
+    // a slot up once and using the slot overloads skips the name lookup.
+    uint32_t slotOf(std::string_view name) const;
+    const std::vector<std::string>& variables() const { return slotNames; }
+
+    const Ast& ast() const { return program; }
+    const Chunk& chunk() const { return bytecode; }
+
+private:
+    CompiledProgram() = default;
+
+    Ast program;
+    Chunk bytecode; // refers to program, so neither may move
+    std::vector<std::string> slotNames;
+    std::unordered_map<std::string_view, uint32_t> slots; // keys view slotNames
+};
+
+class ProgramInstance {
+public:
+    explicit ProgramInstance(std::shared_ptr<const CompiledProgram> program);
+
+    // Inputs stay set for every later run until set again. Throws
+    // "Unknown variable: <name>" for a name with no slot.
+    void set(std::string_view name, Value value);
+    void set(uint32_t slot, Value value);
+
+    // Runs the program from its inputs; all other variables start unset
+    void run();
+    // run() in slices: start(), then resume() until it returns true, each
+    // call stopping after budget loop iterations (0: no limit) so the thread
+    // can do other work in between. See VM::resume.
+    void start();
+    bool resume(uint64_t budget);
+
+    // A variable after run(). Throws "Undefined variable: <name>" when the
+    // last run did not assign it.
+    const Value& get(std::string_view name) const;
+    const Value& get(uint32_t slot) const;
+
+    // 'smile' goes to stdout unless replaced, e.g. by a StringSink
+    void setOutput(std::unique_ptr<OutputSink> sink) { vm.setOutput(std::move(sink)); }
+    void setJit(bool enabled) { vm.setJit(enabled); }
+
+    // Current and peak bytes of the instance's strings, arrays and
+    // variables; the shared CompiledProgram is not counted. A run that would
+    // go past setMemoryLimit(bytes) throws "Memory limit of <bytes> bytes
+    // exceeded" (0, the default, for no limit).
+    const MemoryAccount& memory() const { return vm.memory(); }
+    void setMemoryLimit(size_t bytes) { vm.memory().setLimit(bytes); }
+
+    const CompiledProgram& program() const { return *compiled; }
+
+private:
+    std::shared_ptr<const CompiledProgram> compiled;
+    VM vm;
+
+    uint32_t requireSlot(std::string_view name) const;
+};
@@ -0,0 +1,334 @@
+#include "image.h"
+#include "arrays.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unistd.h>
+
+namespace {
+
+constexpr char kMagic[8] = {'H', 'A', 'P', 'P', 'Y', 'C', '\0', '\n'};
+constexpr uint32_t kByteOrder = 0x01020304;
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceHash;
+    uint64_t checksum;    // contentHash of everything after the header
+    uint64_t payloadSize;
+    uint32_t nodeSize;
+    uint32_t nodeCount;
+    uint32_t listCount;
+    uint32_t statementCount;
+    uint32_t positionCount;
+    uint32_t constantCount;
+    uint32_t nameCount;
+    uint32_t slotCount;
+    uint32_t reserved;    // no tail padding, so {} zeroes every byte written
+};
+static_assert(sizeof(ImageHeader) == 80, "image headers carry no padding");
+
+enum ConstantKind : uint32_t { kIntConstant, kDoubleConstant, kStringConstant };
+
+struct ConstantRecord {
+    uint32_t kind;
+    uint32_t length; // strings only
+    uint64_t bits;   // the int or double, or a string's offset in the string bytes
+};
+
+struct StringRecord {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct PositionRecord {
+    NodeId stmt;
+    uint32_t line;
+    uint32_t column;
+};
+
+[[noreturn]] void invalid(const std::string& reason) {
+    throw std::runtime_error("Invalid program image: " + reason);
+}
+
+class ImageWriter {
+public:
+    template <typename T>
+    void array(const T* data, size_t count) {
+        bytes.resize((bytes.size() + 7) & ~size_t(7), '\0');
+        bytes.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+    }
+    std::string bytes;
+};
+
+class ImageReader {
+public:
+    explicit ImageReader(std::string_view payload) : payload(payload) {}
+
+    template <typename T>
+    void array(std::vector<T>& out, size_t count) {
+        pos = (pos + 7) & ~size_t(7);
+        if (pos > payload.size() || count > (payload.size() - pos) / sizeof(T)) invalid("truncated");
+        out.resize(count);
+        if (count) std::memcpy(out.data(), payload.data() + pos, count * sizeof(T));
+        pos += count * sizeof(T);
+    }
+    std::string_view rest() const { return payload.substr(std::min((pos + 7) & ~size_t(7), payload.size())); }
+
+private:
+    std::string_view payload;
+    size_t pos = 0;
+};
+
+// Every reference in range, children before their parents (so no cycles),
+// and nothing the optimizer adds: engines and the optimizer trust all of it
+void validate(const Ast& program, size_t slotCount) {
+    const size_t nodeCount = program.nodes.size();
+    auto child = [](uint32_t ref, NodeId parent) { return ref < parent; };
+    for (NodeId id = 0; id < nodeCount; ++id) {
+        const Node& node = program.nodes[id];
+        bool ok = false;
+        switch (node.kind) {
+            case NodeKind::Number:
+            case NodeKind::String:
+                ok = node.a < program.constants.size();
+                break;
+            case NodeKind::Variable:
+                ok = node.a < program.names.size() && node.b < slotCount;
+                break;
+            case NodeKind::Binary:
+                ok = node.op <= BinaryOp::GreaterEqual && child(node.a, id) && child(node.b, id);
+                break;
+            case NodeKind::Index:
+                ok = child(node.a, id) && child(node.b, id);
+                break;
+            case NodeKind::StoreElement:
+                // c is the array's Variable, checked as a node of its own
+                ok = child(node.a, id) && child(node.b, id) && child(node.c, id) &&
+                     program.nodes[node.c].kind == NodeKind::Variable;
+                break;
+            case NodeKind::Print:
+                ok = child(node.a, id);
+                break;
+            case NodeKind::Decl:
+                if (node.varType != TokenType::IntType && node.varType != TokenType::FloatType &&
+                    node.varType != TokenType::StringType && node.varType != TokenType::IntArrayType &&
+                    node.varType != TokenType::FloatArrayType) break;
+                [[fallthrough]];
+            case NodeKind::Assign:
+                ok = child(node.a, id) && node.b < slotCount && node.c < program.names.size();
+                break;
+            case NodeKind::If:
+                ok = child(node.a, id) && child(node.b, id) && (node.c == kNoNode || child(node.c, id));
+                break;
+            case NodeKind::While:
+                ok = child(node.a, id) && child(node.b, id) && node.c == kNoNode;
+                break;
+            case NodeKind::Call:
+                if (node.c >= kBuiltinCount || node.b != builtinInfo(static_cast<Builtin>(node.c)).arity) break;
+                [[fallthrough]];
+            case NodeKind::ArrayLiteral:
+            case NodeKind::Block:
+                ok = node.a <= program.lists.size() && node.b <= program.lists.size() - node.a;
+                for (uint32_t i = 0; ok && i < node.b; ++i) ok = child(program.lists[node.a + i], id);
+                break;
+            default:
+                break;
+        }
+        if (!ok) invalid("bad node " + std::to_string(id));
+    }
+    for (NodeId stmt : program.statements) {
+        if (stmt >= nodeCount) invalid("bad statement");
+    }
+}
+
+} // namespace
+
+// 64-bit words through a multiply-rotate mix. Only for spotting corruption
+// and naming cache entries, not for security.
+uint64_t contentHash(std::string_view data) {
+    const uint64_t kMul1 = 0x9E3779B97F4A7C15ull;
+    const uint64_t kMul2 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t hash = kMul1 ^ (data.size() * kMul2);
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, 8);
+        hash ^= word * kMul2;
+        hash = ((hash << 31) | (hash >> 33)) * kMul1;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data.data() + i, data.size() - i);
+    hash ^= tail * kMul2;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    return hash ^ (hash >> 33);
+}
+
+bool isProgramImage(std::string_view data) {
+    return data.size() >= sizeof kMagic && std::memcmp(data.data(), kMagic, sizeof kMagic) == 0;
+}
+
+uint64_t programImageSourceHash(std::string_view data) {
+    if (!isProgramImage(data) || data.size() < sizeof(ImageHeader)) return 0;
+    ImageHeader header;
+    std::memcpy(&header, data.data(), sizeof header);
+    return header.sourceHash;
+}
+
+void writeProgramImage(const std::string& path, const Ast& program,
+                       const std::vector<std::string>& slotNames, uint64_t sourceHash) {
+    // All string bytes go into one pool at the end
+    std::string strings;
+    auto addString = [&strings](const std::string& text) {
+        if (strings.size() + text.size() > UINT32_MAX) throw std::runtime_error("Program too large for an image");
+        StringRecord record{static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size())};
+        strings += text;
+        return record;
+    };
+
+    std::vector<PositionRecord> positions;
+    positions.reserve(program.statementPositions.size());
+    for (const auto& [stmt, at] : program.statementPositions) positions.push_back({stmt, at.line, at.column});
+
+    std::vector<ConstantRecord> constants;
+    constants.reserve(program.constants.size());
+    for (const Value& value : program.constants) {
+        ConstantRecord record{};
+        if (value.isInt()) {
+            record.kind = kIntConstant;
+            record.bits = static_cast<uint32_t>(value.asInt());
+        } else if (value.isDouble()) {
+            record.kind = kDoubleConstant;
+            double d = value.asDouble();
+            std::memcpy(&record.bits, &d, sizeof record.bits);
+        } else {
+            StringRecord text = addString(value.str());
+            record.kind = kStringConstant;
+            record.length = text.length;
+            record.bits = text.offset;
+        }
+        constants.push_back(record);
+    }
+
+    std::vector<StringRecord> names;
+    std::unordered_map<std::string, uint32_t> nameIds;
+    names.reserve(program.names.size());
+    for (const std::string& name : program.names) {
+        nameIds.emplace(name, static_cast<uint32_t>(names.size()));
+        names.push_back(addString(name));
+    }
+    // Every slot belongs to a name the parser saw
+    std::vector<uint32_t> slots;
+    slots.reserve(slotNames.size());
+    for (const std::string& name : slotNames) slots.push_back(nameIds.at(name));
+
+    ImageWriter payload;
+    payload.array(program.nodes.data(), program.nodes.size());
+    payload.array(program.lists.data(), program.lists.size());
+    payload.array(program.statements.data(), program.statements.size());
+    payload.array(positions.data(), positions.size());
+    payload.array(constants.data(), constants.size());
+    payload.array(names.data(), names.size());
+    payload.array(slots.data(), slots.size());
+    payload.array(strings.data(), strings.size());
+
+    ImageHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof kMagic);
+    header.version = kImageVersion;
+    header.byteOrder = kByteOrder;
+    header.sourceHash = sourceHash;
+    header.checksum = contentHash(payload.bytes);
+    header.payloadSize = payload.bytes.size();
+    header.nodeSize = sizeof(Node);
+    header.nodeCount = static_cast<uint32_t>(program.nodes.size());
+    header.listCount = static_cast<uint32_t>(program.lists.size());
+    header.statementCount = static_cast<uint32_t>(program.statements.size());
+    header.positionCount = static_cast<uint32_t>(positions.size());
+    header.constantCount = static_cast<uint32_t>(constants.size());
+    header.nameCount = static_cast<uint32_t>(names.size());
+    header.slotCount = static_cast<uint32_t>(slots.size());
+
+    std::string temporary = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("Could not open file: " + path);
+        file.write(reinterpret_cast<const char*>(&header), sizeof header);
+        file.write(payload.bytes.data(), static_cast<std::streamsize>(payload.bytes.size()));
+        if (!file.flush()) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Could not write file: " + path);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not write file: " + path);
+    }
+}
+
+ProgramImage readProgramImage(std::string_view data) {
+    if (!isProgramImage(data)) invalid("not an image");
+    if (data.size() < sizeof(ImageHeader)) invalid("truncated");
+    ImageHeader header;
+    std::memcpy(&header, data.data(), sizeof header);
+    if (header.version != kImageVersion) invalid("version " + std::to_string(header.version) + ", expected " + std::to_string(kImageVersion));
+    if (header.byteOrder != kByteOrder || header.nodeSize != sizeof(Node)) invalid("written by an incompatible build");
+    std::string_view payload = data.substr(sizeof header);
+    if (payload.size() != header.payloadSize) invalid("truncated");
+    if (contentHash(payload) != header.checksum) invalid("checksum mismatch");
+
+    ProgramImage image;
+    Ast& program = image.program;
+    ImageReader reader(payload);
+    std::vector<PositionRecord> positions;
+    std::vector<ConstantRecord> constants;
+    std::vector<StringRecord> names;
+    std::vector<uint32_t> slots;
+    reader.array(program.nodes, header.nodeCount);
+    reader.array(program.lists, header.listCount);
+    reader.array(program.statements, header.statementCount);
+    reader.array(positions, header.positionCount);
+    reader.array(constants, header.constantCount);
+    reader.array(names, header.nameCount);
+    reader.array(slots, header.slotCount);
+    std::string_view strings = reader.rest();
+
+    auto text = [&strings](uint64_t offset, uint32_t length) {
+        if (offset > strings.size() || length > strings.size() - offset) invalid("bad string");
+        return strings.substr(offset, length);
+    };
+
+    program.statementPositions.reserve(positions.size());
+    for (const PositionRecord& record : positions) {
+        program.statementPositions.emplace_back(record.stmt, SourcePos{record.line, record.column});
+    }
+    program.constants.reserve(constants.size());
+    for (const ConstantRecord& record : constants) {
+        if (record.kind == kIntConstant) {
+            program.constants.emplace_back(static_cast<int>(static_cast<uint32_t>(record.bits)));
+        } else if (record.kind == kDoubleConstant) {
+            double value;
+            std::memcpy(&value, &record.bits, sizeof value);
+            program.constants.emplace_back(value);
+        } else if (record.kind == kStringConstant) {
+            program.constants.emplace_back(std::string(text(record.bits, record.length)));
+        } else {
+            invalid("bad constant");
+        }
+    }
+    program.names.reserve(names.size());
+    for (const StringRecord& record : names) program.names.emplace_back(text(record.offset, record.length));
+    image.slotNames.reserve(slots.size());
+    for (uint32_t name : slots) {
+        if (name >= program.names.size()) invalid("bad slot");
+        image.slotNames.push_back(program.names[name]);
+    }
+
+    validate(program, image.slotNames.size());
+    return image;
+}
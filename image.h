@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A parsed and resolved program saved as a .happyc image, so later runs skip
+// the Lexer, Parser and Resolver. The optimizer still runs on load, so -O
+// applies as usual.
+//
+// Layout: an ImageHeader, then 8-byte aligned sections (nodes, block lists,
+// statements, statement positions, constants, names, slot names, string
+// bytes). Arrays are stored in memory order and copied into the Ast in bulk,
+// so a memory-mapped image loads without touching the nodes one by one
+// beyond a bounds check. Images are tied to the build's Node layout and byte
+// order; bump kImageVersion when either the layout or the meaning of a
+// NodeKind changes.
+
+constexpr uint32_t kImageVersion = 2;
+
+struct ProgramImage {
+    Ast program;                        // as the Resolver left it
+    std::vector<std::string> slotNames; // Resolver::slotNames()
+};
+
+// Hash of a source text, used to name cache entries (see main's --cache)
+uint64_t contentHash(std::string_view data);
+
+// True when data starts like an image, whether or not it is valid
+bool isProgramImage(std::string_view data);
+
+// Serialize a resolved program. Written to a temporary file and renamed, so
+// readers never see half an image. Throws std::runtime_error.
+void writeProgramImage(const std::string& path, const Ast& program,
+                       const std::vector<std::string>& slotNames, uint64_t sourceHash);
+
+// Throws std::runtime_error("Invalid program image: <reason>") for anything
+// truncated, corrupted or from another version
+ProgramImage readProgramImage(std::string_view data);
+
+// The sourceHash an image was written with, or 0 if data is not an image
+uint64_t programImageSourceHash(std::string_view data);
@@ -1,223 +1,274 @@
 #include "interpreter.h"
+#include "arrays.h"
 #include <stdexcept>
-#include <iostream>
 #include <variant>
 #include <string>
+#include <unistd.h>
 
-void Interpreter::interpret(const std::vector<std::unique_ptr<Stmt>>& program) {
-    for (const auto& stmt : program) {
-        execute(stmt.get());
-    }
-}
-
-void Interpreter::execute(const Stmt* stmt) {
-    if (auto printStmt = dynamic_cast<const PrintStmt*>(stmt)) {
-        auto val = evaluate(printStmt->expr.get());
-        std::visit([](auto&& arg) { std::cout << arg << std::endl; }, val);
-    }
-    else if (auto assignStmt = dynamic_cast<const AssignStmt*>(stmt)) {
-        auto val = evaluate(assignStmt->value.get());
-        variables[assignStmt->name] = val;
-    }
-    else if (auto declStmt = dynamic_cast<const DeclStmt*>(stmt)) {
-        auto val = evaluate(declStmt->value.get());
-        if (declStmt->varType == TokenType::IntType) {
-            if (auto pInt = std::get_if<int>(&val)) variables[declStmt->name] = *pInt;
-            else if (auto pDouble = std::get_if<double>(&val)) variables[declStmt->name] = static_cast<int>(*pDouble);
-            else throw std::runtime_error("Type mismatch assigning to int variable");
-        }
-        else if (declStmt->varType == TokenType::FloatType) {
-            if (auto pInt = std::get_if<int>(&val)) variables[declStmt->name] = static_cast<double>(*pInt);
-            else if (auto pDouble = std::get_if<double>(&val)) variables[declStmt->name] = *pDouble;
-            else throw std::runtime_error("Type mismatch assigning to float variable");
-        }
-        else if (declStmt->varType == TokenType::StringType) {
-            if (auto pStr = std::get_if<std::string>(&val)) variables[declStmt->name] = *pStr;
-            else throw std::runtime_error("Type mismatch assigning to string variable");
-        }
-        else {
-            throw std::runtime_error("Unknown variable type");
-        }
-    }
-    else if (auto ifStmt = dynamic_cast<const IfStmt*>(stmt)) {
-        auto cond = evaluate(ifStmt->condition.get());
-        bool condVal = false;
-        if (auto pInt = std::get_if<int>(&cond)) condVal = (*pInt != 0);
-        else if (auto pDouble = std::get_if<double>(&cond)) condVal = (*pDouble != 0.0);
-        else throw std::runtime_error("Condition must be numeric");
-        if (condVal) {
-            if (ifStmt->thenBranch)
-                execute(ifStmt->thenBranch.get());
-        } else {
-            if (ifStmt->elseBranch)
-                execute(ifStmt->elseBranch.get());
-        }
-    }
-    else if (auto whileStmt = dynamic_cast<const WhileStmt*>(stmt)) {
-        while (true) {
-            auto cond = evaluate(whileStmt->condition.get());
-            bool condVal = false;
-            if (auto pInt = std::get_if<int>(&cond)) condVal = (*pInt != 0);
-            else if (auto pDouble = std::get_if<double>(&cond)) condVal = (*pDouble != 0.0);
-            else throw std::runtime_error("Condition must be numeric");
-            if (!condVal) break;
-            execute(whileStmt->body.get());
-        }
-    }
-    else if (auto block = dynamic_cast<const BlockStmt*>(stmt)) {
-        for (const auto& s : block->statements) {
-            execute(s.get());
+void Interpreter::interpret(const Ast& program, size_t slotCount) {
+    if (!output) setOutput(std::make_unique<FdSink>(STDOUT_FILENO, FdSink::defaultPolicy(STDOUT_FILENO)));
+    ast = &program;
+    sites.assign(program.nodes.size(), BinarySite{});
+    variables.resize(slotCount);
+    defined.resize(slotCount, 0);
+    storage.set(*account, sites.capacity() * sizeof(BinarySite) + variables.capacity() * sizeof(Value) +
+                              defined.capacity());
+    loops.reset(program);
+    hotLoops.clear(); // keyed by NodeId, so only valid for one Ast
+    try {
+        MemoryScope scope(account.get());
+        for (NodeId stmt : program.statements) {
+            execute(stmt);
         }
     }
-    else {
-        throw std::runtime_error("Unknown statement type in execute");
+    catch (...) {
+        // Whatever was printed before the error goes out before the message
+        output->flush();
+        throw;
     }
+    output->flush();
 }
 
-std::variant<int, double, std::string> Interpreter::evaluate(const Expr* expr) {
-    if (auto n = dynamic_cast<const NumberExpr*>(expr)) {
-        return n->value;
-    }
-    else if (auto v = dynamic_cast<const VariableExpr*>(expr)) {
-        auto it = variables.find(v->name);
-        if (it == variables.end()) throw std::runtime_error("Undefined variable: " + v->name);
-        return it->second;
-    }
-    else if (auto s = dynamic_cast<const StringExpr*>(expr)) {
-        return s->value;
+void Interpreter::store(uint32_t slot, Value value) {
+    variables[slot] = std::move(value);
+    defined[slot] = 1;
+}
+
+// Rewrites a Binary site into the fast path for the operand types it just
+// saw. Sites that keep changing types fall back to applyBinary for good.
+void Interpreter::quicken(BinarySite& site, BinaryOp op, const Value& left, const Value& right) {
+    if (site.respecializations >= kMaxRespecializations) {
+        site.fastPath = nullptr;
+        site.megamorphic = true;
+        ++stats.megamorphicSites;
+        return;
     }
-    else if (auto b = dynamic_cast<const BinaryExpr*>(expr)) {
-        auto leftVal = evaluate(b->left.get());
-        auto rightVal = evaluate(b->right.get());
+    ++site.respecializations;
+    ++stats.specializations;
+    site.fastPath = specializeBinary(op, left, right);
+}
 
-       
+// s = s + expr where s holds a string: appends to the variable's own buffer
+// instead of building a copy, so growing a string in a loop is linear.
+// Returns false, having done nothing, for any other assignment.
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+bool Interpreter::appendInPlace(const Node& assign) {
+    const Node& value = (*ast)[assign.a];
+    if (value.kind != NodeKind::Binary || value.op != BinaryOp::Add) return false;
+    const Node& left = (*ast)[value.a];
+    if (left.kind != NodeKind::Variable || left.b != assign.b || !defined[assign.b]) return false;
+    if (!variables[assign.b].isString()) return false;
 
-        // String concatenation for '+'
-        if (b->op == "+") {
-            if (auto pStrL = std::get_if<std::string>(&leftVal)) {
-                if (auto pStrR = std::get_if<std::string>(&rightVal)) {
-                    return *pStrL + *pStrR;
-                }
-            }
+    Value right = evaluate(value.b);
+    if (right.isString()) variables[assign.b].append(right);
+    else variables[assign.b] = applyBinary(BinaryOp::Add, variables[assign.b], right);
+    return true;
+}
+
+// Finishes the iteration a side exit left: the statement it stopped at,
+// then the rest of every enclosing block
+void Interpreter::resume(const CompiledLoop::SideExit& exit) {
+    for (const CompiledLoop::Resume& step : exit.rest) {
+        const Node& node = (*ast)[step.node];
+        if (node.kind != NodeKind::Block) {
+            execute(step.node);
+            continue;
+        }
+        for (const NodeId* s = ast->begin(node) + step.from; s < ast->end(node); ++s) {
+            execute(*s);
         }
+    }
+}
 
-        // Numeric operations
-        if (b->op == "+") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL + *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL + *pDoubleR;
+void Interpreter::execute(NodeId id) {
+    const Node& node = (*ast)[id];
+    // A Block's time belongs to the statement around it
+    bool profiled = profiler && node.kind != NodeKind::Block;
+    if (profiled) profiler->enter(id);
+    switch (node.kind) {
+        case NodeKind::Print: {
+            output->print(evaluate(node.a));
+            break;
+        }
+        case NodeKind::Assign: {
+            if (variables[node.b].isString() && appendInPlace(node)) break;
+            auto val = evaluate(node.a);
+            store(node.b, std::move(val));
+            break;
+        }
+        case NodeKind::Decl: {
+            auto val = evaluate(node.a);
+            if (node.varType == TokenType::IntType) {
+                if (val.isInt()) store(node.b, std::move(val));
+                else if (val.isDouble()) store(node.b, static_cast<int>(val.asDouble()));
+                else throw std::runtime_error("Type mismatch assigning to int variable");
             }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL + *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL + *pDoubleR;
-            }
-        }
-        else if (b->op == "-") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL - *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL - *pDoubleR;
+            else if (node.varType == TokenType::FloatType) {
+                if (val.isInt()) store(node.b, static_cast<double>(val.asInt()));
+                else if (val.isDouble()) store(node.b, std::move(val));
+                else throw std::runtime_error("Type mismatch assigning to float variable");
             }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL - *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL - *pDoubleR;
+            else if (node.varType == TokenType::StringType) {
+                if (val.isString()) store(node.b, std::move(val));
+                else throw std::runtime_error("Type mismatch assigning to string variable");
             }
-        }
-        else if (b->op == "*") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL * *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL * *pDoubleR;
+            else if (node.varType == TokenType::IntArrayType || node.varType == TokenType::FloatArrayType) {
+                store(node.b, declareArray(node.varType, val));
             }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL * *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL * *pDoubleR;
+            else {
+                throw std::runtime_error("Unknown variable type");
             }
-        }
-        else if (b->op == "/") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) {
-                    if (*pIntR == 0) throw std::runtime_error("Division by zero");
-                    return static_cast<double>(*pIntL) / *pIntR;
-                }
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) {
-                    if (*pDoubleR == 0.0) throw std::runtime_error("Division by zero");
-                    return *pIntL / *pDoubleR;
-                }
+            break;
+        }
+        case NodeKind::StoreElement: {
+            Value index = evaluate(node.b);
+            Value value = evaluate(node.a);
+            const Node& target = (*ast)[node.c];
+            if (!defined[target.b]) throw std::runtime_error("Undefined variable: " + ast->nameOf(target));
+            storeElement(variables[target.b], index, value);
+            break;
+        }
+        case NodeKind::If: {
+            if (condition(node.a)) {
+                if (node.b != kNoNode)
+                    execute(node.b);
+            } else {
+                if (node.c != kNoNode)
+                    execute(node.c);
             }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) {
-                    if (*pIntR == 0) throw std::runtime_error("Division by zero");
-                    return *pDoubleL / *pIntR;
+            break;
+        }
+        case NodeKind::While: {
+            if (node.c != kNoNode) loops.enter(node.c);
+            HotLoop* hot = jitEnabled && !profiler ? &hotLoops[id] : nullptr;
+            while (true) {
+                if (node.c != kNoNode && loops.tryClosedForm(node.c, variables, defined)) break;
+                if (hot && hot->code) {
+                    CompiledLoop::Result result;
+                    if (hot->code->run(variables, defined, result)) {
+                        ++jitCounters.nativeEntries;
+                        if (result.exit == CompiledLoop::Exit::Finished) break;
+                        if (result.exit == CompiledLoop::Exit::Statement) {
+                            ++jitCounters.sideExits;
+                            resume(hot->code->sideExits()[result.index]);
+                            continue;
+                        }
+                        // Exit::Condition: evaluate it below
+                    } else {
+                        // A variable changed type since compilation
+                        hot->code.reset();
+                        hot->iterations = 0;
+                    }
                 }
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) {
-                    if (*pDoubleR == 0.0) throw std::runtime_error("Division by zero");
-                    return *pDoubleL / *pDoubleR;
+                if (!condition(node.a)) break;
+                execute(node.b);
+                if (hot && !hot->code && hot->attempts < kMaxJitAttempts && ++hot->iterations >= kJitThreshold) {
+                    hot->iterations = 0;
+                    ++hot->attempts;
+                    hot->code = compileLoop(*ast, id, variables, defined);
+                    if (hot->code) ++jitCounters.compiledLoops;
                 }
             }
+            break;
         }
-        else if (b->op == "%") {
-            int leftInt, rightInt;
-            if (auto pIntL = std::get_if<int>(&leftVal)) leftInt = *pIntL;
-            else if (auto pDoubleL = std::get_if<double>(&leftVal)) leftInt = static_cast<int>(*pDoubleL);
-            else throw std::runtime_error("Modulo operator requires integer operands");
-            if (auto pIntR = std::get_if<int>(&rightVal)) rightInt = *pIntR;
-            else if (auto pDoubleR = std::get_if<double>(&rightVal)) rightInt = static_cast<int>(*pDoubleR);
-            else throw std::runtime_error("Modulo operator requires integer operands");
-            if (rightInt == 0) throw std::runtime_error("Modulo by zero");
-            return leftInt % rightInt;
-        }
-        else if (b->op == "==") {
-            return leftVal == rightVal;
-        }
-        else if (b->op == "!=") {
-            return leftVal != rightVal;
-        }
-        else if (b->op == "<") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL < *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL < *pDoubleR;
-            }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL < *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL < *pDoubleR;
-            }
-            throw std::runtime_error("Operator '<' requires numeric operands");
-        }
-        else if (b->op == "<=") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL <= *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL <= *pDoubleR;
-            }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL <= *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL <= *pDoubleR;
+        case NodeKind::Block: {
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                execute(*s);
             }
-            throw std::runtime_error("Operator '<=' requires numeric operands");
+            break;
         }
-        else if (b->op == ">") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL > *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL > *pDoubleR;
+        default:
+            throw std::runtime_error("Unknown statement type in execute");
+    }
+    if (profiled) profiler->exit();
+}
+
+// An 'ana'/'fun' condition straight to a branch decision. A comparison
+// reads variables and literals in place and never builds its 0/1 result;
+// anything else is evaluated and tested for truth.
+bool Interpreter::condition(NodeId id) {
+    const Node& node = (*ast)[id];
+    if (node.kind == NodeKind::Binary && node.op >= BinaryOp::Equal) {
+        Value leftScratch, rightScratch;
+        const Value& left = operand(node.a, leftScratch);
+        const Value& right = operand(node.b, rightScratch);
+        return compareValues(node.op, left, right);
+    }
+    Value cond = evaluate(id);
+    if (cond.isInt()) return cond.asInt() != 0;
+    if (cond.isDouble()) return cond.asDouble() != 0.0;
+    throw std::runtime_error("Condition must be numeric");
+}
+
+// A variable or literal without copying it, anything else evaluated into scratch
+const Value& Interpreter::operand(NodeId id, Value& scratch) {
+    const Node& node = (*ast)[id];
+    if (node.kind == NodeKind::Variable) {
+        if (!defined[node.b]) throw std::runtime_error("Undefined variable: " + ast->nameOf(node));
+        return variables[node.b];
+    }
+    if (node.kind == NodeKind::Number || node.kind == NodeKind::String) return ast->constants[node.a];
+    scratch = evaluate(id);
+    return scratch;
+}
+
+Value Interpreter::evaluate(NodeId id) {
+    const Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Number:
+        case NodeKind::String:
+            return ast->constants[node.a];
+        case NodeKind::Variable:
+            // Only reachable when the defining statement was skipped at run time
+            if (!defined[node.b]) throw std::runtime_error("Undefined variable: " + ast->nameOf(node));
+            return variables[node.b];
+        case NodeKind::Binary: {
+            auto leftVal = evaluate(node.a);
+            auto rightVal = evaluate(node.b);
+            BinarySite& site = sites[id];
+            Value result;
+            if (site.fastPath) {
+                if (site.fastPath(leftVal, rightVal, result)) {
+                    ++stats.hits;
+                    return result;
+                }
+                ++stats.misses;
+            } else {
+                ++stats.unquickened;
             }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL > *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL > *pDoubleR;
+            if (!site.megamorphic) quicken(site, node.op, leftVal, rightVal);
+            return applyBinary(node.op, leftVal, rightVal);
+        }
+        case NodeKind::Index: {
+            Value array = evaluate(node.a);
+            Value index = evaluate(node.b);
+            return elementAt(array, index);
+        }
+        case NodeKind::Call: {
+            Value args[2];
+            for (uint32_t i = 0; i < node.b; ++i) {
+                args[i] = evaluate(ast->lists[node.a + i]);
             }
-            throw std::runtime_error("Operator '>' requires numeric operands");
+            return callBuiltin(static_cast<Builtin>(node.c), args);
         }
-        else if (b->op == ">=") {
-            if (auto pIntL = std::get_if<int>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pIntL >= *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pIntL >= *pDoubleR;
-            }
-            if (auto pDoubleL = std::get_if<double>(&leftVal)) {
-                if (auto pIntR = std::get_if<int>(&rightVal)) return *pDoubleL >= *pIntR;
-                if (auto pDoubleR = std::get_if<double>(&rightVal)) return *pDoubleL >= *pDoubleR;
+        case NodeKind::ArrayLiteral: {
+            std::vector<Value> elements;
+            elements.reserve(node.b);
+            for (const NodeId* e = ast->begin(node); e != ast->end(node); ++e) {
+                elements.push_back(evaluate(*e));
             }
-            throw std::runtime_error("Operator '>=' requires numeric operands");
+            return makeArray(elements.data(), elements.size());
         }
-        else {
-            throw std::runtime_error("Unknown operator: " + b->op);
+        case NodeKind::Hoisted: {
+            if (const Value* cached = loops.cached(node.b)) return *cached;
+            Value val = evaluate(node.a);
+            loops.fill(node.b, val);
+            return val;
         }
+        default:
+            break;
     }
 
     throw std::runtime_error("Invalid expression");
@@ -226,7 +277,6 @@ std::variant<int, double, std::string> Interpreter::evaluate(const Expr* expr) {
 
 
 
-
 /*#include "interpreter.h"
 #include <stdexcept>
 #include <iostream>
@@ -1,22 +1,76 @@
 #pragma once
 
 #include "ast.h"
+#include "jit.h"
 #include "lexer.h"
-#include <iostream>
+#include "loops.h"
+#include "memory_account.h"
+#include "output.h"
+#include "profiler.h"
+#include "quicken.h"
+#include "value.h"
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <variant>
 #include <vector>
-#include <memory>
 
 class Interpreter {
 public:
-    void interpret(const std::vector<std::unique_ptr<Stmt>>& program);
+    // The program must have been through Resolver; slotCount is Resolver::slotCount().
+    // Variables keep their values from earlier calls (see repl.h).
+    void interpret(const Ast& program, size_t slotCount);
+
+    // How monomorphic the executed Binary sites were
+    const QuickeningStats& quickeningStats() const { return stats; }
+
+    // Where 'smile' writes; buffered stdout unless replaced
+    void setOutput(std::unique_ptr<OutputSink> sink) {
+        output = std::move(sink);
+        if (output) output->chargeTo(*account);
+    }
+
+    // The strings, arrays and variables the program holds (see VM::memory)
+    MemoryAccount& memory() { return *account; }
+    const MemoryAccount& memory() const { return *account; }
+
+    // Native code for hot loops (see jit.h); on by default where supported
+    void setJit(bool enabled) { jitEnabled = enabled; }
+    const JitStats& jitStats() const { return jitCounters; }
+
+    // Per-statement timing (see profiler.h); profiled runs do not use the JIT
+    void setProfiler(Profiler* statementProfiler) { profiler = statementProfiler; }
 
 private:
-    void execute(const Stmt* stmt);
-    std::variant<int, double, std::string> evaluate(const Expr* expr);
-    // Variables can be int or double, stored in a variant
-    std::unordered_map<std::string, std::variant<int, double, std::string>> variables;
+    // Type feedback for one Binary node (see quicken.h)
+    struct BinarySite {
+        BinaryFastPath fastPath = nullptr;
+        uint8_t respecializations = 0;
+        bool megamorphic = false;
+    };
+
+    void execute(NodeId id);
+    Value evaluate(NodeId id);
+    bool condition(NodeId id);
+    const Value& operand(NodeId id, Value& scratch);
+    void store(uint32_t slot, Value value);
+    bool appendInPlace(const Node& assign);
+    void resume(const CompiledLoop::SideExit& exit);
+    void quicken(BinarySite& site, BinaryOp op, const Value& left, const Value& right);
+    const Ast* ast = nullptr;
+    std::shared_ptr<MemoryAccount> account = MemoryAccount::create();
+    MemoryCharge storage; // sites, variables and defined
+    std::vector<BinarySite> sites; // indexed by NodeId
+    // Variables live in the slot the Resolver gave their name
+    std::vector<Value> variables;
+    std::vector<uint8_t> defined;
+    QuickeningStats stats;
+    LoopRuntime loops;
+    std::unique_ptr<OutputSink> output;
+    bool jitEnabled = kJitAvailable;
+    std::unordered_map<NodeId, HotLoop> hotLoops; // by While node
+    JitStats jitCounters;
+    Profiler* profiler = nullptr;
 
-};
+};
\ No newline at end of file
@@ -0,0 +1,561 @@
+#include "jit.h"
+#include <cstring>
+#include <map>
+
+#ifdef HAPPYSCRIPT_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Exit codes returned by the native code; side exit i returns kFirstSideExit + i
+constexpr uint32_t kFinished = 0;
+constexpr uint32_t kConditionExit = 1;
+constexpr uint32_t kFirstSideExit = 2;
+
+} // namespace
+
+CompiledLoop::~CompiledLoop() {
+#ifdef HAPPYSCRIPT_JIT
+    if (memory) munmap(memory, mappedSize);
+#endif
+}
+
+bool CompiledLoop::run(std::vector<Value>& slots, const std::vector<uint8_t>& defined, Result& result) {
+    for (const Variable& var : variables) {
+        if (!defined[var.slot]) return false;
+        const Value& value = slots[var.slot];
+        if (var.isInt) {
+            if (!value.isInt()) return false;
+            frame[var.slot] = static_cast<uint32_t>(value.asInt());
+        } else {
+            if (!value.isDouble()) return false;
+            double d = value.asDouble();
+            std::memcpy(&frame[var.slot], &d, sizeof(double));
+        }
+    }
+
+    uint32_t code = entry(frame.data());
+
+    for (const Variable& var : variables) {
+        if (!var.assigned) continue;
+        if (var.isInt) {
+            slots[var.slot] = static_cast<int>(static_cast<uint32_t>(frame[var.slot]));
+        } else {
+            double d;
+            std::memcpy(&d, &frame[var.slot], sizeof(double));
+            slots[var.slot] = d;
+        }
+    }
+    if (code == kFinished) result = {Exit::Finished, 0};
+    else if (code == kConditionExit) result = {Exit::Condition, 0};
+    else result = {Exit::Statement, code - kFirstSideExit};
+    return true;
+}
+
+#ifndef HAPPYSCRIPT_JIT
+
+std::unique_ptr<CompiledLoop> compileLoop(const Ast&, NodeId, const std::vector<Value>&, const std::vector<uint8_t>&) {
+    return nullptr;
+}
+
+#else
+
+// Straightforward code generation: every variable lives in its frame cell
+// (rdi + 8 * slot), an expression leaves its result in eax or xmm0, and the
+// left operand of a binary operator waits on the machine stack. rbp keeps
+// the entry stack pointer so a side exit from inside an expression can
+// drop whatever is still pushed.
+class LoopCompiler {
+public:
+    LoopCompiler(const Ast& program, const std::vector<Value>& slots, const std::vector<uint8_t>& defined)
+        : ast(program), slots(slots), defined(defined), types(slots.size(), Type::Unknown),
+          assigned(slots.size(), 0) {}
+
+    std::unique_ptr<CompiledLoop> compile(NodeId loop);
+
+private:
+    using Resume = CompiledLoop::Resume;
+    enum class Type : uint8_t { Unknown, Int, Double };
+
+    const Ast& ast;
+    const std::vector<Value>& slots;
+    const std::vector<uint8_t>& defined;
+    std::vector<Type> types;        // per slot, fixed for the whole loop
+    std::vector<uint8_t> assigned;  // per slot
+    std::vector<uint32_t> used;     // slots touched by compiled code
+
+    std::vector<uint8_t> code;
+    std::map<uint32_t, std::vector<size_t>> exitJumps; // exit code -> rel32 fields
+    std::vector<CompiledLoop::SideExit> exits;
+
+    // The statement being generated, for side exits raised inside it
+    NodeId currentStmt = kNoNode;
+    const std::vector<Resume>* currentRest = nullptr;
+    uint32_t currentExit = kConditionExit;
+
+    // Analysis
+    bool collectStmt(NodeId id);
+    bool collectExpr(NodeId id);
+    bool useSlot(uint32_t slot);
+    Type typeOf(NodeId id) const;
+    bool typesAreStable(NodeId id) const;
+
+    // Code generation
+    void genStmt(NodeId id, const std::vector<Resume>& rest);
+    Type genExpr(NodeId id);
+    void genDouble(NodeId id);
+    void genInt(NodeId id);
+    void genBinary(const Node& node);
+    void genCondition(NodeId id, std::vector<size_t>& whenFalse);
+    void enterStatement(NodeId id, const std::vector<Resume>& rest);
+    uint32_t statementExit();
+
+    void emit(std::initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    size_t jump(std::initializer_list<uint8_t> opcode); // returns the rel32 field
+    void patch(size_t field, size_t target);
+    void exitTo(uint32_t exitCode, std::initializer_list<uint8_t> opcode);
+    void loadInt(uint32_t slot);
+    void storeInt(uint32_t slot);
+    void loadDouble(uint32_t slot);
+    void storeDouble(uint32_t slot);
+};
+
+bool LoopCompiler::useSlot(uint32_t slot) {
+    if (types[slot] != Type::Unknown) return true;
+    if (!defined[slot]) return false;
+    if (slots[slot].isInt()) types[slot] = Type::Int;
+    else if (slots[slot].isDouble()) types[slot] = Type::Double;
+    else return false;
+    used.push_back(slot);
+    return true;
+}
+
+bool LoopCompiler::collectExpr(NodeId id) {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Number:
+            return ast.constants[node.a].isNumber();
+        case NodeKind::Variable:
+            return useSlot(node.b);
+        case NodeKind::Hoisted:
+            return collectExpr(node.a);
+        case NodeKind::Binary:
+            return collectExpr(node.a) && collectExpr(node.b);
+        default:
+            return false;
+    }
+}
+
+bool LoopCompiler::collectStmt(NodeId id) {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+            // Always a side exit; the interpreter evaluates it
+            return true;
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            if (!useSlot(node.b)) return false;
+            assigned[node.b] = 1;
+            return collectExpr(node.a);
+        case NodeKind::If:
+            return collectExpr(node.a) && (node.b == kNoNode || collectStmt(node.b)) &&
+                   (node.c == kNoNode || collectStmt(node.c));
+        case NodeKind::Block:
+            for (const NodeId* s = ast.begin(node); s != ast.end(node); ++s) {
+                if (!collectStmt(*s)) return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+LoopCompiler::Type LoopCompiler::typeOf(NodeId id) const {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Number:
+            return ast.constants[node.a].isInt() ? Type::Int : Type::Double;
+        case NodeKind::Variable:
+            return types[node.b];
+        case NodeKind::Hoisted:
+            return typeOf(node.a);
+        case NodeKind::Binary: {
+            Type left = typeOf(node.a), right = typeOf(node.b);
+            switch (node.op) {
+                case BinaryOp::Add:
+                case BinaryOp::Sub:
+                case BinaryOp::Mul:
+                    return left == Type::Int && right == Type::Int ? Type::Int : Type::Double;
+                case BinaryOp::Div:
+                    return Type::Double;
+                default:
+                    return Type::Int; // '%' and comparisons
+            }
+        }
+        default:
+            return Type::Unknown;
+    }
+}
+
+// Every store must produce the type the variable had on entry, so each
+// frame cell keeps one type for the whole loop
+bool LoopCompiler::typesAreStable(NodeId id) const {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Assign:
+            return typeOf(node.a) == types[node.b];
+        case NodeKind::Decl:
+            if (node.varType == TokenType::IntType) return types[node.b] == Type::Int;
+            if (node.varType == TokenType::FloatType) return types[node.b] == Type::Double;
+            return false;
+        case NodeKind::If:
+            return (node.b == kNoNode || typesAreStable(node.b)) && (node.c == kNoNode || typesAreStable(node.c));
+        case NodeKind::Block:
+            for (const NodeId* s = ast.begin(node); s != ast.end(node); ++s) {
+                if (!typesAreStable(*s)) return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+std::unique_ptr<CompiledLoop> LoopCompiler::compile(NodeId loop) {
+    const Node& node = ast[loop];
+    if (!collectExpr(node.a) || !collectStmt(node.b) || !typesAreStable(node.b)) return nullptr;
+
+    emit({0x55});             // push rbp
+    emit({0x48, 0x89, 0xE5}); // mov rbp, rsp
+    size_t loopHead = code.size();
+    currentExit = kConditionExit;
+    std::vector<size_t> whenFalse;
+    genCondition(node.a, whenFalse);
+    genStmt(node.b, {});
+    patch(jump({0xE9}), loopHead);
+    for (size_t field : whenFalse) exitJumps[kFinished].push_back(field);
+
+    size_t commonExit = code.size();
+    emit({0x48, 0x89, 0xEC}); // mov rsp, rbp
+    emit({0x5D, 0xC3});       // pop rbp; ret
+    for (const auto& [exitCode, fields] : exitJumps) {
+        for (size_t field : fields) patch(field, code.size());
+        emit({0xB8});         // mov eax, exitCode
+        emit32(exitCode);
+        patch(jump({0xE9}), commonExit);
+    }
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (code.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    std::memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    std::unique_ptr<CompiledLoop> compiled(new CompiledLoop());
+    compiled->memory = memory;
+    compiled->mappedSize = size;
+    compiled->entry = reinterpret_cast<CompiledLoop::Entry>(memory);
+    uint32_t frameSize = 0;
+    for (uint32_t slot : used) {
+        compiled->variables.push_back({slot, types[slot] == Type::Int, assigned[slot] != 0});
+        if (slot + 1 > frameSize) frameSize = slot + 1;
+    }
+    compiled->frame.assign(frameSize, 0);
+    compiled->exits = std::move(exits);
+    return compiled;
+}
+
+void LoopCompiler::enterStatement(NodeId id, const std::vector<Resume>& rest) {
+    currentStmt = id;
+    currentRest = &rest;
+    currentExit = UINT32_MAX;
+}
+
+// The side exit that re-runs the current statement in the interpreter,
+// created the first time the statement needs one
+uint32_t LoopCompiler::statementExit() {
+    if (currentExit == UINT32_MAX) {
+        CompiledLoop::SideExit exit{currentStmt, {{currentStmt, 0}}};
+        exit.rest.insert(exit.rest.end(), currentRest->begin(), currentRest->end());
+        exits.push_back(std::move(exit));
+        currentExit = kFirstSideExit + static_cast<uint32_t>(exits.size() - 1);
+    }
+    return currentExit;
+}
+
+void LoopCompiler::genStmt(NodeId id, const std::vector<Resume>& rest) {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+            enterStatement(id, rest);
+            exitTo(statementExit(), {0xE9});
+            break;
+        case NodeKind::Assign: {
+            enterStatement(id, rest);
+            if (genExpr(node.a) == Type::Int) storeInt(node.b);
+            else storeDouble(node.b);
+            break;
+        }
+        case NodeKind::Decl: {
+            enterStatement(id, rest);
+            Type type = genExpr(node.a);
+            if (node.varType == TokenType::IntType) {
+                if (type == Type::Double) emit({0xF2, 0x0F, 0x2C, 0xC0}); // cvttsd2si eax, xmm0
+                storeInt(node.b);
+            } else {
+                if (type == Type::Int) emit({0xF2, 0x0F, 0x2A, 0xC0});    // cvtsi2sd xmm0, eax
+                storeDouble(node.b);
+            }
+            break;
+        }
+        case NodeKind::If: {
+            enterStatement(id, rest);
+            std::vector<size_t> whenFalse;
+            genCondition(node.a, whenFalse);
+            if (node.b != kNoNode) genStmt(node.b, rest);
+            if (node.c != kNoNode) {
+                size_t toEnd = jump({0xE9});
+                for (size_t field : whenFalse) patch(field, code.size());
+                genStmt(node.c, rest);
+                patch(toEnd, code.size());
+            } else {
+                for (size_t field : whenFalse) patch(field, code.size());
+            }
+            break;
+        }
+        case NodeKind::Block:
+            for (uint32_t i = 0; i < node.b; ++i) {
+                std::vector<Resume> after{{id, i + 1}};
+                after.insert(after.end(), rest.begin(), rest.end());
+                genStmt(ast.lists[node.a + i], after);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Jumps to the collected fields when the condition is falsy: 0 or 0.0 (NaN is truthy)
+void LoopCompiler::genCondition(NodeId id, std::vector<size_t>& whenFalse) {
+    if (genExpr(id) == Type::Int) {
+        emit({0x85, 0xC0});                   // test eax, eax
+        whenFalse.push_back(jump({0x0F, 0x84})); // je
+    } else {
+        emit({0x66, 0x0F, 0x57, 0xC9});       // xorpd xmm1, xmm1
+        emit({0x66, 0x0F, 0x2E, 0xC1});       // ucomisd xmm0, xmm1
+        emit({0x7A, 0x06});                   // jp over the je
+        whenFalse.push_back(jump({0x0F, 0x84})); // je
+    }
+}
+
+LoopCompiler::Type LoopCompiler::genExpr(NodeId id) {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Number: {
+            const Value& value = ast.constants[node.a];
+            if (value.isInt()) {
+                emit({0xB8});                 // mov eax, imm32
+                emit32(static_cast<uint32_t>(value.asInt()));
+                return Type::Int;
+            }
+            uint64_t bits;
+            double d = value.asDouble();
+            std::memcpy(&bits, &d, sizeof bits);
+            emit({0x48, 0xB8});               // mov rax, imm64
+            emit64(bits);
+            emit({0x66, 0x48, 0x0F, 0x6E, 0xC0}); // movq xmm0, rax
+            return Type::Double;
+        }
+        case NodeKind::Variable:
+            if (types[node.b] == Type::Int) loadInt(node.b);
+            else loadDouble(node.b);
+            return types[node.b];
+        case NodeKind::Hoisted:
+            return genExpr(node.a);
+        case NodeKind::Binary:
+            genBinary(node);
+            return typeOf(id);
+        default:
+            return Type::Unknown;
+    }
+}
+
+void LoopCompiler::genDouble(NodeId id) {
+    if (genExpr(id) == Type::Int) emit({0xF2, 0x0F, 0x2A, 0xC0}); // cvtsi2sd xmm0, eax
+}
+
+// toModuloOperand: doubles are truncated like static_cast<int>
+void LoopCompiler::genInt(NodeId id) {
+    if (genExpr(id) == Type::Double) emit({0xF2, 0x0F, 0x2C, 0xC0}); // cvttsd2si eax, xmm0
+}
+
+void LoopCompiler::genBinary(const Node& node) {
+    Type left = typeOf(node.a), right = typeOf(node.b);
+    bool intOperands = left == Type::Int && right == Type::Int;
+
+    // Leaves the left operand in eax / xmm0 and the right one in ecx / xmm1
+    auto operandsAsInt = [&](bool truncate) {
+        if (truncate) genInt(node.a); else genExpr(node.a);
+        emit({0x50});                         // push rax
+        if (truncate) genInt(node.b); else genExpr(node.b);
+        emit({0x89, 0xC1});                   // mov ecx, eax
+        emit({0x58});                         // pop rax
+    };
+    auto operandsAsDouble = [&]() {
+        genDouble(node.a);
+        emit({0x66, 0x48, 0x0F, 0x7E, 0xC0}); // movq rax, xmm0
+        emit({0x50});                         // push rax
+        genDouble(node.b);
+        emit({0x66, 0x0F, 0x28, 0xC8});       // movapd xmm1, xmm0
+        emit({0x58});                         // pop rax
+        emit({0x66, 0x48, 0x0F, 0x6E, 0xC0}); // movq xmm0, rax
+    };
+    auto setFlagToEax = [&](uint8_t setcc) {
+        emit({0x0F, setcc, 0xC0});            // setcc al
+        emit({0x0F, 0xB6, 0xC0});             // movzx eax, al
+    };
+
+    switch (node.op) {
+        case BinaryOp::Add:
+        case BinaryOp::Sub:
+        case BinaryOp::Mul:
+            if (intOperands) {
+                operandsAsInt(false);
+                if (node.op == BinaryOp::Add) emit({0x01, 0xC8});            // add eax, ecx
+                else if (node.op == BinaryOp::Sub) emit({0x29, 0xC8});       // sub eax, ecx
+                else emit({0x0F, 0xAF, 0xC1});                               // imul eax, ecx
+            } else {
+                operandsAsDouble();
+                uint8_t opcode = node.op == BinaryOp::Add ? 0x58 : node.op == BinaryOp::Sub ? 0x5C : 0x59;
+                emit({0xF2, 0x0F, opcode, 0xC1});                            // addsd/subsd/mulsd xmm0, xmm1
+            }
+            break;
+        case BinaryOp::Div:
+            operandsAsDouble();
+            emit({0x66, 0x0F, 0x57, 0xD2});   // xorpd xmm2, xmm2
+            emit({0x66, 0x0F, 0x2E, 0xCA});   // ucomisd xmm1, xmm2
+            emit({0x7A, 0x06});               // jp over the je (NaN is not zero)
+            exitTo(statementExit(), {0x0F, 0x84});
+            emit({0xF2, 0x0F, 0x5E, 0xC1});   // divsd xmm0, xmm1
+            break;
+        case BinaryOp::Mod:
+            operandsAsInt(true);
+            emit({0x85, 0xC9});               // test ecx, ecx
+            exitTo(statementExit(), {0x0F, 0x84});
+            // INT_MIN % -1 traps in idiv; let the interpreter have it
+            emit({0x83, 0xF9, 0xFF});         // cmp ecx, -1
+            exitTo(statementExit(), {0x0F, 0x84});
+            emit({0x99});                     // cdq
+            emit({0xF7, 0xF9});               // idiv ecx
+            emit({0x89, 0xD0});               // mov eax, edx
+            break;
+        case BinaryOp::Equal:
+        case BinaryOp::NotEqual: {
+            bool equal = node.op == BinaryOp::Equal;
+            if (left != right) {
+                // Different alternatives never compare equal; operands still
+                // run for their side exits
+                operandsAsInt(false);
+                emit({0xB8});
+                emit32(equal ? 0 : 1);
+            } else if (intOperands) {
+                operandsAsInt(false);
+                emit({0x39, 0xC8});           // cmp eax, ecx
+                setFlagToEax(equal ? 0x94 : 0x95);
+            } else {
+                operandsAsDouble();
+                emit({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+                if (equal) {
+                    emit({0x0F, 0x94, 0xC0}); // sete al
+                    emit({0x0F, 0x9B, 0xC1}); // setnp cl
+                    emit({0x20, 0xC8});       // and al, cl
+                } else {
+                    emit({0x0F, 0x95, 0xC0}); // setne al
+                    emit({0x0F, 0x9A, 0xC1}); // setp cl
+                    emit({0x08, 0xC8});       // or al, cl
+                }
+                emit({0x0F, 0xB6, 0xC0});     // movzx eax, al
+            }
+            break;
+        }
+        default: {
+            // Less, LessEqual, Greater, GreaterEqual
+            if (intOperands) {
+                operandsAsInt(false);
+                emit({0x39, 0xC8});           // cmp eax, ecx
+                uint8_t setcc = node.op == BinaryOp::Less ? 0x9C : node.op == BinaryOp::LessEqual ? 0x9E
+                              : node.op == BinaryOp::Greater ? 0x9F : 0x9D;
+                setFlagToEax(setcc);
+            } else {
+                // Unordered (NaN) clears all four, as in C++
+                operandsAsDouble();
+                if (node.op == BinaryOp::Less || node.op == BinaryOp::LessEqual)
+                    emit({0x66, 0x0F, 0x2E, 0xC8}); // ucomisd xmm1, xmm0
+                else
+                    emit({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+                bool strict = node.op == BinaryOp::Less || node.op == BinaryOp::Greater;
+                setFlagToEax(strict ? 0x97 : 0x93); // seta / setae
+            }
+            break;
+        }
+    }
+}
+
+void LoopCompiler::emit32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void LoopCompiler::emit64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+size_t LoopCompiler::jump(std::initializer_list<uint8_t> opcode) {
+    emit(opcode);
+    size_t field = code.size();
+    emit32(0);
+    return field;
+}
+
+void LoopCompiler::patch(size_t field, size_t target) {
+    uint32_t rel = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(field + 4));
+    std::memcpy(&code[field], &rel, sizeof rel);
+}
+
+void LoopCompiler::exitTo(uint32_t exitCode, std::initializer_list<uint8_t> opcode) {
+    exitJumps[exitCode].push_back(jump(opcode));
+}
+
+void LoopCompiler::loadInt(uint32_t slot) {
+    emit({0x8B, 0x87});                       // mov eax, [rdi + disp32]
+    emit32(slot * 8);
+}
+
+void LoopCompiler::storeInt(uint32_t slot) {
+    emit({0x89, 0x87});                       // mov [rdi + disp32], eax
+    emit32(slot * 8);
+}
+
+void LoopCompiler::loadDouble(uint32_t slot) {
+    emit({0xF2, 0x0F, 0x10, 0x87});           // movsd xmm0, [rdi + disp32]
+    emit32(slot * 8);
+}
+
+void LoopCompiler::storeDouble(uint32_t slot) {
+    emit({0xF2, 0x0F, 0x11, 0x87});           // movsd [rdi + disp32], xmm0
+    emit32(slot * 8);
+}
+
+std::unique_ptr<CompiledLoop> compileLoop(const Ast& program, NodeId loop,
+                                          const std::vector<Value>& slots, const std::vector<uint8_t>& defined) {
+    LoopCompiler compiler(program, slots, defined);
+    return compiler.compile(loop);
+}
+
+#endif
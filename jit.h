@@ -0,0 +1,104 @@
+#pragma once
+
+#include "ast.h"
+#include "value.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Native code tier for hot 'fun' loops (x86-64 Linux only; elsewhere
+// compileLoop always returns nullptr and the engines just interpret).
+//
+// A loop qualifies once every variable it touches holds an int or a double
+// that keeps its type across the loop, and its body only contains
+// assignments, declarations, 'ana'/'elsa' and 'smile'. The generated code
+// works on an unboxed copy of those variables and leaves the loop (a side
+// exit) right before any statement it can't finish itself: a 'smile', or a
+// '/' or '%' whose divisor turns out to be zero. The engine then runs that
+// statement normally, so output and error messages are exactly what the
+// interpreter would produce, and re-enters the native code on the next
+// iteration.
+
+#if defined(__x86_64__) && defined(__linux__)
+#define HAPPYSCRIPT_JIT 1
+constexpr bool kJitAvailable = true;
+#else
+constexpr bool kJitAvailable = false;
+#endif
+
+// Iterations of a loop, summed over all its executions, before it is compiled
+constexpr uint32_t kJitThreshold = 1000;
+// Loops whose variables keep changing type stop being compiled after this
+constexpr uint8_t kMaxJitAttempts = 3;
+
+class CompiledLoop {
+public:
+    enum class Exit : uint8_t {
+        Finished,  // the condition became false
+        Condition, // the condition can't be evaluated natively this time
+        Statement, // stopped in front of sideExits()[index].stmt
+    };
+    struct Result {
+        Exit exit;
+        uint32_t index;
+    };
+
+    // Work left in the current iteration after a side exit: run node (the
+    // children of a Block from 'from', or the statement itself), innermost first
+    struct Resume {
+        NodeId node;
+        uint32_t from;
+    };
+    struct SideExit {
+        NodeId stmt;
+        std::vector<Resume> rest;
+    };
+
+    ~CompiledLoop();
+    CompiledLoop(const CompiledLoop&) = delete;
+    CompiledLoop& operator=(const CompiledLoop&) = delete;
+
+    // Runs iterations until the loop ends or a side exit. Returns false
+    // without running anything when a variable no longer holds the type the
+    // code was compiled for.
+    bool run(std::vector<Value>& slots, const std::vector<uint8_t>& defined, Result& result);
+
+    const std::vector<SideExit>& sideExits() const { return exits; }
+
+private:
+    friend class LoopCompiler;
+    CompiledLoop() = default;
+
+    using Entry = uint32_t (*)(uint64_t* frame);
+    struct Variable {
+        uint32_t slot;
+        bool isInt;
+        bool assigned;
+    };
+
+    void* memory = nullptr;
+    size_t mappedSize = 0;
+    Entry entry = nullptr;
+    std::vector<Variable> variables;
+    std::vector<SideExit> exits;
+    std::vector<uint64_t> frame; // indexed by slot
+};
+
+// Per-loop bookkeeping kept by the engines
+struct HotLoop {
+    uint32_t iterations = 0;
+    uint8_t attempts = 0;
+    std::unique_ptr<CompiledLoop> code;
+    std::vector<uint32_t> exitPcs; // VM: where each side exit resumes
+};
+
+struct JitStats {
+    uint64_t compiledLoops = 0;
+    uint64_t nativeEntries = 0;
+    uint64_t sideExits = 0;
+};
+
+// Compiles While node 'loop' for the variable types currently in slots, or
+// returns nullptr when the loop doesn't qualify (see above)
+std::unique_ptr<CompiledLoop> compileLoop(const Ast& program, NodeId loop,
+                                          const std::vector<Value>& slots, const std::vector<uint8_t>& defined);
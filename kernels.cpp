@@ -0,0 +1,518 @@
+#include "kernels.h"
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(HAPPYSCRIPT_NO_SIMD)
+#define HAPPYSCRIPT_SIMD 1
+#include <immintrin.h>
+// Compiled for AVX2 but only called after checking the CPU has it
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+// Two's complement wrap-around, as the engines' int operators behave
+int wrapAdd(int a, int b) { return static_cast<int>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b)); }
+int wrapMul(int a, int b) { return static_cast<int>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b)); }
+
+template <typename T>
+bool holds(BinaryOp relation, T l, T r) {
+    return relation == BinaryOp::Less ? l < r : relation == BinaryOp::Greater ? l > r : l == r;
+}
+
+// The last step of every double sum: lanes[j] holds partial sums j, j + 4,
+// j + 8 and j + 12 already folded, then come the elements left over
+double foldLanes(const double lanes[4]) {
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Smallest (or largest) of 4 lanes, keeping the earlier lane on ties
+template <bool Min>
+double foldExtremes(const double lanes[4]) {
+    double result = lanes[0];
+    for (int j = 1; j < 4; ++j) {
+        if (Min ? lanes[j] < result : lanes[j] > result) result = lanes[j];
+    }
+    return result;
+}
+
+// Scalar versions, which fix the order the vector code must reproduce
+
+int dotIntsScalar(const int* left, const int* right, size_t count) {
+    int total = 0;
+    for (size_t i = 0; i < count; ++i) total = wrapAdd(total, wrapMul(left[i], right[i]));
+    return total;
+}
+
+template <bool Min>
+int extremeIntsScalar(const int* data, size_t count) {
+    int result = data[0];
+    for (size_t i = 1; i < count; ++i) {
+        if (Min ? data[i] < result : data[i] > result) result = data[i];
+    }
+    return result;
+}
+
+void scaleIntsScalar(const int* data, int factor, int* out, size_t from, size_t count) {
+    for (size_t i = from; i < count; ++i) out[i] = wrapMul(data[i], factor);
+}
+
+#ifndef HAPPYSCRIPT_SIMD
+int sumIntsScalar(const int* data, size_t count) {
+    int total = 0;
+    for (size_t i = 0; i < count; ++i) total = wrapAdd(total, data[i]);
+    return total;
+}
+
+// right == nullptr sums data alone
+double sumProductsScalar(const double* data, const double* right, size_t count) {
+    double partial[16] = {};
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (size_t j = 0; j < 16; ++j) partial[j] += right ? data[i + j] * right[i + j] : data[i + j];
+    }
+    double lanes[4];
+    for (size_t j = 0; j < 4; ++j) lanes[j] = (partial[j] + partial[4 + j]) + (partial[8 + j] + partial[12 + j]);
+    double total = foldLanes(lanes);
+    for (; i < count; ++i) total += right ? data[i] * right[i] : data[i];
+    return total;
+}
+
+template <bool Min>
+double extremeDoublesScalar(const double* data, size_t count) {
+    double lanes[4] = {data[0], data[0], data[0], data[0]};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (size_t j = 0; j < 4; ++j) {
+            if (Min ? data[i + j] < lanes[j] : data[i + j] > lanes[j]) lanes[j] = data[i + j];
+        }
+    }
+    double result = foldExtremes<Min>(lanes);
+    for (; i < count; ++i) {
+        if (Min ? data[i] < result : data[i] > result) result = data[i];
+    }
+    return result;
+}
+#endif
+
+#ifdef HAPPYSCRIPT_SIMD
+const bool kHasAvx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+
+__m128i load128(const int* data) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)); }
+void store128(int* out, __m128i value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), value); }
+
+// SSE2: double sums in 8 registers of two lanes, q[2k] and q[2k + 1]
+// holding partial sums 4k..4k+3
+
+double sumDoublesSse2(const double* data, const double* right, size_t count) {
+    __m128d q[8];
+    for (__m128d& reg : q) reg = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (size_t r = 0; r < 8; ++r) {
+            __m128d term = _mm_loadu_pd(data + i + 2 * r);
+            if (right) term = _mm_mul_pd(term, _mm_loadu_pd(right + i + 2 * r));
+            q[r] = _mm_add_pd(q[r], term);
+        }
+    }
+    double lanes[4];
+    _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(q[0], q[2]), _mm_add_pd(q[4], q[6])));
+    _mm_storeu_pd(lanes + 2, _mm_add_pd(_mm_add_pd(q[1], q[3]), _mm_add_pd(q[5], q[7])));
+    double total = foldLanes(lanes);
+    for (; i < count; ++i) total += right ? data[i] * right[i] : data[i];
+    return total;
+}
+
+template <bool Min>
+double extremeDoublesSse2(const double* data, size_t count) {
+    __m128d low = _mm_set1_pd(data[0]), high = low;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // minpd(x, m) is x < m ? x : m, as in the scalar loop
+        if (Min) {
+            low = _mm_min_pd(_mm_loadu_pd(data + i), low);
+            high = _mm_min_pd(_mm_loadu_pd(data + i + 2), high);
+        } else {
+            low = _mm_max_pd(_mm_loadu_pd(data + i), low);
+            high = _mm_max_pd(_mm_loadu_pd(data + i + 2), high);
+        }
+    }
+    double lanes[4];
+    _mm_storeu_pd(lanes, low);
+    _mm_storeu_pd(lanes + 2, high);
+    double result = foldExtremes<Min>(lanes);
+    for (; i < count; ++i) {
+        if (Min ? data[i] < result : data[i] > result) result = data[i];
+    }
+    return result;
+}
+
+int sumIntsSse2(const int* data, size_t count) {
+    __m128i total = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) total = _mm_add_epi32(total, load128(data + i));
+    int lanes[4];
+    store128(lanes, total);
+    int result = wrapAdd(wrapAdd(lanes[0], lanes[1]), wrapAdd(lanes[2], lanes[3]));
+    for (; i < count; ++i) result = wrapAdd(result, data[i]);
+    return result;
+}
+
+template <bool Min>
+int extremeIntsSse2(const int* data, size_t count) {
+    __m128i result = _mm_set1_epi32(data[0]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = load128(data + i);
+        __m128i take = Min ? _mm_cmplt_epi32(x, result) : _mm_cmpgt_epi32(x, result);
+        result = _mm_or_si128(_mm_and_si128(take, x), _mm_andnot_si128(take, result));
+    }
+    int lanes[4];
+    store128(lanes, result);
+    int extreme = extremeIntsScalar<Min>(lanes, 4);
+    for (; i < count; ++i) {
+        if (Min ? data[i] < extreme : data[i] > extreme) extreme = data[i];
+    }
+    return extreme;
+}
+
+void scaleDoublesSse2(const double* data, double factor, double* out, size_t count) {
+    __m128d k = _mm_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(data + i), k));
+    for (; i < count; ++i) out[i] = data[i] * factor;
+}
+
+void addDoublesSse2(const double* left, const double* right, double* out, size_t count) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    for (; i < count; ++i) out[i] = left[i] + right[i];
+}
+
+void addIntsSse2(const int* left, const int* right, int* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) store128(out + i, _mm_add_epi32(load128(left + i), load128(right + i)));
+    for (; i < count; ++i) out[i] = wrapAdd(left[i], right[i]);
+}
+
+template <BinaryOp Relation>
+void compareIntsSse2(const int* left, const int* right, size_t rightStep, int* out, size_t count) {
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i broadcast = _mm_set1_epi32(right[0]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i l = load128(left + i);
+        __m128i r = rightStep ? load128(right + i) : broadcast;
+        __m128i mask = Relation == BinaryOp::Less ? _mm_cmplt_epi32(l, r)
+                     : Relation == BinaryOp::Greater ? _mm_cmpgt_epi32(l, r) : _mm_cmpeq_epi32(l, r);
+        store128(out + i, _mm_and_si128(mask, one));
+    }
+    for (; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+}
+
+template <BinaryOp Relation>
+void compareDoublesSse2(const double* left, const double* right, size_t rightStep, int* out, size_t count) {
+    __m128d broadcast = _mm_set1_pd(right[0]);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d l = _mm_loadu_pd(left + i);
+        __m128d r = rightStep ? _mm_loadu_pd(right + i) : broadcast;
+        __m128d mask = Relation == BinaryOp::Less ? _mm_cmplt_pd(l, r)
+                     : Relation == BinaryOp::Greater ? _mm_cmpgt_pd(l, r) : _mm_cmpeq_pd(l, r);
+        int bits = _mm_movemask_pd(mask);
+        out[i] = bits & 1;
+        out[i + 1] = bits >> 1;
+    }
+    for (; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+}
+
+// AVX2: double sums in 4 registers of four lanes, p[k] holding partial sums
+// 4k..4k+3
+
+AVX2_FUNCTION double sumDoublesAvx2(const double* data, const double* right, size_t count) {
+    __m256d p0 = _mm256_setzero_pd(), p1 = p0, p2 = p0, p3 = p0;
+    size_t i = 0;
+    if (right) {
+        for (; i + 16 <= count; i += 16) {
+            p0 = _mm256_add_pd(p0, _mm256_mul_pd(_mm256_loadu_pd(data + i), _mm256_loadu_pd(right + i)));
+            p1 = _mm256_add_pd(p1, _mm256_mul_pd(_mm256_loadu_pd(data + i + 4), _mm256_loadu_pd(right + i + 4)));
+            p2 = _mm256_add_pd(p2, _mm256_mul_pd(_mm256_loadu_pd(data + i + 8), _mm256_loadu_pd(right + i + 8)));
+            p3 = _mm256_add_pd(p3, _mm256_mul_pd(_mm256_loadu_pd(data + i + 12), _mm256_loadu_pd(right + i + 12)));
+        }
+    } else {
+        for (; i + 16 <= count; i += 16) {
+            p0 = _mm256_add_pd(p0, _mm256_loadu_pd(data + i));
+            p1 = _mm256_add_pd(p1, _mm256_loadu_pd(data + i + 4));
+            p2 = _mm256_add_pd(p2, _mm256_loadu_pd(data + i + 8));
+            p3 = _mm256_add_pd(p3, _mm256_loadu_pd(data + i + 12));
+        }
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(p0, p1), _mm256_add_pd(p2, p3)));
+    double total = foldLanes(lanes);
+    for (; i < count; ++i) total += right ? data[i] * right[i] : data[i];
+    return total;
+}
+
+template <bool Min>
+AVX2_FUNCTION double extremeDoublesAvx2(const double* data, size_t count) {
+    __m256d result = _mm256_set1_pd(data[0]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(data + i);
+        result = Min ? _mm256_min_pd(x, result) : _mm256_max_pd(x, result);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, result);
+    double extreme = foldExtremes<Min>(lanes);
+    for (; i < count; ++i) {
+        if (Min ? data[i] < extreme : data[i] > extreme) extreme = data[i];
+    }
+    return extreme;
+}
+
+AVX2_FUNCTION __m256i load256(const int* data) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)); }
+AVX2_FUNCTION void store256(int* out, __m256i value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), value); }
+
+// right == nullptr sums data alone
+AVX2_FUNCTION int sumIntsAvx2(const int* data, const int* right, size_t count) {
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i term = load256(data + i);
+        if (right) term = _mm256_mullo_epi32(term, load256(right + i));
+        total = _mm256_add_epi32(total, term);
+    }
+    int lanes[8];
+    store256(lanes, total);
+    int result = 0;
+    for (int lane : lanes) result = wrapAdd(result, lane);
+    for (; i < count; ++i) result = wrapAdd(result, right ? wrapMul(data[i], right[i]) : data[i]);
+    return result;
+}
+
+template <bool Min>
+AVX2_FUNCTION int extremeIntsAvx2(const int* data, size_t count) {
+    __m256i result = _mm256_set1_epi32(data[0]);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i x = load256(data + i);
+        result = Min ? _mm256_min_epi32(x, result) : _mm256_max_epi32(x, result);
+    }
+    int lanes[8];
+    store256(lanes, result);
+    int extreme = extremeIntsScalar<Min>(lanes, 8);
+    for (; i < count; ++i) {
+        if (Min ? data[i] < extreme : data[i] > extreme) extreme = data[i];
+    }
+    return extreme;
+}
+
+AVX2_FUNCTION void scaleIntsAvx2(const int* data, int factor, int* out, size_t count) {
+    __m256i k = _mm256_set1_epi32(factor);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) store256(out + i, _mm256_mullo_epi32(load256(data + i), k));
+    scaleIntsScalar(data, factor, out, i, count);
+}
+
+AVX2_FUNCTION void scaleDoublesAvx2(const double* data, double factor, double* out, size_t count) {
+    __m256d k = _mm256_set1_pd(factor);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), k));
+    for (; i < count; ++i) out[i] = data[i] * factor;
+}
+
+AVX2_FUNCTION void addIntsAvx2(const int* left, const int* right, int* out, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) store256(out + i, _mm256_add_epi32(load256(left + i), load256(right + i)));
+    for (; i < count; ++i) out[i] = wrapAdd(left[i], right[i]);
+}
+
+AVX2_FUNCTION void addDoublesAvx2(const double* left, const double* right, double* out, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    }
+    for (; i < count; ++i) out[i] = left[i] + right[i];
+}
+
+template <BinaryOp Relation>
+AVX2_FUNCTION void compareIntsAvx2(const int* left, const int* right, size_t rightStep, int* out, size_t count) {
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256i broadcast = _mm256_set1_epi32(right[0]);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i l = load256(left + i);
+        __m256i r = rightStep ? load256(right + i) : broadcast;
+        __m256i mask = Relation == BinaryOp::Less ? _mm256_cmpgt_epi32(r, l)
+                     : Relation == BinaryOp::Greater ? _mm256_cmpgt_epi32(l, r) : _mm256_cmpeq_epi32(l, r);
+        store256(out + i, _mm256_and_si256(mask, one));
+    }
+    for (; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+}
+
+template <BinaryOp Relation>
+AVX2_FUNCTION void compareDoublesAvx2(const double* left, const double* right, size_t rightStep, int* out,
+                                      size_t count) {
+    // Ordered comparisons: false when either side is NaN, like C++'s operators
+    constexpr int predicate = Relation == BinaryOp::Less ? _CMP_LT_OQ
+                            : Relation == BinaryOp::Greater ? _CMP_GT_OQ : _CMP_EQ_OQ;
+    __m256d broadcast = _mm256_set1_pd(right[0]);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d r = rightStep ? _mm256_loadu_pd(right + i) : broadcast;
+        int bits = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(left + i), r, predicate));
+        out[i] = bits & 1;
+        out[i + 1] = (bits >> 1) & 1;
+        out[i + 2] = (bits >> 2) & 1;
+        out[i + 3] = bits >> 3;
+    }
+    for (; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+}
+#endif
+
+template <template <BinaryOp> class Kernel, typename... Args>
+void forRelation(BinaryOp relation, Args... args) {
+    if (relation == BinaryOp::Less) Kernel<BinaryOp::Less>::run(args...);
+    else if (relation == BinaryOp::Greater) Kernel<BinaryOp::Greater>::run(args...);
+    else Kernel<BinaryOp::Equal>::run(args...);
+}
+
+template <BinaryOp Relation>
+struct CompareInts {
+    static void run(const int* left, const int* right, size_t rightStep, int* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+        if (kHasAvx2) return compareIntsAvx2<Relation>(left, right, rightStep, out, count);
+        return compareIntsSse2<Relation>(left, right, rightStep, out, count);
+#else
+        for (size_t i = 0; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+#endif
+    }
+};
+
+template <BinaryOp Relation>
+struct CompareDoubles {
+    static void run(const double* left, const double* right, size_t rightStep, int* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+        if (kHasAvx2) return compareDoublesAvx2<Relation>(left, right, rightStep, out, count);
+        return compareDoublesSse2<Relation>(left, right, rightStep, out, count);
+#else
+        for (size_t i = 0; i < count; ++i) out[i] = holds(Relation, left[i], right[i * rightStep]);
+#endif
+    }
+};
+
+} // namespace
+
+int sumInts(const int* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return sumIntsAvx2(data, nullptr, count);
+    return sumIntsSse2(data, count);
+#else
+    return sumIntsScalar(data, count);
+#endif
+}
+
+double sumDoubles(const double* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return sumDoublesAvx2(data, nullptr, count);
+    return sumDoublesSse2(data, nullptr, count);
+#else
+    return sumProductsScalar(data, nullptr, count);
+#endif
+}
+
+int dotInts(const int* left, const int* right, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    // SSE2 has no 32-bit multiply
+    if (kHasAvx2) return sumIntsAvx2(left, right, count);
+#endif
+    return dotIntsScalar(left, right, count);
+}
+
+double dotDoubles(const double* left, const double* right, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return sumDoublesAvx2(left, right, count);
+    return sumDoublesSse2(left, right, count);
+#else
+    return sumProductsScalar(left, right, count);
+#endif
+}
+
+int minInts(const int* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return extremeIntsAvx2<true>(data, count);
+    return extremeIntsSse2<true>(data, count);
+#else
+    return extremeIntsScalar<true>(data, count);
+#endif
+}
+
+int maxInts(const int* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return extremeIntsAvx2<false>(data, count);
+    return extremeIntsSse2<false>(data, count);
+#else
+    return extremeIntsScalar<false>(data, count);
+#endif
+}
+
+double minDoubles(const double* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return extremeDoublesAvx2<true>(data, count);
+    return extremeDoublesSse2<true>(data, count);
+#else
+    return extremeDoublesScalar<true>(data, count);
+#endif
+}
+
+double maxDoubles(const double* data, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return extremeDoublesAvx2<false>(data, count);
+    return extremeDoublesSse2<false>(data, count);
+#else
+    return extremeDoublesScalar<false>(data, count);
+#endif
+}
+
+void scaleInts(const int* data, int factor, int* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return scaleIntsAvx2(data, factor, out, count);
+#endif
+    scaleIntsScalar(data, factor, out, 0, count);
+}
+
+void scaleDoubles(const double* data, double factor, double* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return scaleDoublesAvx2(data, factor, out, count);
+    return scaleDoublesSse2(data, factor, out, count);
+#else
+    for (size_t i = 0; i < count; ++i) out[i] = data[i] * factor;
+#endif
+}
+
+void addInts(const int* left, const int* right, int* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return addIntsAvx2(left, right, out, count);
+    return addIntsSse2(left, right, out, count);
+#else
+    for (size_t i = 0; i < count; ++i) out[i] = wrapAdd(left[i], right[i]);
+#endif
+}
+
+void addDoubles(const double* left, const double* right, double* out, size_t count) {
+#ifdef HAPPYSCRIPT_SIMD
+    if (kHasAvx2) return addDoublesAvx2(left, right, out, count);
+    return addDoublesSse2(left, right, out, count);
+#else
+    for (size_t i = 0; i < count; ++i) out[i] = left[i] + right[i];
+#endif
+}
+
+void compareInts(BinaryOp relation, const int* left, const int* right, size_t rightStep, int* out, size_t count) {
+    forRelation<CompareInts>(relation, left, right, rightStep, out, count);
+}
+
+void compareDoubles(BinaryOp relation, const double* left, const double* right, size_t rightStep, int* out,
+                    size_t count) {
+    forRelation<CompareDoubles>(relation, left, right, rightStep, out, count);
+}
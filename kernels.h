@@ -0,0 +1,36 @@
+#pragma once
+
+#include "value.h"
+#include <cstddef>
+
+// The loops behind the array builtins (see arrays.h). On x86-64 they use
+// AVX2 when the CPU has it and SSE2 otherwise; elsewhere, or when built with
+// HAPPYSCRIPT_NO_SIMD, they are plain loops. Int arithmetic wraps around
+// like the engines' int operators.
+//
+// Every path adds doubles in the same order (16 interleaved partial sums,
+// folded pairwise, then the elements left over), and min/max keep 4 lanes
+// the same way, so a result never depends on which path ran.
+
+int sumInts(const int* data, size_t count);
+double sumDoubles(const double* data, size_t count);
+int dotInts(const int* left, const int* right, size_t count);
+double dotDoubles(const double* left, const double* right, size_t count);
+
+// count must not be 0. NaN elements are skipped unless the first one is NaN.
+int minInts(const int* data, size_t count);
+int maxInts(const int* data, size_t count);
+double minDoubles(const double* data, size_t count);
+double maxDoubles(const double* data, size_t count);
+
+void scaleInts(const int* data, int factor, int* out, size_t count);
+void scaleDoubles(const double* data, double factor, double* out, size_t count);
+void addInts(const int* left, const int* right, int* out, size_t count);
+void addDoubles(const double* left, const double* right, double* out, size_t count);
+
+// out[i] = 1 where left[i] relation right[i] holds, 0 elsewhere, for relation
+// Less, Greater or Equal. With rightStep 0 every element is compared with
+// right[0].
+void compareInts(BinaryOp relation, const int* left, const int* right, size_t rightStep, int* out, size_t count);
+void compareDoubles(BinaryOp relation, const double* left, const double* right, size_t rightStep, int* out,
+                    size_t count);
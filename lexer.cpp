@@ -1,7 +1,210 @@
 #include "lexer.h"
-#include <cctype>
+#include <array>
 #include <stdexcept>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(HAPPYSCRIPT_NO_SIMD)
+#define HAPPYSCRIPT_SIMD 1
+#include <immintrin.h>
+// Compiled for AVX2 but only called after checking the CPU has it
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+// Character classes as std::isspace, std::isdigit and std::isalpha see them
+// in the "C" locale, without the call; bytes from 0x80 up are in none
+enum CharClass : uint8_t {
+    kSpace = 1,
+    kDigit = 2,
+    kAlpha = 4,
+    kDot = 8,
+    kAlnum = kDigit | kAlpha,
+    kNumber = kDigit | kDot, // what a number literal is made of
+};
+
+constexpr std::array<uint8_t, 256> makeClasses() {
+    std::array<uint8_t, 256> classes{};
+    for (int c = '\t'; c <= '\r'; ++c) classes[c] = kSpace;
+    classes[' '] = kSpace;
+    for (int c = '0'; c <= '9'; ++c) classes[c] = kDigit;
+    for (int c = 'a'; c <= 'z'; ++c) classes[c] = classes[c - 'a' + 'A'] = kAlpha;
+    classes['.'] = kDot;
+    return classes;
+}
+
+constexpr std::array<uint8_t, 256> kClasses = makeClasses();
+
+bool inClass(char c, uint8_t mask) {
+    return kClasses[static_cast<unsigned char>(c)] & mask;
+}
+
+// Keywords, found with one comparison through a perfect hash of the first
+// byte and the length
+struct Keyword {
+    std::string_view text;
+    TokenType type = TokenType::Identifier;
+};
+
+constexpr Keyword kKeywords[] = {
+    {"smile", TokenType::Print}, {"int", TokenType::IntType}, {"float", TokenType::FloatType},
+    {"string", TokenType::StringType}, {"ana", TokenType::IfType}, {"elsa", TokenType::ElseType},
+    {"fun", TokenType::WhileType},
+};
+
+constexpr size_t kKeywordSlots = 16;
+
+constexpr size_t keywordSlot(std::string_view word) {
+    return (static_cast<unsigned char>(word[0]) + 5 * word.size()) % kKeywordSlots;
+}
+
+constexpr std::array<Keyword, kKeywordSlots> makeKeywordTable() {
+    std::array<Keyword, kKeywordSlots> table{};
+    for (const Keyword& keyword : kKeywords) table[keywordSlot(keyword.text)] = keyword;
+    return table;
+}
+
+constexpr std::array<Keyword, kKeywordSlots> kKeywordTable = makeKeywordTable();
+
+constexpr bool keywordsHaveOwnSlots() {
+    for (const Keyword& keyword : kKeywords) {
+        if (kKeywordTable[keywordSlot(keyword.text)].text != keyword.text) return false;
+    }
+    return true;
+}
+static_assert(keywordsHaveOwnSlots(), "two keywords hash to one slot; change keywordSlot");
+
+// Identifier, or the keyword spelled word
+TokenType wordType(std::string_view word) {
+    const Keyword& keyword = kKeywordTable[keywordSlot(word)];
+    return keyword.text == word ? keyword.type : TokenType::Identifier;
+}
+
+// Adds the line breaks marked in breaks, bit i standing for offset base + i
+void countBreaks(uint32_t breaks, size_t base, uint32_t& line, size_t& lineStart) {
+    if (breaks == 0) return;
+    line += static_cast<uint32_t>(__builtin_popcount(breaks));
+    lineStart = base + (31 - __builtin_clz(breaks)) + 1;
+}
+
+#ifdef HAPPYSCRIPT_SIMD
+const bool kHasAvx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+
+// Runs of whitespace, identifier characters and digits rarely reach 16
+// bytes, so they are scanned 16 at a time with SSE2; string bodies can be
+// long and use AVX2 where the CPU has it.
+
+__m128i load16(const char* data) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)); }
+
+uint32_t maskOf(__m128i matches) { return static_cast<uint32_t>(_mm_movemask_epi8(matches)); }
+
+// Bytes from lo to hi. Both are below 0x80, so bytes from 0x80 up, which
+// compare as negative, never match.
+__m128i inRange(__m128i bytes, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmplt_epi8(bytes, _mm_set1_epi8(static_cast<char>(hi + 1))));
+}
+
+uint32_t spaceMask(const char* data) {
+    __m128i bytes = load16(data);
+    return maskOf(_mm_or_si128(inRange(bytes, '\t', '\r'), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+}
+
+uint32_t alnumMask(const char* data) {
+    __m128i bytes = load16(data);
+    // Setting bit 5 folds 'A'..'Z' onto 'a'..'z' and nothing else onto them
+    __m128i letters = inRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z');
+    return maskOf(_mm_or_si128(letters, inRange(bytes, '0', '9')));
+}
+
+uint32_t newlineMask(const char* data) {
+    return maskOf(_mm_cmpeq_epi8(load16(data), _mm_set1_epi8('\n')));
+}
+
+uint32_t numberMask(const char* data) {
+    __m128i bytes = load16(data);
+    return maskOf(_mm_or_si128(inRange(bytes, '0', '9'), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('.'))));
+}
+
+// Where the run of bytes in Mask's class (cls for the last few bytes) that
+// starts at pos ends
+template <uint32_t (*Mask)(const char*)>
+size_t runEnd(const char* data, size_t pos, size_t size, uint8_t cls) {
+    for (; pos + 16 <= size; pos += 16) {
+        uint32_t others = ~Mask(data + pos) & 0xFFFF;
+        if (others != 0) return pos + __builtin_ctz(others);
+    }
+    while (pos < size && inClass(data[pos], cls)) ++pos;
+    return pos;
+}
+
+AVX2_FUNCTION size_t quoteEndAvx2(const char* data, size_t pos, size_t size, uint32_t& line, size_t& lineStart) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; pos + 32 <= size; pos += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+        uint32_t quotes = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)));
+        uint32_t breaks = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+        if (quotes != 0) {
+            countBreaks(breaks & ((quotes & (0 - quotes)) - 1), pos, line, lineStart);
+            return pos + __builtin_ctz(quotes);
+        }
+        countBreaks(breaks, pos, line, lineStart);
+    }
+    return pos;
+}
+
+size_t quoteEndSse2(const char* data, size_t pos, size_t size, uint32_t& line, size_t& lineStart) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= size; pos += 16) {
+        __m128i bytes = load16(data + pos);
+        uint32_t quotes = maskOf(_mm_cmpeq_epi8(bytes, quote));
+        uint32_t breaks = maskOf(_mm_cmpeq_epi8(bytes, newline));
+        if (quotes != 0) {
+            countBreaks(breaks & ((quotes & (0 - quotes)) - 1), pos, line, lineStart);
+            return pos + __builtin_ctz(quotes);
+        }
+        countBreaks(breaks, pos, line, lineStart);
+    }
+    return pos;
+}
+#endif
+
+size_t wordEnd(const char* data, size_t pos, size_t size) {
+#ifdef HAPPYSCRIPT_SIMD
+    return runEnd<alnumMask>(data, pos, size, kAlnum);
+#else
+    while (pos < size && inClass(data[pos], kAlnum)) ++pos;
+    return pos;
+#endif
+}
+
+size_t numberEnd(const char* data, size_t pos, size_t size) {
+#ifdef HAPPYSCRIPT_SIMD
+    return runEnd<numberMask>(data, pos, size, kNumber);
+#else
+    while (pos < size && inClass(data[pos], kNumber)) ++pos;
+    return pos;
+#endif
+}
+
+// Where the '"' closing a string body that starts at pos is (size if there
+// is none), counting the line breaks on the way
+size_t quoteEnd(const char* data, size_t pos, size_t size, uint32_t& line, size_t& lineStart) {
+#ifdef HAPPYSCRIPT_SIMD
+    pos = kHasAvx2 ? quoteEndAvx2(data, pos, size, line, lineStart) : quoteEndSse2(data, pos, size, line, lineStart);
+#endif
+    for (; pos < size && data[pos] != '"'; ++pos) {
+        if (data[pos] == '\n') {
+            ++line;
+            lineStart = pos + 1;
+        }
+    }
+    return pos;
+}
+
+} // namespace
+
 char Lexer::peek() const {
     return pos < source.size() ? source[pos] : '\0';
 }
@@ -11,72 +214,105 @@ char Lexer::get() {
 }
 
 void Lexer::skipWhitespace() {
-    while (std::isspace(peek())) get();
+    const char* data = source.data();
+    size_t size = source.size();
+#ifdef HAPPYSCRIPT_SIMD
+    for (; pos + 16 <= size; pos += 16) {
+        uint32_t spaces = spaceMask(data + pos);
+        uint32_t run = __builtin_ctz(~spaces); // at most 16
+        countBreaks(newlineMask(data + pos) & ((1u << run) - 1), pos, line, lineStart);
+        if (run < 16) {
+            pos += run;
+            return;
+        }
+    }
+#endif
+    for (; pos < size && inClass(data[pos], kSpace); ++pos) {
+        if (data[pos] == '\n') newLine(pos + 1);
+    }
+}
+
+void Lexer::newLine(size_t start) {
+    ++line;
+    lineStart = start;
 }
 
 bool Lexer::isAtEnd() const {
     return pos >= source.size();
 }
 
+uint32_t Interner::intern(std::string_view name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+    uint32_t id = static_cast<uint32_t>(spellings.size());
+    spellings.push_back(name);
+    ids.emplace(name, id);
+    return id;
+}
+
 std::vector<Token> Lexer::tokenize() {
     std::vector<Token> tokens;
+    // Generated scripts run as dense as a token per two or three bytes. The
+    // regrowth copy would cost more than reserving pages that are never
+    // written, which cost nothing.
+    tokens.reserve(source.size() / 2);
     skipWhitespace();
        
     while (pos < source.size()) {
+        size_t lexed = tokens.size();
+        SourcePos at{line, static_cast<uint32_t>(pos - lineStart + 1)};
         char c = peek();
-        
-        if (std::isdigit(c)) {
-            std::string num;
-            while (std::isdigit(peek()) || peek() == '.') num += get();
-            tokens.push_back({TokenType::Number, num});
+        uint8_t cls = kClasses[static_cast<unsigned char>(c)];
+
+        if (cls & kDigit) {
+            size_t start = pos;
+            pos = numberEnd(source.data(), pos + 1, source.size());
+            tokens.push_back({TokenType::Number, source.substr(start, pos - start)});
         }
         else if (c == '"') {
             get();
-            std::string str;
-            while (peek() != '"' && !isAtEnd()) {
-                str += get();
-            }
+            size_t start = pos;
+            pos = quoteEnd(source.data(), pos, source.size(), line, lineStart);
+            size_t end = pos;
             if (get() != '"') {
                 throw std::runtime_error("Unterminated string literal");
             }
-            tokens.push_back({ TokenType::StringLiteral, str });
+            tokens.push_back({ TokenType::StringLiteral, source.substr(start, end - start) });
         }
         else if (c == '\'') {
             get(); // consume opening quote
-            char ch = get();
+            size_t at = pos;
+            get();
             if (peek() == '\\') { // handle escape sequences
                 get(); // consume '\'
-                ch = get(); // get escaped character
+                at = pos;
+                get(); // get escaped character
             }
             if (get() != '\'') {
                 throw std::runtime_error("Unterminated character literal");
             }
-            tokens.push_back({ TokenType::StringLiteral, std::string(1, ch) });
+            tokens.push_back({ TokenType::StringLiteral, source.substr(at, 1) });
         }
-        else if (std::isalpha(c)) {
-            std::string id;
-            while (std::isalnum(peek())) id += get();
-            if (id == "smile") tokens.push_back({ TokenType::Print, id });
-            else if (id == "int") tokens.push_back({ TokenType::IntType, id });
-            else if (id == "float") tokens.push_back({ TokenType::FloatType, id });
-            else if (id == "string") tokens.push_back({ TokenType::StringType, id });
-            else if (id == "ana") tokens.push_back({ TokenType::IfType, id });
-            else if (id == "elsa") tokens.push_back({ TokenType::ElseType, id });
-            else if (id == "fun") tokens.push_back({ TokenType::WhileType, id }); // <-- Add this line
-            else tokens.push_back({TokenType::Identifier, id});
+        else if (cls & kAlpha) {
+            size_t start = pos;
+            pos = wordEnd(source.data(), pos + 1, source.size());
+            std::string_view id = source.substr(start, pos - start);
+            TokenType type = wordType(id);
+            if (type == TokenType::Identifier) tokens.push_back({type, id, interner.intern(id)});
+            else tokens.push_back({type, id});
         }
         
         
         else {
             switch (c) {
-                case '+': tokens.push_back({TokenType::Plus, std::string(1,get())}); break;
-                case '-': tokens.push_back({TokenType::Minus, std::string(1,get())}); break;
-                case '*': tokens.push_back({TokenType::Star, std::string(1,get())}); break;
-                case '/': tokens.push_back({TokenType::Slash, std::string(1,get())}); break;
-                case '%': tokens.push_back({TokenType::Percent, std::string(1,get())}); break; // <-- Add this line
-                case '(': tokens.push_back({TokenType::LParen, std::string(1,get())}); break;
-                case ')': tokens.push_back({TokenType::RParen, std::string(1,get())}); break;
-                case ';': tokens.push_back({TokenType::Semicolon, std::string(1,get())}); break;
+                case '+': tokens.push_back({TokenType::Plus, source.substr(pos++, 1)}); break;
+                case '-': tokens.push_back({TokenType::Minus, source.substr(pos++, 1)}); break;
+                case '*': tokens.push_back({TokenType::Star, source.substr(pos++, 1)}); break;
+                case '/': tokens.push_back({TokenType::Slash, source.substr(pos++, 1)}); break;
+                case '%': tokens.push_back({TokenType::Percent, source.substr(pos++, 1)}); break; // <-- Add this line
+                case '(': tokens.push_back({TokenType::LParen, source.substr(pos++, 1)}); break;
+                case ')': tokens.push_back({TokenType::RParen, source.substr(pos++, 1)}); break;
+                case ';': tokens.push_back({TokenType::Semicolon, source.substr(pos++, 1)}); break;
                 case '=':
                     get(); // consume '='
                     if (peek() == '=') {
@@ -95,8 +331,11 @@ std::vector<Token> Lexer::tokenize() {
                         // handle single '!' if needed
                     }
                     break;
-                case '{': tokens.push_back({TokenType::LBrace, std::string(1,get())}); break;
-                case '}': tokens.push_back({TokenType::RBrace, std::string(1,get())}); break;
+                case '[': tokens.push_back({TokenType::LBracket, source.substr(pos++, 1)}); break;
+                case ']': tokens.push_back({TokenType::RBracket, source.substr(pos++, 1)}); break;
+                case ',': tokens.push_back({TokenType::Comma, source.substr(pos++, 1)}); break;
+                case '{': tokens.push_back({TokenType::LBrace, source.substr(pos++, 1)}); break;
+                case '}': tokens.push_back({TokenType::RBrace, source.substr(pos++, 1)}); break;
                 case '<':
                     get(); // consume '<'
                     if (peek() == '=') {
@@ -118,8 +357,10 @@ std::vector<Token> Lexer::tokenize() {
                 default: get(); break; // skip unknown
             }
         }
+        if (tokens.size() > lexed) tokens.back().at = at;
         skipWhitespace();
     }
-    tokens.push_back({TokenType::End, ""});
+    tokens.push_back({TokenType::End, std::string_view()});
+    tokens.back().at = {line, static_cast<uint32_t>(pos - lineStart + 1)};
     return tokens;
 }
@@ -1,8 +1,12 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     Number, Identifier, Plus, Minus, Star, Slash,
     LParen, RParen, Semicolon, Equal, IntType, FloatType, End, Print, StringType,  // Added StringType
     StringLiteral, IfType, DoubleEqual, BangEqual, ElseType, Percent, WhileType, // <-- Add this line
@@ -10,22 +14,61 @@ enum class TokenType {
     Greater,        // >
     LessEqual,      // <=
     GreaterEqual,   // >=
+    LBracket, RBracket, Comma,
+    IntArrayType, FloatArrayType, // 'int[]' and 'float[]', made by the parser
 };
 
+constexpr uint32_t kNoSymbol = UINT32_MAX;
+
+// 1-based line and byte column; line 0 means unknown
+struct SourcePos {
+    uint32_t line = 0;
+    uint32_t column = 0;
+};
+
+// Tokens point into the source buffer, which must outlive them
 struct Token {
+    std::string_view text;
+    uint32_t symbol;  // Interner id, for identifiers only
     TokenType type;
-    std::string text;
+    SourcePos at;     // where the token starts
+
+    Token(TokenType type, std::string_view text, uint32_t symbol = kNoSymbol)
+        : text(text), symbol(symbol), type(type) {}
 };
 
+// Identifier spellings, each stored once as a view into the source
+class Interner {
+public:
+    uint32_t intern(std::string_view name);
+    const std::vector<std::string_view>& names() const { return spellings; }
+private:
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<std::string_view> spellings;
+};
+
+// Bytes in the character literal at the start of text, as the Lexer reads
+// it: 3 for 'c', 5 for 'c\e'. Only the third byte decides; the scanners that
+// find statement ends without lexing share this so they skip the same bytes.
+inline size_t charLiteralLength(std::string_view text) {
+    return text.size() > 2 && text[2] == '\\' ? 5 : 3;
+}
+
 class Lexer {
 public:
-    explicit Lexer(const std::string &src) : source(src) {}
+    // firstLine: the line src starts on, for a piece cut from a longer source
+    explicit Lexer(std::string_view src, uint32_t firstLine = 1) : source(src), line(firstLine) {}
     std::vector<Token> tokenize();
+    const Interner& symbols() const { return interner; }
 private:
-    std::string source;
+    std::string_view source;
     size_t pos = 0;
+    Interner interner;
+    uint32_t line = 1;     // of pos
+    size_t lineStart = 0;  // offset of that line
     char peek() const;
     char get();
     void skipWhitespace();
     bool isAtEnd() const;
+    void newLine(size_t start);
 };
@@ -0,0 +1,307 @@
+#include "loop_optimizer.h"
+#include <climits>
+
+void LoopOptimizer::run() {
+    for (NodeId stmt : ast.statements) visitStmt(stmt);
+}
+
+// Nodes are copied, not referenced: hoisting appends to ast.nodes
+void LoopOptimizer::visitStmt(NodeId id) {
+    const Node node = ast[id];
+    switch (node.kind) {
+        case NodeKind::If:
+            if (node.b != kNoNode) visitStmt(node.b);
+            if (node.c != kNoNode) visitStmt(node.c);
+            break;
+        case NodeKind::While:
+            optimizeLoop(id);
+            break;
+        case NodeKind::Block:
+            for (uint32_t i = 0; i < node.b; ++i) visitStmt(ast.lists[node.a + i]);
+            break;
+        default:
+            break;
+    }
+}
+
+// Outer loops go first, so an expression is hoisted to the outermost loop
+// it is invariant in; inner loops then see it as a plain Hoisted leaf.
+void LoopOptimizer::optimizeLoop(NodeId id) {
+    assignments.assign(ast.names.size() + 1, 0);
+    reads.assign(ast.names.size() + 1, 0);
+    countUses(ast[id].a);
+    countUses(ast[id].b);
+
+    ClosedForm form;
+    if (matchClosedForm(ast[id], form)) {
+        uint32_t loop = loopIndex(id);
+        ast.loops[loop].hasClosedForm = true;
+        ast.loops[loop].closedForm = std::move(form);
+        ++closedFormLoops;
+        return;
+    }
+
+    hoistInExpr(ast[id].a, id);
+    hoistInStmt(ast[id].b, id);
+    visitStmt(ast[id].b);
+}
+
+void LoopOptimizer::countUses(NodeId id) {
+    const Node& node = ast[id];
+    auto grow = [this](uint32_t slot) {
+        if (slot >= assignments.size()) {
+            assignments.resize(slot + 1, 0);
+            reads.resize(slot + 1, 0);
+        }
+    };
+    switch (node.kind) {
+        case NodeKind::Variable:
+            grow(node.b);
+            ++reads[node.b];
+            break;
+        case NodeKind::Binary:
+        case NodeKind::Index:
+        case NodeKind::While:
+            countUses(node.a);
+            countUses(node.b);
+            break;
+        case NodeKind::StoreElement: {
+            // Changes the array, so expressions reading it stay in the loop
+            uint32_t slot = ast[node.c].b;
+            grow(slot);
+            ++assignments[slot];
+            countUses(node.a);
+            countUses(node.b);
+            countUses(node.c);
+            break;
+        }
+        case NodeKind::Hoisted:
+        case NodeKind::Print:
+            countUses(node.a);
+            break;
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            grow(node.b);
+            ++assignments[node.b];
+            countUses(node.a);
+            break;
+        case NodeKind::If:
+            countUses(node.a);
+            if (node.b != kNoNode) countUses(node.b);
+            if (node.c != kNoNode) countUses(node.c);
+            break;
+        case NodeKind::Call:
+        case NodeKind::ArrayLiteral:
+        case NodeKind::Block:
+            for (const NodeId* s = ast.begin(node); s != ast.end(node); ++s) countUses(*s);
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t LoopOptimizer::loopIndex(NodeId id) {
+    if (ast[id].c == kNoNode) {
+        ast[id].c = static_cast<uint32_t>(ast.loops.size());
+        ast.loops.emplace_back();
+    }
+    return ast[id].c;
+}
+
+// fun (i < bound) { ... } where every statement of the body is either the
+// single counter update i = i + c / i = i - c, or acc = acc + term with term
+// one of i, i * c, c * i or c, and acc read nowhere else in the loop
+bool LoopOptimizer::matchClosedForm(const Node& loop, ClosedForm& form) const {
+    const Node& cond = ast[loop.a];
+    if (cond.kind != NodeKind::Binary) return false;
+    NodeId counterSide, boundSide;
+    BinaryOp relation = cond.op;
+    if (ast[cond.a].kind == NodeKind::Variable) {
+        counterSide = cond.a;
+        boundSide = cond.b;
+    } else {
+        counterSide = cond.b;
+        boundSide = cond.a;
+        switch (relation) {
+            case BinaryOp::Less: relation = BinaryOp::Greater; break;
+            case BinaryOp::LessEqual: relation = BinaryOp::GreaterEqual; break;
+            case BinaryOp::Greater: relation = BinaryOp::Less; break;
+            case BinaryOp::GreaterEqual: relation = BinaryOp::LessEqual; break;
+            default: break;
+        }
+    }
+    if (relation != BinaryOp::Less && relation != BinaryOp::LessEqual &&
+        relation != BinaryOp::Greater && relation != BinaryOp::GreaterEqual) return false;
+    if (ast[counterSide].kind != NodeKind::Variable) return false;
+    form.induction = ast[counterSide].b;
+    form.relation = relation;
+
+    const Node& bound = ast[boundSide];
+    Value constant;
+    if (bound.kind == NodeKind::Variable) {
+        if (bound.b == form.induction || assignments[bound.b] != 0) return false;
+    } else if (!numericConstant(boundSide, constant)) {
+        return false;
+    }
+    form.bound = boundSide;
+
+    const Node& body = ast[loop.b];
+    if (body.kind != NodeKind::Block) return false;
+    bool counterSeen = false;
+    for (const NodeId* s = ast.begin(body); s != ast.end(body); ++s) {
+        const Node& stmt = ast[*s];
+        if (stmt.kind != NodeKind::Assign || assignments[stmt.b] != 1) return false;
+        const Node& value = ast[stmt.a];
+        if (stmt.b == form.induction) {
+            if (!matchCounter(value, stmt.b, form.step)) return false;
+            counterSeen = true;
+            continue;
+        }
+        ClosedForm::Accumulator acc;
+        if (!matchAccumulation(value, stmt.b, form.induction, acc)) return false;
+        acc.afterStep = counterSeen;
+        form.accumulators.push_back(std::move(acc));
+    }
+    return counterSeen;
+}
+
+bool LoopOptimizer::matchCounter(const Node& value, uint32_t slot, Value& step) const {
+    if (value.kind != NodeKind::Binary) return false;
+    if (value.op == BinaryOp::Add) {
+        if (isVariable(value.a, slot)) return numericConstant(value.b, step);
+        if (isVariable(value.b, slot)) return numericConstant(value.a, step);
+        return false;
+    }
+    if (value.op != BinaryOp::Sub || !isVariable(value.a, slot) || !numericConstant(value.b, step)) return false;
+    // i - c is exactly i + (-c) for both int and double
+    if (step.isInt()) {
+        if (step.asInt() == INT_MIN) return false;
+        step = -step.asInt();
+    } else {
+        step = -step.asDouble();
+    }
+    return true;
+}
+
+bool LoopOptimizer::matchAccumulation(const Node& value, uint32_t slot, uint32_t induction,
+                                      ClosedForm::Accumulator& acc) const {
+    if (value.kind != NodeKind::Binary || value.op != BinaryOp::Add || reads[slot] != 1) return false;
+    NodeId term;
+    if (isVariable(value.a, slot)) term = value.b;
+    else if (isVariable(value.b, slot)) term = value.a;
+    else return false;
+    acc.slot = slot;
+
+    const Node& termNode = ast[term];
+    if (isVariable(term, induction)) {
+        acc.scalesInduction = true;
+        acc.factor = 1;
+        return true;
+    }
+    if (termNode.kind == NodeKind::Binary && termNode.op == BinaryOp::Mul) {
+        // Strength reduction: sum of i * c is c times the sum of i
+        acc.scalesInduction = true;
+        if (isVariable(termNode.a, induction)) return numericConstant(termNode.b, acc.factor);
+        if (isVariable(termNode.b, induction)) return numericConstant(termNode.a, acc.factor);
+        return false;
+    }
+    acc.scalesInduction = false;
+    return numericConstant(term, acc.factor);
+}
+
+bool LoopOptimizer::isVariable(NodeId id, uint32_t slot) const {
+    return ast[id].kind == NodeKind::Variable && ast[id].b == slot;
+}
+
+bool LoopOptimizer::numericConstant(NodeId id, Value& out) const {
+    if (ast[id].kind != NodeKind::Number) return false;
+    out = ast.constants[ast[id].a];
+    return out.isNumber();
+}
+
+void LoopOptimizer::hoistInStmt(NodeId id, NodeId loop) {
+    const Node node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            hoistInExpr(node.a, loop);
+            break;
+        case NodeKind::StoreElement:
+            hoistInExpr(node.b, loop);
+            hoistInExpr(node.a, loop);
+            break;
+        case NodeKind::If:
+            hoistInExpr(node.a, loop);
+            if (node.b != kNoNode) hoistInStmt(node.b, loop);
+            if (node.c != kNoNode) hoistInStmt(node.c, loop);
+            break;
+        case NodeKind::While:
+            hoistInExpr(node.a, loop);
+            hoistInStmt(node.b, loop);
+            break;
+        case NodeKind::Block:
+            for (uint32_t i = 0; i < node.b; ++i) hoistInStmt(ast.lists[node.a + i], loop);
+            break;
+        default:
+            break;
+    }
+}
+
+// Hoists the largest invariant subexpressions of id
+void LoopOptimizer::hoistInExpr(NodeId id, NodeId loop) {
+    const Node node = ast[id];
+    if (node.kind != NodeKind::Binary && node.kind != NodeKind::Index && node.kind != NodeKind::Call &&
+        node.kind != NodeKind::ArrayLiteral) return;
+    if (isInvariant(id)) {
+        if (!isConstant(id)) hoist(id, loop);
+        return;
+    }
+    if (node.kind == NodeKind::Call || node.kind == NodeKind::ArrayLiteral) {
+        for (uint32_t i = 0; i < node.b; ++i) hoistInExpr(ast.lists[node.a + i], loop);
+        return;
+    }
+    NodeId left = node.a, right = node.b;
+    hoistInExpr(left, loop);
+    hoistInExpr(right, loop);
+}
+
+bool LoopOptimizer::isInvariant(NodeId id) const {
+    const Node& node = ast[id];
+    switch (node.kind) {
+        case NodeKind::Number:
+        case NodeKind::String:
+        case NodeKind::Hoisted:
+            return true;
+        case NodeKind::Variable:
+            return node.b >= assignments.size() || assignments[node.b] == 0;
+        case NodeKind::Binary:
+        case NodeKind::Index:
+            return isInvariant(node.a) && isInvariant(node.b);
+        case NodeKind::Call:
+        case NodeKind::ArrayLiteral:
+            for (const NodeId* e = ast.begin(node); e != ast.end(node); ++e) {
+                if (!isInvariant(*e)) return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Constants left over after folding are ones that raise an error
+bool LoopOptimizer::isConstant(NodeId id) const {
+    const Node& node = ast[id];
+    if (node.kind == NodeKind::Number || node.kind == NodeKind::String) return true;
+    return node.kind == NodeKind::Binary && isConstant(node.a) && isConstant(node.b);
+}
+
+void LoopOptimizer::hoist(NodeId id, NodeId loop) {
+    Node original = ast[id];
+    Node hoisted{NodeKind::Hoisted};
+    hoisted.a = ast.add(original);
+    hoisted.b = static_cast<uint32_t>(ast.hoistLoops.size());
+    ast.hoistLoops.push_back(loopIndex(loop));
+    ast[id] = hoisted;
+    ++hoistedExprs;
+}
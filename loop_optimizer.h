@@ -0,0 +1,49 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <vector>
+
+// The -O2 'fun' loop pass, run by Optimizer after folding:
+//
+//  - An expression whose variables are not assigned anywhere in a loop is
+//    wrapped in a Hoisted node and evaluated at most once per loop entry. It
+//    is still evaluated lazily, in its original place, so a division by
+//    zero or an undefined variable is reported exactly when it was before.
+//  - A loop that only advances a counter by a constant and adds the counter
+//    (times a constant) or a constant to accumulators gets a ClosedForm, which
+//    the engines use to jump straight to the final values when they can be
+//    computed exactly (see LoopRuntime).
+//
+// Only loops that get one of these have a loop index (While::c), so other
+// loops run exactly as before.
+class LoopOptimizer {
+public:
+    explicit LoopOptimizer(Ast& program) : ast(program) {}
+
+    void run();
+
+    uint64_t hoistedExprs = 0;
+    uint64_t closedFormLoops = 0;
+
+private:
+    Ast& ast;
+    // Per slot, for the loop being optimized
+    std::vector<uint32_t> assignments;
+    std::vector<uint32_t> reads;
+
+    void visitStmt(NodeId id);
+    void optimizeLoop(NodeId id);
+    void countUses(NodeId id);
+    uint32_t loopIndex(NodeId id);
+    bool matchClosedForm(const Node& loop, ClosedForm& form) const;
+    bool matchCounter(const Node& value, uint32_t slot, Value& step) const;
+    bool matchAccumulation(const Node& value, uint32_t slot, uint32_t induction, ClosedForm::Accumulator& acc) const;
+    bool isVariable(NodeId id, uint32_t slot) const;
+    bool numericConstant(NodeId id, Value& out) const;
+    void hoistInStmt(NodeId id, NodeId loop);
+    void hoistInExpr(NodeId id, NodeId loop);
+    bool isInvariant(NodeId id) const;
+    bool isConstant(NodeId id) const;
+    void hoist(NodeId id, NodeId loop);
+};
@@ -0,0 +1,137 @@
+#include "loops.h"
+#include <climits>
+#include <cmath>
+
+namespace {
+
+// Integers up to 2^53 are exact in a double, so sums and products that stay
+// within it come out the same whether done one iteration at a time or at once
+constexpr int64_t kExactLimit = int64_t(1) << 53;
+
+// The integer a number holds, when int and double arithmetic on it are exact
+bool exactInteger(const Value& value, int64_t& out) {
+    if (value.isInt()) {
+        out = value.asInt();
+        return true;
+    }
+    if (value.isDouble()) {
+        double d = value.asDouble();
+        if (!(std::fabs(d) <= static_cast<double>(kExactLimit)) || std::trunc(d) != d) return false;
+        if (d == 0.0 && std::signbit(d)) return false;
+        out = static_cast<int64_t>(d);
+        return true;
+    }
+    return false;
+}
+
+bool fits(__int128 value, bool isInt) {
+    if (isInt) return value >= INT_MIN && value <= INT_MAX;
+    return value >= -kExactLimit && value <= kExactLimit;
+}
+
+Value makeNumber(int64_t value, bool isInt) {
+    if (isInt) return static_cast<int>(value);
+    return static_cast<double>(value);
+}
+
+__int128 magnitude(__int128 value) {
+    return value < 0 ? -value : value;
+}
+
+} // namespace
+
+void LoopRuntime::reset(const Ast& ast) {
+    program = &ast;
+    clock = 0;
+    stamps.assign(ast.loops.size(), 0);
+    attempts.assign(ast.loops.size(), 0);
+    caches.assign(ast.hoistLoops.size(), HoistCache{});
+}
+
+bool LoopRuntime::tryClosedForm(uint32_t loop, std::vector<Value>& slots, const std::vector<uint8_t>& defined) {
+    const LoopInfo& info = program->loops[loop];
+    if (!info.hasClosedForm || attempts[loop] == 0) return false;
+    --attempts[loop];
+    const ClosedForm& form = info.closedForm;
+
+    if (!defined[form.induction]) return false;
+    const Value& counter = slots[form.induction];
+    int64_t start, step;
+    if (!exactInteger(counter, start) || !exactInteger(form.step, step)) return false;
+    // i keeps its type only if int + step stays int
+    bool counterIsInt = counter.isInt();
+    if (counterIsInt && !form.step.isInt()) return false;
+
+    const Node& boundNode = (*program)[form.bound];
+    const Value* bound;
+    if (boundNode.kind == NodeKind::Variable) {
+        if (!defined[boundNode.b]) return false;
+        bound = &slots[boundNode.b];
+    } else {
+        bound = &program->constants[boundNode.a];
+    }
+    if (!bound->isNumber()) return false;
+
+    __int128 limit = counterIsInt ? INT_MAX : kExactLimit;
+    auto counterAt = [&](__int128 iteration) { return start + iteration * step; };
+    auto holds = [&](__int128 iteration) {
+        return isTruthy(applyBinary(form.relation, makeNumber(static_cast<int64_t>(counterAt(iteration)), counterIsInt), *bound));
+    };
+
+    // Trip count: the condition holds for iterations [0, trips) and no longer
+    __int128 trips = 0;
+    if (holds(0)) {
+        bool upwards = form.relation == BinaryOp::Less || form.relation == BinaryOp::LessEqual;
+        if (step == 0 || (step > 0) != upwards) return false; // runs until i overflows, if ever
+        double boundValue = bound->isInt() ? bound->asInt() : bound->asDouble();
+        // Iterations after which i would still be exact in its type
+        __int128 lastExact = upwards ? (limit - start) / step : (start + limit) / -step;
+        double estimate = std::ceil((boundValue - static_cast<double>(start)) / static_cast<double>(step));
+        if (!(estimate <= static_cast<double>(lastExact))) return false;
+        trips = estimate < 1 ? 1 : static_cast<__int128>(estimate);
+        while (trips > 1 && !holds(trips - 1)) --trips;
+        while (holds(trips)) {
+            if (++trips > lastExact) return false;
+        }
+    }
+    if (trips == 0) return true;
+
+    struct Update {
+        uint32_t slot;
+        __int128 value;
+        bool isInt;
+    };
+    std::vector<Update> updates;
+    updates.reserve(form.accumulators.size());
+    for (const ClosedForm::Accumulator& acc : form.accumulators) {
+        if (!defined[acc.slot]) return false;
+        const Value& current = slots[acc.slot];
+        int64_t initial, factor;
+        if (!exactInteger(current, initial) || !exactInteger(acc.factor, factor)) return false;
+        bool accIsInt = current.isInt();
+        bool termIsInt = acc.factor.isInt() && (!acc.scalesInduction || counterIsInt);
+        // An int accumulator turns into a double after its first double term
+        if (accIsInt && !termIsInt) return false;
+
+        __int128 firstTerm = factor, lastTerm = factor, total = factor * trips;
+        if (acc.scalesInduction) {
+            __int128 first = counterAt(acc.afterStep ? 1 : 0);
+            __int128 last = counterAt(acc.afterStep ? trips : trips - 1);
+            firstTerm = first * factor;
+            lastTerm = last * factor;
+            total = (first + last) * trips / 2 * factor;
+        }
+        // Every term and every partial sum has to be exact in its own type
+        __int128 largestTerm = magnitude(firstTerm) > magnitude(lastTerm) ? magnitude(firstTerm) : magnitude(lastTerm);
+        if (!fits(largestTerm, termIsInt)) return false;
+        if (!fits(magnitude(initial) + largestTerm * trips, accIsInt)) return false;
+        updates.push_back({acc.slot, initial + total, accIsInt});
+    }
+
+    slots[form.induction] = makeNumber(static_cast<int64_t>(counterAt(trips)), counterIsInt);
+    for (const Update& update : updates) {
+        slots[update.slot] = makeNumber(static_cast<int64_t>(update.value), update.isInt);
+    }
+    ++finished;
+    return true;
+}
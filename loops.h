@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ast.h"
+#include "value.h"
+#include <cstdint>
+#include <vector>
+
+// Run-time side of the loop optimizer's rewrites, shared by both engines.
+// Every execution of a While that has a loop index gets a fresh stamp; a
+// Hoisted value is only reused while the stamp of its loop is unchanged, so
+// invariants are recomputed each time the loop is entered again.
+class LoopRuntime {
+public:
+    void reset(const Ast& program);
+
+    // Call each time execution reaches a While whose c is a loop index
+    void enter(uint32_t loop) {
+        stamps[loop] = ++clock;
+        attempts[loop] = kClosedFormAttempts;
+    }
+
+    // The value of a Hoisted cache computed since its loop was entered, or nullptr
+    const Value* cached(uint32_t cache) const {
+        const HoistCache& entry = caches[cache];
+        return entry.stamp == stamps[program->hoistLoops[cache]] ? &entry.value : nullptr;
+    }
+    void fill(uint32_t cache, const Value& value) {
+        caches[cache].stamp = stamps[program->hoistLoops[cache]];
+        caches[cache].value = value;
+    }
+
+    // Runs the rest of the loop in one step when it has a closed form and the
+    // current values allow it to be computed exactly; otherwise returns false
+    // and changes nothing, and the engine runs the next iteration itself.
+    bool tryClosedForm(uint32_t loop, std::vector<Value>& slots, const std::vector<uint8_t>& defined);
+
+    uint64_t closedFormRuns() const { return finished; }
+
+private:
+    // The first iterations may still change variable types (an int counter
+    // becomes a double after i = i + 1), so the closed form is retried a
+    // few times before the loop is left to run normally.
+    static constexpr uint8_t kClosedFormAttempts = 3;
+
+    struct HoistCache {
+        uint64_t stamp = 0;
+        Value value;
+    };
+
+    const Ast* program = nullptr;
+    uint64_t clock = 0;
+    uint64_t finished = 0;
+    std::vector<uint64_t> stamps;   // per loop
+    std::vector<uint8_t> attempts;  // per loop
+    std::vector<HoistCache> caches; // per Hoisted cache
+};
@@ -1,48 +1,328 @@
-#include "lexer.h"
-#include "parser.h"
+#include "batch.h"
+#include "frontend.h"
+#include "image.h"
 #include "interpreter.h"
-#include <iostream>
+#include "resolver.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "vm.h"
+#include "source.h"
+#include "output.h"
+#include "profiler.h"
+#include "repl.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <memory>
 #include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Parses and resolves source, or loads it from an image in cacheDir named
+// after its content hash. Writing the cache is best effort: a read-only or
+// full cache directory just means the next run parses again.
+static void loadProgram(const SourceBuffer& source, const char* cacheDir,
+                        Ast& program, std::vector<std::string>& slotNames) {
+    if (isProgramImage(source.view())) {
+        ProgramImage image = readProgramImage(source.view());
+        program = std::move(image.program);
+        slotNames = std::move(image.slotNames);
+        return;
+    }
+
+    uint64_t hash = 0;
+    std::string cachePath;
+    if (cacheDir) {
+        hash = contentHash(source.view());
+        char name[32];
+        std::snprintf(name, sizeof name, "%016llx.happyc", static_cast<unsigned long long>(hash));
+        cachePath = (std::filesystem::path(cacheDir) / name).string();
+        try {
+            SourceBuffer cached = SourceBuffer::fromFile(cachePath);
+            if (programImageSourceHash(cached.view()) == hash) {
+                ProgramImage image = readProgramImage(cached.view());
+                program = std::move(image.program);
+                slotNames = std::move(image.slotNames);
+                return;
+            }
+        }
+        catch (const std::exception&) {
+            // Missing, stale or corrupt: parse and rewrite it
+        }
+    }
+
+    program = parseSource(source.view());
+    Resolver resolver;
+    resolver.resolve(program);
+    slotNames = resolver.slotNames();
+
+    if (cacheDir) {
+        try {
+            std::filesystem::create_directories(cacheDir);
+            writeProgramImage(cachePath, program, slotNames, hash);
+        }
+        catch (const std::exception&) {
+        }
+    }
+}
+
+// "64M" and the like: bytes, or K, M or G of them. Returns false when the
+// text is not a size.
+static bool parseSize(const char* text, size_t& bytes) {
+    char* end;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text) return false;
+    switch (*end) {
+        case 'K': case 'k': value <<= 10; ++end; break;
+        case 'M': case 'm': value <<= 20; ++end; break;
+        case 'G': case 'g': value <<= 30; ++end; break;
+        default: break;
+    }
+    if (*end) return false;
+    bytes = static_cast<size_t>(value);
+    return true;
+}
+
+static void printMemoryStats(const MemoryAccount& memory) {
+    std::cerr << "memory: peak " << memory.peak() << " bytes, " << memory.current() << " bytes at exit\n";
+}
+
+static void printJitStats(const JitStats& stats) {
+    std::cerr << "jit: compiled " << stats.compiledLoops << " loops, "
+              << stats.nativeEntries << " native entries, "
+              << stats.sideExits << " side exits\n";
+}
 
 int main(int argc, char* argv[]) {
-    std::string source;
+    SourceBuffer source = SourceBuffer::fromString(std::string());
+    const char* path = nullptr;
+    bool useVM = true;
+    bool printStats = false;
+    int optLevel = 1;
+    bool useJit = true;
+    FlushPolicy flushPolicy = FdSink::defaultPolicy(STDOUT_FILENO);
+    bool profile = false;
+    const char* foldedPath = nullptr;
+    const char* batchTarget = nullptr;
+    unsigned jobs = 0;
+    const char* compileOutput = nullptr;
+    bool compileOnly = false;
+    bool forceRepl = false;
+    bool stream = false;
+    const char* cacheDir = nullptr;
+    size_t memoryLimit = 0;
 
-    if (argc >= 2) {
-        // Read from file
-        std::ifstream in(argv[1]);
-        if (!in) {
-            std::cerr << "Could not open file: " << argv[1] << "\n";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--engine=vm") == 0) useVM = true;
+        else if (std::strcmp(argv[i], "--engine=tree") == 0) useVM = false;
+        else if (std::strcmp(argv[i], "--stats") == 0) printStats = true;
+        else if (std::strcmp(argv[i], "--jit=on") == 0) useJit = true;
+        else if (std::strcmp(argv[i], "--jit=off") == 0) useJit = false;
+        else if (std::strcmp(argv[i], "--flush=line") == 0) flushPolicy = FlushPolicy::EveryLine;
+        else if (std::strcmp(argv[i], "--flush=full") == 0) flushPolicy = FlushPolicy::WhenFull;
+        else if (std::strcmp(argv[i], "--flush=exit") == 0) flushPolicy = FlushPolicy::AtExit;
+        else if (std::strcmp(argv[i], "--profile") == 0) profile = true;
+        else if (std::strncmp(argv[i], "--profile=", 10) == 0) {
+            profile = true;
+            foldedPath = argv[i] + 10;
+        }
+        else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batchTarget = argv[++i];
+        else if (std::strncmp(argv[i], "--batch=", 8) == 0) batchTarget = argv[i] + 8;
+        else if (std::strncmp(argv[i], "--jobs=", 7) == 0) jobs = static_cast<unsigned>(std::strtoul(argv[i] + 7, nullptr, 10));
+        else if (std::strcmp(argv[i], "--compile") == 0) compileOnly = true;
+        else if (std::strncmp(argv[i], "--compile=", 10) == 0) {
+            compileOnly = true;
+            compileOutput = argv[i] + 10;
+        }
+        else if (std::strncmp(argv[i], "--cache=", 8) == 0) cacheDir = argv[i] + 8;
+        else if (std::strcmp(argv[i], "--repl") == 0) forceRepl = true;
+        else if (std::strcmp(argv[i], "--stream") == 0) stream = true;
+        else if (std::strncmp(argv[i], "--max-memory=", 13) == 0 && parseSize(argv[i] + 13, memoryLimit)) {}
+        else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '2' && !argv[i][3])
+            optLevel = argv[i][2] - '0';
+        else if (argv[i][0] == '-') {
+            std::cerr << "Unknown option: " << argv[i] << "\n";
+            std::cerr << "Usage: happyscript [--engine=vm|tree] [-O0|-O1|-O2] [--jit=on|off] [--flush=line|full|exit] [--stats] [--profile[=folded.txt]] [--cache=DIR] [--max-memory=SIZE] [--repl] [--stream] [file.happy|file.happyc]\n";
+            std::cerr << "       happyscript --compile[=out.happyc] file.happy\n";
+            std::cerr << "       happyscript --batch <dir|list> [--jobs=N] [--engine=vm|tree] [-O0|-O1|-O2] [--jit=on|off] [--max-memory=SIZE]\n";
             return 1;
         }
-        source.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        else path = argv[i];
+    }
+
+    if (batchTarget) {
+        if (path || profile) {
+            std::cerr << "--batch takes no script file and no --profile\n";
+            return 1;
+        }
+        BatchOptions options;
+        options.useVM = useVM;
+        options.optLevel = optLevel;
+        options.useJit = useJit;
+        options.jobs = jobs;
+        options.memoryLimit = memoryLimit;
+        try {
+            return runBatch(batchScripts(batchTarget), options);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    if (compileOnly) {
+        if (!path) {
+            std::cerr << "--compile needs a script file\n";
+            return 1;
+        }
+        std::string output = compileOutput ? compileOutput : std::filesystem::path(path).replace_extension(".happyc").string();
+        try {
+            SourceBuffer script = SourceBuffer::fromFile(path);
+            Ast program;
+            std::vector<std::string> slotNames;
+            loadProgram(script, nullptr, program, slotNames);
+            writeProgramImage(output, program, slotNames, contentHash(script.view()));
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (stream) {
+        // Run each statement as soon as it has arrived; only what has not
+        // run yet is kept
+        int fd = STDIN_FILENO;
+        if (path && (fd = ::open(path, O_RDONLY)) < 0) {
+            std::cerr << "Could not open file: " << path << "\n";
+            return 1;
+        }
+        ReplOptions options;
+        options.optLevel = optLevel;
+        options.useJit = useJit;
+        options.flushPolicy = flushPolicy;
+        options.prompts = false;
+        options.memoryLimit = memoryLimit;
+        int status = Repl(options).stream(fd);
+        if (fd != STDIN_FILENO) ::close(fd);
+        return status;
+    }
+
+    if (path) {
+        // Read from file (memory-mapped when possible)
+        try {
+            source = SourceBuffer::fromFile(path);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    } else if (forceRepl || isatty(STDIN_FILENO)) {
+        // Interactive: run each statement as soon as it is complete
+        bool interactive = isatty(STDIN_FILENO);
+        if (interactive) {
+            std::cout << "HappyScript Interpreter! Each statement runs as soon as it is complete; Ctrl+D (Linux/mac) or Ctrl+Z (Windows) exits.\n" << std::flush;
+        }
+        ReplOptions options;
+        options.optLevel = optLevel;
+        options.useJit = useJit;
+        options.flushPolicy = flushPolicy;
+        options.prompts = interactive;
+        options.memoryLimit = memoryLimit;
+        return Repl(options).run(std::cin, std::cout);
     } else {
         // Read from stdin
-        std::cout << "HappyScript Interpreter! Type your code, finish with Ctrl+D (Linux/mac) or Ctrl+Z (Windows).\n";
+        std::cout << "HappyScript Interpreter! Type your code, finish with Ctrl+D (Linux/mac) or Ctrl+Z (Windows).\n" << std::flush;
+        std::string text;
         std::string line;
         while (std::getline(std::cin, line)) {
-            source += line + "\n";
+            text += line + "\n";
         }
-        if (source.empty()) {
+        if (text.empty()) {
             std::cerr << "No input detected. Exiting.\n";
             return 0;
         }
+        source = SourceBuffer::fromString(std::move(text));
     }
 
+    Ast program;
+    std::vector<std::string> slotNames;
+    std::unique_ptr<Profiler> profiler;
+    int status = 0;
     try {
-        Lexer lexer(source);
-        auto tokens = lexer.tokenize();
+        loadProgram(source, path ? cacheDir : nullptr, program, slotNames);
 
-        Parser parser(tokens);
-        auto program = parser.parseProgram();
+        Optimizer optimizer(optLevel);
+        optimizer.optimize(program);
+        if (printStats) {
+            const OptimizerStats& opt = optimizer.stats();
+            std::cerr << "-O" << optLevel << ": folded " << opt.foldedExprs
+                      << " expressions, pruned " << opt.prunedBranches
+                      << " branches, removed " << opt.removedStores << " dead stores"
+                      << ", hoisted " << opt.hoistedExprs << " invariants, "
+                      << opt.closedFormLoops << " closed-form loops\n";
+        }
+        if (profile) profiler = std::make_unique<Profiler>(program);
 
-        Interpreter interpreter;
-        interpreter.interpret(program);
+        if (useVM) {
+            Compiler compiler;
+            compiler.setProfiling(profile);
+            Chunk chunk = compiler.compile(program, slotNames);
+            VM vm;
+            vm.setOutput(std::make_unique<FdSink>(STDOUT_FILENO, flushPolicy));
+            vm.setJit(useJit && kJitAvailable);
+            vm.setProfiler(profiler.get());
+            vm.memory().setLimit(memoryLimit);
+            MemoryCharge programBytes;
+            programBytes.set(vm.memory(), program.memoryBytes());
+            vm.run(chunk);
+            if (printStats) printJitStats(vm.jitStats());
+            if (printStats) printMemoryStats(vm.memory());
+        } else {
+            // Reference tree-walking engine
+            Interpreter interpreter;
+            interpreter.setOutput(std::make_unique<FdSink>(STDOUT_FILENO, flushPolicy));
+            interpreter.setJit(useJit && kJitAvailable);
+            interpreter.setProfiler(profiler.get());
+            interpreter.memory().setLimit(memoryLimit);
+            MemoryCharge programBytes;
+            programBytes.set(interpreter.memory(), program.memoryBytes());
+            interpreter.interpret(program, slotNames.size());
+            if (printStats) printJitStats(interpreter.jitStats());
+            if (printStats) printMemoryStats(interpreter.memory());
+            if (printStats) {
+                const QuickeningStats& stats = interpreter.quickeningStats();
+                uint64_t total = stats.hits + stats.misses + stats.unquickened;
+                std::cerr << "binary ops: " << total
+                          << ", fast-path hits: " << stats.hits
+                          << ", guard misses: " << stats.misses
+                          << ", unquickened: " << stats.unquickened
+                          << ", specializations: " << stats.specializations
+                          << ", megamorphic sites: " << stats.megamorphicSites << "\n";
+            }
+        }
     }
     catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
-        return 1;
+        status = 1;
     }
 
-    return 0;
+    if (profiler) {
+        // Also after an error: the profile shows how far the program got
+        profiler->finish();
+        profiler->writeReport(std::cerr);
+        if (foldedPath) {
+            std::ofstream folded(foldedPath);
+            if (!folded) {
+                std::cerr << "Could not open file: " << foldedPath << "\n";
+                return 1;
+            }
+            profiler->writeFolded(folded);
+        }
+    }
+    return status;
 }
@@ -0,0 +1,43 @@
+#include "memory_account.h"
+#include <stdexcept>
+#include <string>
+
+std::shared_ptr<MemoryAccount> MemoryAccount::create(size_t limit) {
+    return std::shared_ptr<MemoryAccount>(new MemoryAccount(limit),
+                                          [](MemoryAccount* account) { account->credit(kOwned); });
+}
+
+void MemoryAccount::recharge(size_t& charged, size_t bytes, bool enforce) {
+    if (bytes > charged) charge(bytes - charged, enforce);
+    else credit(charged - bytes);
+    charged = bytes;
+}
+
+void MemoryAccount::exceeded() const {
+    throw std::runtime_error("Memory limit of " + std::to_string(cap) + " bytes exceeded");
+}
+
+void MemoryCharge::set(MemoryAccount& account, size_t bytes, bool enforce) {
+    if (to == &account) {
+        to->recharge(charged, bytes, enforce);
+        return;
+    }
+    account.charge(bytes, enforce);
+    clear();
+    to = &account;
+    charged = bytes;
+}
+
+void MemoryCharge::clear() {
+    if (to) to->credit(charged);
+    to = nullptr;
+    charged = 0;
+}
+
+MemoryScope::MemoryScope(MemoryAccount* account) : previous(MemoryAccount::activeAccount) {
+    MemoryAccount::activeAccount = account;
+}
+
+MemoryScope::~MemoryScope() {
+    MemoryAccount::activeAccount = previous;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bytes one engine holds on behalf of a script: the strings and arrays its
+// Values point at, its variable slots and stack, and (when the host charges
+// them) the Ast it runs. Reports current and peak use; with a limit set,
+// charge() throws std::runtime_error("Memory limit of N bytes exceeded")
+// before the use goes past it, so the script stops with an ordinary error and
+// the host is left as it was.
+//
+// A string or array buffer records the account it was charged to and gives
+// the bytes back when freed, even on another thread or after the engine is
+// gone: the account lives until its owners have let go of it and nothing is
+// charged to it any more. Only allocating and freeing pay for any of this,
+// one atomic add each; reading and copying Values cost what they did before.
+class MemoryAccount {
+public:
+    static std::shared_ptr<MemoryAccount> create(size_t limit = 0);
+
+    // Valid while an owner holds the account
+    size_t current() const { return used.load(std::memory_order_relaxed) - kOwned; }
+    size_t peak() const { return highest.load(std::memory_order_relaxed); }
+    size_t limit() const { return cap; }
+    // 0 for no limit; takes effect at the next charge
+    void setLimit(size_t bytes) { cap = bytes; }
+
+    // Throws when bytes more would go past the limit, charging nothing.
+    // enforce = false charges even past it, for memory already taken that
+    // cannot be refused any more.
+    void charge(size_t bytes, bool enforce = true) {
+        if (cap != 0 && enforce) require(bytes);
+        size_t now = used.fetch_add(bytes, std::memory_order_relaxed) + bytes - kOwned;
+        // Only the thread running the engine charges
+        if (now > highest.load(std::memory_order_relaxed)) highest.store(now, std::memory_order_relaxed);
+    }
+    // May free the account once no owner holds it: the last use of a pointer
+    void credit(size_t bytes) {
+        if (used.fetch_sub(bytes, std::memory_order_acq_rel) == bytes) delete this;
+    }
+    // Throws as charge(bytes) would, without charging; for checking before
+    // an allocation whose size the script chose
+    void require(size_t bytes) const {
+        if (cap != 0 && bytes > cap - std::min(cap, current())) exceeded();
+    }
+    // Moves a charge of charged bytes to bytes, e.g. when a vector grows
+    void recharge(size_t& charged, size_t bytes, bool enforce = true);
+
+    // The account that Values made on this thread are charged to, or
+    // nullptr; set by MemoryScope while an engine runs
+    static MemoryAccount* active() { return activeAccount; }
+
+private:
+    explicit MemoryAccount(size_t limit) : cap(limit) {}
+
+    // Added to used while the owners' shared_ptr lives, so used reaches 0
+    // only once neither the owners nor any buffer need the account
+    static constexpr size_t kOwned = size_t{1} << 62;
+
+    // Defined here rather than in the .cpp so that reading it is a plain
+    // thread-local load in every file
+    static inline thread_local MemoryAccount* activeAccount = nullptr;
+
+    std::atomic<size_t> used{kOwned};
+    std::atomic<size_t> highest{0};
+    size_t cap;
+
+    [[noreturn]] void exceeded() const;
+
+    friend class MemoryScope;
+};
+
+// Makes account the active one on this thread until the end of the scope
+class MemoryScope {
+public:
+    explicit MemoryScope(MemoryAccount* account);
+    ~MemoryScope();
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+private:
+    MemoryAccount* previous;
+};
+
+// A charge for something an account's owner holds, such as an engine's
+// variable slots, given back when it goes
+class MemoryCharge {
+public:
+    MemoryCharge() = default;
+    ~MemoryCharge() { clear(); }
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+    // Charges bytes in place of what was charged before; throws like
+    // MemoryAccount::charge, leaving the old charge in place
+    void set(MemoryAccount& account, size_t bytes, bool enforce = true);
+    void clear();
+
+private:
+    MemoryAccount* to = nullptr;
+    size_t charged = 0;
+};
+
+// MemoryAccount::require on the active account, if any
+inline void requireMemory(size_t bytes) {
+    if (MemoryAccount* account = MemoryAccount::active()) account->require(bytes);
+}
@@ -0,0 +1,224 @@
+#include "optimizer.h"
+#include "loop_optimizer.h"
+#include <stdexcept>
+
+void Optimizer::optimize(Ast& program) {
+    if (level <= 0) return;
+    ast = &program;
+    for (NodeId stmt : program.statements) {
+        foldStmt(stmt);
+    }
+    if (level >= 2 && !keepStores) {
+        // Reads are collected after pruning: a read in a dead branch never runs
+        slotRead.clear();
+        for (NodeId stmt : program.statements) markReads(stmt);
+        for (NodeId stmt : program.statements) removeDeadStores(stmt);
+    }
+    compactStatements();
+    if (level >= 2) {
+        LoopOptimizer loops(program);
+        loops.run();
+        counters.hoistedExprs = loops.hoistedExprs;
+        counters.closedFormLoops = loops.closedFormLoops;
+    }
+}
+
+void Optimizer::foldStmt(NodeId id) {
+    Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            foldExpr(node.a);
+            break;
+        case NodeKind::StoreElement:
+            foldExpr(node.b);
+            foldExpr(node.a);
+            break;
+        case NodeKind::If: {
+            foldExpr(node.a);
+            if (node.b != kNoNode) foldStmt(node.b);
+            if (node.c != kNoNode) foldStmt(node.c);
+            Value cond;
+            if (constantOf(node.a, cond) && cond.isNumber()) {
+                NodeId taken = isTruthy(cond) ? node.b : node.c;
+                if (taken != kNoNode) (*ast)[id] = (*ast)[taken];
+                else makeEmpty(id);
+                ++counters.prunedBranches;
+            }
+            break;
+        }
+        case NodeKind::While: {
+            foldExpr(node.a);
+            foldStmt(node.b);
+            Value cond;
+            if (constantOf(node.a, cond) && cond.isNumber() && !isTruthy(cond)) {
+                makeEmpty(id);
+                ++counters.prunedBranches;
+            }
+            break;
+        }
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                foldStmt(*s);
+            }
+            compactBlock(node);
+            break;
+        default:
+            break;
+    }
+}
+
+void Optimizer::foldExpr(NodeId id) {
+    Node& node = (*ast)[id];
+    // Builtins and array literals are left to run time; their arguments fold
+    if (node.kind == NodeKind::Index) {
+        foldExpr(node.a);
+        foldExpr(node.b);
+        return;
+    }
+    if (node.kind == NodeKind::Call || node.kind == NodeKind::ArrayLiteral) {
+        for (const NodeId* e = ast->begin(node); e != ast->end(node); ++e) {
+            foldExpr(*e);
+        }
+        return;
+    }
+    if (node.kind != NodeKind::Binary) return;
+    foldExpr(node.a);
+    foldExpr(node.b);
+
+    Value left, right;
+    if (!constantOf(node.a, left) || !constantOf(node.b, right)) return;
+    Value result;
+    try {
+        result = applyBinary(node.op, left, right);
+    }
+    catch (const std::runtime_error&) {
+        // Leave it for the engine so the error is raised at the same point
+        return;
+    }
+    Node folded{result.isString() ? NodeKind::String : NodeKind::Number};
+    folded.a = static_cast<uint32_t>(ast->constants.size());
+    ast->constants.push_back(std::move(result));
+    node = folded;
+    ++counters.foldedExprs;
+}
+
+bool Optimizer::constantOf(NodeId id, Value& out) const {
+    const Node& node = (*ast)[id];
+    if (node.kind != NodeKind::Number && node.kind != NodeKind::String) return false;
+    out = ast->constants[node.a];
+    return true;
+}
+
+void Optimizer::makeEmpty(NodeId id) {
+    Node empty{NodeKind::Block};
+    empty.a = 0;
+    empty.b = 0;
+    (*ast)[id] = empty;
+}
+
+bool Optimizer::isEmpty(NodeId id) const {
+    const Node& node = (*ast)[id];
+    return node.kind == NodeKind::Block && node.b == 0;
+}
+
+void Optimizer::compactBlock(Node& block) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < block.b; ++i) {
+        NodeId child = ast->lists[block.a + i];
+        if (!isEmpty(child)) ast->lists[block.a + kept++] = child;
+    }
+    block.b = kept;
+}
+
+void Optimizer::compactStatements() {
+    std::vector<NodeId>& statements = ast->statements;
+    size_t kept = 0;
+    for (NodeId stmt : statements) {
+        if (!isEmpty(stmt)) statements[kept++] = stmt;
+    }
+    statements.resize(kept);
+}
+
+void Optimizer::markReads(NodeId id) {
+    const Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Variable:
+            if (node.b >= slotRead.size()) slotRead.resize(node.b + 1, 0);
+            slotRead[node.b] = 1;
+            break;
+        case NodeKind::Binary:
+        case NodeKind::Index:
+        case NodeKind::While:
+            markReads(node.a);
+            markReads(node.b);
+            break;
+        case NodeKind::StoreElement:
+            // Changes the array in place, so c counts as a read
+            markReads(node.a);
+            markReads(node.b);
+            markReads(node.c);
+            break;
+        case NodeKind::Print:
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            markReads(node.a);
+            break;
+        case NodeKind::If:
+            markReads(node.a);
+            if (node.b != kNoNode) markReads(node.b);
+            if (node.c != kNoNode) markReads(node.c);
+            break;
+        case NodeKind::Call:
+        case NodeKind::ArrayLiteral:
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                markReads(*s);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void Optimizer::removeDeadStores(NodeId id) {
+    Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            if (isDeadStore(node)) {
+                makeEmpty(id);
+                ++counters.removedStores;
+            }
+            break;
+        case NodeKind::If:
+            if (node.b != kNoNode) removeDeadStores(node.b);
+            if (node.c != kNoNode) removeDeadStores(node.c);
+            break;
+        case NodeKind::While:
+            removeDeadStores(node.b);
+            break;
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                removeDeadStores(*s);
+            }
+            compactBlock(node);
+            break;
+        default:
+            break;
+    }
+}
+
+// Only stores of a literal are dropped: anything else might raise an error
+// (undefined variable, division by zero, type mismatch on declaration).
+bool Optimizer::isDeadStore(const Node& node) const {
+    if (node.b < slotRead.size() && slotRead[node.b]) return false;
+    const Node& value = (*ast)[node.a];
+    if (node.kind == NodeKind::Assign) {
+        return value.kind == NodeKind::Number || value.kind == NodeKind::String;
+    }
+    if (node.varType == TokenType::StringType) return value.kind == NodeKind::String;
+    if (node.varType == TokenType::IntType || node.varType == TokenType::FloatType) return value.kind == NodeKind::Number;
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <vector>
+
+struct OptimizerStats {
+    uint64_t foldedExprs = 0;
+    uint64_t prunedBranches = 0;
+    uint64_t removedStores = 0;
+    uint64_t hoistedExprs = 0;
+    uint64_t closedFormLoops = 0;
+};
+
+// Rewrites a resolved Ast in place. Every rewrite keeps the observable
+// behaviour, including which error is raised and when: an expression that
+// would throw (division by zero, string + number, ...) is never folded away.
+//
+//   -O0  nothing
+//   -O1  constant folding, 'ana'/'fun' with a constant condition
+//   -O2  also drops stores to variables that are never read, hoists
+//        loop-invariant expressions and finds closed forms for counting
+//        loops (see loop_optimizer.h)
+//
+// Dead-store elimination assumes the Ast is the whole program, i.e. nobody
+// reads variables after it finishes; hosts that do call setKeepStores(true).
+class Optimizer {
+public:
+    explicit Optimizer(int level) : level(level) {}
+
+    void optimize(Ast& program);
+    void setKeepStores(bool keep) { keepStores = keep; }
+    const OptimizerStats& stats() const { return counters; }
+
+private:
+    int level;
+    bool keepStores = false;
+    Ast* ast = nullptr;
+    OptimizerStats counters;
+    std::vector<uint8_t> slotRead;
+
+    void foldStmt(NodeId id);
+    void foldExpr(NodeId id);
+    bool constantOf(NodeId id, Value& out) const;
+    void makeEmpty(NodeId id);
+    bool isEmpty(NodeId id) const;
+    void compactBlock(Node& block);
+    void compactStatements();
+    void markReads(NodeId id);
+    void removeDeadStores(NodeId id);
+    bool isDeadStore(const Node& node) const;
+};
@@ -0,0 +1,157 @@
+#include "output.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+// Longest %g rendering of a double is "-1.23457e-308"; ints need 11
+constexpr size_t kMaxNumberLength = 32;
+
+namespace {
+
+char* formatNumber(char* out, int value) {
+    return std::to_chars(out, out + kMaxNumberLength, value).ptr;
+}
+
+// std::ostream's default for doubles: %g with precision 6
+char* formatNumber(char* out, double value) {
+    return std::to_chars(out, out + kMaxNumberLength, value, std::chars_format::general, 6).ptr;
+}
+
+} // namespace
+
+OutputSink::OutputSink(FlushPolicy policy, size_t capacity)
+    : policy(policy), capacity(capacity), buffer(capacity) {}
+
+char* OutputSink::reserve(size_t size) {
+    if (used + size > buffer.size()) {
+        size_t grown = buffer.size();
+        if (policy == FlushPolicy::AtExit) grown = std::max(buffer.size() * 2, used + size);
+        else flush();
+        grown = std::max(grown, size);
+        if (grown > buffer.size()) {
+            if (account && printing) account->require(grown - buffer.capacity());
+            buffer.resize(grown);
+            recharge();
+        }
+    }
+    return buffer.data() + used;
+}
+
+void OutputSink::chargeTo(MemoryAccount& to) {
+    account = &to;
+    recharge();
+}
+
+void OutputSink::recharge() {
+    // Outside print() the memory is already taken, so it is charged anyway
+    if (account) held.set(*account, buffer.capacity() + keptBytes, printing);
+}
+
+void OutputSink::keep(std::string& kept, const char* data, size_t size) {
+    size_t needed = kept.size() + size;
+    // std::string doubles its capacity, or grows to fit
+    if (account && printing && needed > kept.capacity())
+        account->require(std::max(needed, 2 * kept.capacity()) - kept.capacity());
+    kept.append(data, size);
+    if (kept.capacity() != keptBytes) {
+        keptBytes = kept.capacity();
+        recharge();
+    }
+}
+
+void OutputSink::released(const std::string& kept) {
+    keptBytes = kept.capacity();
+    recharge();
+}
+
+template <typename T>
+void OutputSink::printElements(const std::vector<T>& elements) {
+    *reserve(1) = '[';
+    ++used;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        char* out = reserve(kMaxNumberLength + 2);
+        char* end = out;
+        if (i > 0) {
+            *end++ = ',';
+            *end++ = ' ';
+        }
+        end = formatNumber(end, elements[i]);
+        used += end - out;
+    }
+    char* out = reserve(2);
+    out[0] = ']';
+    out[1] = '\n';
+    used += 2;
+}
+
+void OutputSink::print(const Value& value) {
+    printing = true;
+    try {
+        printValue(value);
+    }
+    catch (...) {
+        printing = false;
+        throw;
+    }
+    printing = false;
+}
+
+void OutputSink::printValue(const Value& value) {
+    if (value.isString()) {
+        const std::string* pStr = &value.str();
+        if (policy != FlushPolicy::AtExit && pStr->size() >= capacity) {
+            // Too big to be worth copying through the buffer
+            flush();
+            write(pStr->data(), pStr->size());
+            *reserve(1) = '\n';
+            ++used;
+        } else {
+            char* out = reserve(pStr->size() + 1);
+            std::memcpy(out, pStr->data(), pStr->size());
+            out[pStr->size()] = '\n';
+            used += pStr->size() + 1;
+        }
+    } else if (value.isIntArray()) {
+        printElements(value.ints());
+    } else if (value.isFloatArray()) {
+        printElements(value.floats());
+    } else {
+        char* out = reserve(kMaxNumberLength);
+        char* end = value.isInt() ? formatNumber(out, value.asInt()) : formatNumber(out, value.asDouble());
+        *end++ = '\n';
+        used += end - out;
+    }
+    if (policy == FlushPolicy::EveryLine) flush();
+}
+
+void OutputSink::flush() {
+    if (used == 0) return;
+    size_t size = used;
+    used = 0;
+    write(buffer.data(), size);
+}
+
+FdSink::FdSink(int fd, FlushPolicy policy) : OutputSink(policy), fd(fd) {}
+
+FdSink::~FdSink() {
+    flush();
+}
+
+FlushPolicy FdSink::defaultPolicy(int fd) {
+    return isatty(fd) ? FlushPolicy::EveryLine : FlushPolicy::WhenFull;
+}
+
+void FdSink::write(const char* data, size_t size) {
+    while (size > 0 && !failed) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            failed = true;
+            break;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "memory_account.h"
+#include "value.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class FlushPolicy {
+    EveryLine, // like std::endl; the default for terminals
+    WhenFull,  // write out the buffer once it fills up
+    AtExit,    // keep everything until flush() or destruction
+};
+
+// Where 'smile' output goes. Lines are formatted straight into a buffer with
+// std::to_chars, producing the same bytes as 'std::cout << value << std::endl'
+// (ints in decimal, doubles like printf's %g), and handed to write() in
+// large chunks according to the flush policy.
+class OutputSink {
+public:
+    explicit OutputSink(FlushPolicy policy, size_t capacity = kDefaultCapacity);
+    virtual ~OutputSink() = default;
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // Appends the value and a newline
+    void print(const Value& value);
+    void flush();
+
+    // Charges the buffer, and whatever a sink keeps of its output, to the
+    // account of the engine printing; the engines do this in setOutput().
+    // print() then throws "Memory limit of N bytes exceeded" instead of
+    // keeping more than the limit allows. A flush() outside print() never
+    // throws, so it may keep one buffer more.
+    void chargeTo(MemoryAccount& account);
+
+    static constexpr size_t kDefaultCapacity = 64 * 1024;
+
+protected:
+    // Subclasses must call flush() in their destructor
+    virtual void write(const char* data, size_t size) = 0;
+    // For a write() that keeps its output: appends to kept, charging its
+    // growth (see chargeTo)
+    void keep(std::string& kept, const char* data, size_t size);
+    // After what keep() appended to has been given away
+    void released(const std::string& kept);
+
+private:
+    FlushPolicy policy;
+    size_t capacity;
+    std::vector<char> buffer;
+    size_t used = 0;
+    MemoryAccount* account = nullptr;
+    MemoryCharge held;     // buffer and kept
+    size_t keptBytes = 0;  // capacity of what keep() appends to
+    bool printing = false; // growth past the limit throws
+
+    void printValue(const Value& value);
+    char* reserve(size_t size);
+    void recharge();
+    // "[1, 2, 3]" and a newline, reserving an element at a time so a long
+    // array does not need a buffer of its own size
+    template <typename T>
+    void printElements(const std::vector<T>& elements);
+};
+
+// Writes to a file descriptor, stdout by default. Write errors are dropped,
+// as they were with std::cout.
+class FdSink : public OutputSink {
+public:
+    explicit FdSink(int fd, FlushPolicy policy);
+    // EveryLine on a terminal, WhenFull otherwise
+    static FlushPolicy defaultPolicy(int fd);
+    ~FdSink() override;
+
+protected:
+    void write(const char* data, size_t size) override;
+
+private:
+    int fd;
+    bool failed = false;
+};
+
+// Collects output in memory, for embedding
+class StringSink : public OutputSink {
+public:
+    // Output moves from the buffer of capacity bytes into the string
+    // whenever the buffer fills up
+    explicit StringSink(size_t capacity = kDefaultCapacity) : OutputSink(FlushPolicy::WhenFull, capacity) {}
+    ~StringSink() override { flush(); }
+
+    // Everything printed so far
+    const std::string& str() {
+        flush();
+        return contents;
+    }
+    // The same, moved out; the sink starts over empty
+    std::string take() {
+        flush();
+        std::string taken = std::move(contents);
+        contents.clear();
+        released(contents);
+        return taken;
+    }
+
+protected:
+    void write(const char* data, size_t size) override { keep(contents, data, size); }
+
+private:
+    std::string contents;
+};
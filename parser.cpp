@@ -1,11 +1,13 @@
 #include "parser.h"
+#include "arrays.h"
 #include "ast.h" // <-- Make sure this is included
+#include <charconv>
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 
 const Token& Parser::currentToken() const {
     if (pos < tokens.size()) return tokens[pos];
-    static Token eofToken{TokenType::End, ""};
     return eofToken;
 }
 
@@ -13,10 +15,61 @@ void Parser::consume(TokenType expected) {
     if (currentToken().type == expected) {
         pos++;
     } else {
-        throw std::runtime_error("Unexpected token: " + currentToken().text);
+        throw std::runtime_error("Unexpected token: " + std::string(currentToken().text));
     }
 }
 
+uint32_t Parser::addConstant(Value value) {
+    ast.constants.push_back(std::move(value));
+    return static_cast<uint32_t>(ast.constants.size() - 1);
+}
+
+// Generated scripts repeat the same literals over and over; share one entry
+uint32_t Parser::numberConstant(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    auto it = numberIds.find(bits);
+    if (it != numberIds.end()) return it->second;
+    uint32_t id = addConstant(value);
+    numberIds.emplace(bits, id);
+    return id;
+}
+
+uint32_t Parser::stringConstant(std::string_view text) {
+    auto it = stringIds.find(text);
+    if (it != stringIds.end()) return it->second;
+    uint32_t id = addConstant(std::string(text));
+    stringIds.emplace(text, id);
+    return id;
+}
+
+NodeId Parser::binary(NodeId left, TokenType op, NodeId right) {
+    Node node{NodeKind::Binary};
+    switch (op) {
+        case TokenType::Plus: node.op = BinaryOp::Add; break;
+        case TokenType::Minus: node.op = BinaryOp::Sub; break;
+        case TokenType::Star: node.op = BinaryOp::Mul; break;
+        case TokenType::Slash: node.op = BinaryOp::Div; break;
+        case TokenType::Percent: node.op = BinaryOp::Mod; break;
+        case TokenType::DoubleEqual: node.op = BinaryOp::Equal; break;
+        case TokenType::BangEqual: node.op = BinaryOp::NotEqual; break;
+        case TokenType::Less: node.op = BinaryOp::Less; break;
+        case TokenType::LessEqual: node.op = BinaryOp::LessEqual; break;
+        case TokenType::Greater: node.op = BinaryOp::Greater; break;
+        case TokenType::GreaterEqual: node.op = BinaryOp::GreaterEqual; break;
+        default: throw std::runtime_error("Unknown operator: " + std::string(currentToken().text));
+    }
+    node.a = left;
+    node.b = right;
+    return ast.add(node);
+}
+
+NodeId Parser::statement(const Node& node, SourcePos at) {
+    NodeId id = ast.add(node);
+    ast.statementPositions.emplace_back(id, at);
+    return id;
+}
+
 // program := (statement)* EOF
 // statement := printStmt | assignStmt
 /*std::vector<std::unique_ptr<Stmt>> Parser::parseProgram() {
@@ -34,13 +87,20 @@ void Parser::consume(TokenType expected) {
 
     return statements;
 }*/
-std::vector<std::unique_ptr<Stmt>> Parser::parseProgram() {
-    std::vector<std::unique_ptr<Stmt>> statements;
+Ast Parser::parseProgram() {
+    // Every node consumes at least one token, so this never reallocates
+    ast.nodes.reserve(tokens.size());
+    // Name ids are the Lexer's symbol ids; copy each spelling once so the
+    // Ast does not depend on the source buffer
+    ast.names.assign(symbols.names().begin(), symbols.names().end());
+    std::vector<NodeId>& statements = ast.statements;
     while (currentToken().type != TokenType::End) {
         if (currentToken().type == TokenType::IntType || currentToken().type == TokenType::FloatType || currentToken().type== TokenType::StringType) {
             statements.push_back(parseDeclaration());
         } else if (currentToken().type == TokenType::Identifier && tokens[pos + 1].type == TokenType::Equal) {
             statements.push_back(parseAssignStmt());
+        } else if (currentToken().type == TokenType::Identifier && tokens[pos + 1].type == TokenType::LBracket) {
+            statements.push_back(parseStoreElement());
         } else if (currentToken().type == TokenType::Print) {
             statements.push_back(parsePrintStmt());
         }
@@ -50,48 +110,86 @@ std::vector<std::unique_ptr<Stmt>> Parser::parseProgram() {
         else if (currentToken().type == TokenType::WhileType) {
             statements.push_back(parseWhileStmt());
         } else {
-            throw std::runtime_error("Unexpected token: " + currentToken().text);
+            throw std::runtime_error("Unexpected token: " + std::string(currentToken().text));
         }
     }
-    return statements;
+    return std::move(ast);
 }
-std::unique_ptr<Stmt> Parser::parseDeclaration() {
+NodeId Parser::parseDeclaration() {
     auto typeToken = currentToken();
+    SourcePos at = typeToken.at;
     if (typeToken.type != TokenType::IntType &&
         typeToken.type != TokenType::FloatType &&
         typeToken.type != TokenType::StringType) {
         throw std::runtime_error("Expected type declaration");
     }
     consume(typeToken.type); // consume int, float, or string
+    TokenType varType = typeToken.type;
+    if (varType != TokenType::StringType && currentToken().type == TokenType::LBracket) {
+        consume(TokenType::LBracket);
+        consume(TokenType::RBracket);
+        varType = varType == TokenType::IntType ? TokenType::IntArrayType : TokenType::FloatArrayType;
+    }
     
-    std::string name = currentToken().text;
+    uint32_t name = currentToken().symbol;
     consume(TokenType::Identifier);
 
     consume(TokenType::Equal);
     auto expr = parseExpression();
     consume(TokenType::Semicolon);
 
-    return std::make_unique<DeclStmt>(typeToken.type, name, std::move(expr));
+    Node node{NodeKind::Decl};
+    node.varType = varType;
+    node.a = expr;
+    node.c = name;
+    return statement(node, at);
 }
 
 // printStmt := 'print' '(' expression ')' ';'
-std::unique_ptr<PrintStmt> Parser::parsePrintStmt() {
+NodeId Parser::parsePrintStmt() {
+    SourcePos at = currentToken().at;
     consume(TokenType::Print);
     consume(TokenType::LParen);
     auto expr = parseExpression();
     consume(TokenType::RParen);
     consume(TokenType::Semicolon);
-    return std::make_unique<PrintStmt>(std::move(expr));
+    Node node{NodeKind::Print};
+    node.a = expr;
+    return statement(node, at);
 }
 
 // assignStmt := identifier '=' expression ';'
-std::unique_ptr<AssignStmt> Parser::parseAssignStmt() {
-    std::string name = currentToken().text;
+NodeId Parser::parseAssignStmt() {
+    SourcePos at = currentToken().at;
+    uint32_t name = currentToken().symbol;
     consume(TokenType::Identifier);
     consume(TokenType::Equal);
     auto expr = parseExpression();
     consume(TokenType::Semicolon);
-    return std::make_unique<AssignStmt>(name, std::move(expr));
+    Node node{NodeKind::Assign};
+    node.a = expr;
+    node.c = name;
+    return statement(node, at);
+}
+
+// storeElement := identifier '[' expression ']' '=' expression ';'
+NodeId Parser::parseStoreElement() {
+    SourcePos at = currentToken().at;
+    Node target{NodeKind::Variable};
+    target.a = currentToken().symbol;
+    consume(TokenType::Identifier);
+    NodeId array = ast.add(target);
+    consume(TokenType::LBracket);
+    auto index = parseExpression();
+    consume(TokenType::RBracket);
+    consume(TokenType::Equal);
+    auto expr = parseExpression();
+    consume(TokenType::Semicolon);
+    Node node{NodeKind::StoreElement};
+    node.a = expr;
+    node.b = index;
+    node.c = array;
+    return statement(node, at);
 }
 
 
@@ -108,43 +206,43 @@ std::unique_ptr<AssignStmt> Parser::parseAssignStmt() {
 
     return left;
 }*/
-std::unique_ptr<Expr> Parser::parseExpression() {
+NodeId Parser::parseExpression() {
     return parseEquality();
 }
 
-std::unique_ptr<Expr> Parser::parseComparison() {
+NodeId Parser::parseComparison() {
     auto left = parseAddition();
     while (currentToken().type == TokenType::Less ||
            currentToken().type == TokenType::LessEqual ||
            currentToken().type == TokenType::Greater ||
            currentToken().type == TokenType::GreaterEqual) {
-        std::string opSymbol = currentToken().text;
-        consume(currentToken().type);
+        TokenType opType = currentToken().type;
+        consume(opType);
         auto right = parseAddition();
-        left = std::make_unique<BinaryExpr>(std::move(left), opSymbol, std::move(right));
+        left = binary(left, opType, right);
     }
     return left;
 }
 
-std::unique_ptr<Expr> Parser::parseEquality() {
+NodeId Parser::parseEquality() {
     auto left = parseComparison();
     while (currentToken().type == TokenType::DoubleEqual || currentToken().type == TokenType::BangEqual) {
-        std::string opSymbol = currentToken().text;
-        consume(currentToken().type);
+        TokenType opType = currentToken().type;
+        consume(opType);
         auto right = parseComparison();
-        left = std::make_unique<BinaryExpr>(std::move(left), opSymbol, std::move(right));
+        left = binary(left, opType, right);
     }
     return left;
 }
 
-std::unique_ptr<Expr> Parser::parseAddition() {
+NodeId Parser::parseAddition() {
     auto left = parseTerm();
 
     while (currentToken().type == TokenType::Plus || currentToken().type == TokenType::Minus) {
-        std::string opSymbol = currentToken().text;
-        consume(currentToken().type);
+        TokenType opType = currentToken().type;
+        consume(opType);
         auto right = parseTerm();
-        left = std::make_unique<BinaryExpr>(std::move(left), opSymbol, std::move(right));
+        left = binary(left, opType, right);
     }
 
     return left;
@@ -152,37 +250,66 @@ std::unique_ptr<Expr> Parser::parseAddition() {
 
 
 // term := factor (('*' | '/') factor)*
-std::unique_ptr<Expr> Parser::parseTerm() {
+NodeId Parser::parseTerm() {
     auto left = parseFactor();
 
     while (currentToken().type == TokenType::Star || currentToken().type == TokenType::Slash || currentToken().type == TokenType::Percent) {
-        std::string op = currentToken().text;
-        consume(currentToken().type);
+        TokenType opType = currentToken().type;
+        consume(opType);
         auto right = parseFactor();
-        left = std::make_unique<BinaryExpr>(std::move(left), op, std::move(right));
+        left = binary(left, opType, right);
     }
 
     return left;
 }
 
-// factor := NUMBER | identifier | '(' expression ')'
-std::unique_ptr<Expr> Parser::parseFactor() {
+// factor := primary ('[' expression ']')*
+NodeId Parser::parseFactor() {
+    NodeId expr = parsePrimary();
+    while (currentToken().type == TokenType::LBracket) {
+        consume(TokenType::LBracket);
+        auto index = parseExpression();
+        consume(TokenType::RBracket);
+        Node node{NodeKind::Index};
+        node.a = expr;
+        node.b = index;
+        expr = ast.add(node);
+    }
+    return expr;
+}
+
+// primary := NUMBER | identifier | call | arrayLiteral | '(' expression ')'
+NodeId Parser::parsePrimary() {
     if (currentToken().type == TokenType::Number) {
-        const std::string& txt = currentToken().text;
-        if (txt.find('.') != std::string::npos) {
-            double val = std::stod(txt);
-            consume(TokenType::Number);
-            return std::make_unique<NumberExpr>(val);
+        // Number literals are always doubles at run time, even without a '.'
+        std::string_view txt = currentToken().text;
+        double val;
+        if (txt.find('.') != std::string_view::npos) {
+            auto [end, ec] = std::from_chars(txt.data(), txt.data() + txt.size(), val);
+            if (ec == std::errc::result_out_of_range) throw std::out_of_range("stod");
         } else {
-            int val = std::stoi(txt);
-            consume(TokenType::Number);
-            return std::make_unique<NumberExpr>(val);
+            int intVal = 0;
+            auto [end, ec] = std::from_chars(txt.data(), txt.data() + txt.size(), intVal);
+            if (ec == std::errc::result_out_of_range) throw std::out_of_range("stoi");
+            val = intVal;
         }
+        consume(TokenType::Number);
+        Node node{NodeKind::Number};
+        node.a = numberConstant(val);
+        return ast.add(node);
+    }
+    else if (currentToken().type == TokenType::Identifier && tokens[pos + 1].type == TokenType::LParen) {
+        return parseCall();
+    }
+    else if (currentToken().type == TokenType::LBracket) {
+        return parseArrayLiteral();
     }
     else if (currentToken().type == TokenType::Identifier) {
-        std::string name = currentToken().text;
+        uint32_t name = currentToken().symbol;
         consume(TokenType::Identifier);
-        return std::make_unique<VariableExpr>(name);
+        Node node{NodeKind::Variable};
+        node.a = name;
+        return ast.add(node);
     }
     else if (currentToken().type == TokenType::LParen) {
         consume(TokenType::LParen);
@@ -191,17 +318,73 @@ std::unique_ptr<Expr> Parser::parseFactor() {
         return expr;
     }
     else if (currentToken().type == TokenType::StringLiteral) {
-        std::string val = currentToken().text;
+        std::string_view val = currentToken().text;
         consume(TokenType::StringLiteral);
-        return std::make_unique<StringExpr>(val);
+        Node node{NodeKind::String};
+        node.a = stringConstant(val);
+        return ast.add(node);
     }
     else {
-        throw std::runtime_error("Unexpected token in factor: '" + currentToken().text +
+        throw std::runtime_error("Unexpected token in factor: '" + std::string(currentToken().text) +
             "' (type = " + std::to_string(static_cast<int>(currentToken().type)) + ")");
     }
 }
 
-std::unique_ptr<IfStmt> Parser::parseIfStmt() {
+// call := identifier '(' (expression (',' expression)*)? ')'
+NodeId Parser::parseCall() {
+    std::string_view name = currentToken().text;
+    Builtin builtin;
+    if (!builtinNamed(name, builtin)) throw std::runtime_error("Unknown function: " + std::string(name));
+    consume(TokenType::Identifier);
+    consume(TokenType::LParen);
+    size_t first = blockScratch.size();
+    if (currentToken().type != TokenType::RParen) {
+        blockScratch.push_back(parseExpression());
+        while (currentToken().type == TokenType::Comma) {
+            consume(TokenType::Comma);
+            blockScratch.push_back(parseExpression());
+        }
+    }
+    consume(TokenType::RParen);
+    uint8_t arity = builtinInfo(builtin).arity;
+    if (blockScratch.size() - first != arity) {
+        throw std::runtime_error(std::string(name) + " takes " + std::to_string(arity) +
+                                 (arity == 1 ? " argument" : " arguments"));
+    }
+    Node node{NodeKind::Call};
+    node.c = static_cast<uint32_t>(builtin);
+    listFrom(first, node);
+    return ast.add(node);
+}
+
+// arrayLiteral := '[' (expression (',' expression)*)? ']'
+NodeId Parser::parseArrayLiteral() {
+    consume(TokenType::LBracket);
+    size_t first = blockScratch.size();
+    if (currentToken().type != TokenType::RBracket) {
+        blockScratch.push_back(parseExpression());
+        while (currentToken().type == TokenType::Comma) {
+            consume(TokenType::Comma);
+            blockScratch.push_back(parseExpression());
+        }
+    }
+    consume(TokenType::RBracket);
+    Node node{NodeKind::ArrayLiteral};
+    listFrom(first, node);
+    return ast.add(node);
+}
+
+// Moves the nodes pushed onto blockScratch since first into ast.lists as
+// node's children
+void Parser::listFrom(size_t first, Node& node) {
+    node.a = static_cast<uint32_t>(ast.lists.size());
+    node.b = static_cast<uint32_t>(blockScratch.size() - first);
+    ast.lists.insert(ast.lists.end(), blockScratch.begin() + first, blockScratch.end());
+    blockScratch.resize(first);
+}
+
+NodeId Parser::parseIfStmt() {
+    SourcePos at = currentToken().at;
     consume(TokenType::IfType);
     consume(TokenType::LParen);
     
@@ -211,22 +394,23 @@ std::unique_ptr<IfStmt> Parser::parseIfStmt() {
     auto thenBranch = parseStatement();
 
     // Optional 'else' branch
-    std::unique_ptr<Stmt> elseBranch = nullptr;
+    NodeId elseBranch = kNoNode;
     if (currentToken().type == TokenType::ElseType) {
         consume(TokenType::ElseType);
         elseBranch = parseStatement();
     }
 
-    return std::make_unique<IfStmt>(
-        std::move(condition),
-        std::move(thenBranch),
-        std::move(elseBranch)
-    );
+    Node node{NodeKind::If};
+    node.a = condition;
+    node.b = thenBranch;
+    node.c = elseBranch;
+    return statement(node, at);
 
 
 
 }
-std::unique_ptr<WhileStmt> Parser::parseWhileStmt() {
+NodeId Parser::parseWhileStmt() {
+    SourcePos at = currentToken().at;
     consume(TokenType::WhileType);
     consume(TokenType::LParen);
     
@@ -234,10 +418,13 @@ std::unique_ptr<WhileStmt> Parser::parseWhileStmt() {
     consume(TokenType::RParen);
     auto body = parseStatement();
 
-    return std::make_unique<WhileStmt>(std::move(condition), std::move(body));
+    Node node{NodeKind::While};
+    node.a = condition;
+    node.b = body;
+    return statement(node, at);
 }
 
-std::unique_ptr<Stmt> Parser::parseStatement() {
+NodeId Parser::parseStatement() {
     if (currentToken().type == TokenType::Print) {
         return parsePrintStmt();
     }
@@ -259,17 +446,27 @@ std::unique_ptr<Stmt> Parser::parseStatement() {
              (pos + 1 < tokens.size()) && tokens[pos + 1].type == TokenType::Equal) { // <-- Fix here
         return parseAssignStmt();
     }
+    else if (currentToken().type == TokenType::Identifier &&
+             (pos + 1 < tokens.size()) && tokens[pos + 1].type == TokenType::LBracket) {
+        return parseStoreElement();
+    }
     else {
-        throw std::runtime_error("Unexpected token in statement: " + currentToken().text);
+        throw std::runtime_error("Unexpected token in statement: " + std::string(currentToken().text));
     }
 }
-std::unique_ptr<Stmt> Parser::parseBlockStmt() {
+NodeId Parser::parseBlockStmt() {
+    SourcePos at = currentToken().at;
     consume(TokenType::LBrace);
-    std::vector<std::unique_ptr<Stmt>> stmts;
+    // Nested blocks push and pop above our own entries, so our children end
+    // up contiguous in blockScratch and are copied into ast.lists in one go
+    size_t first = blockScratch.size();
     while (currentToken().type != TokenType::RBrace && currentToken().type != TokenType::End) {
-        stmts.push_back(parseStatement());
+        NodeId stmt = parseStatement();
+        blockScratch.push_back(stmt);
     }
     consume(TokenType::RBrace);
-    return std::make_unique<BlockStmt>(std::move(stmts));
+    Node node{NodeKind::Block};
+    listFrom(first, node);
+    return statement(node, at);
 }
 
@@ -1,37 +1,56 @@
 #pragma once
 #include "lexer.h"
 #include "ast.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
-#include <memory>
 
 class Parser {
 public:
-    explicit Parser(const std::vector<Token>& tokens) : tokens(tokens) {}
+    Parser(const std::vector<Token>& tokens, const Interner& symbols)
+        : tokens(tokens), symbols(symbols) {}
 
-    // Parse a full program (list of statements)
-    std::vector<std::unique_ptr<Stmt>> parseProgram();
+    // Parse a full program (list of statements) into a fresh Ast
+    Ast parseProgram();
 
 private:
     const std::vector<Token>& tokens;
+    const Interner& symbols;
     size_t pos = 0;
+    const Token eofToken{TokenType::End, std::string_view()};
+    Ast ast;
+    std::unordered_map<uint64_t, uint32_t> numberIds;
+    std::unordered_map<std::string_view, uint32_t> stringIds; // keys point into the source
+    std::vector<NodeId> blockScratch; // children of the blocks, calls and array literals being parsed
 
     const Token& currentToken() const;
     void consume(TokenType expected);
+    uint32_t addConstant(Value value);
+    uint32_t numberConstant(double value);
+    uint32_t stringConstant(std::string_view text);
+    NodeId binary(NodeId left, TokenType op, NodeId right);
+    NodeId statement(const Node& node, SourcePos at);
 
-    std::unique_ptr<PrintStmt> parsePrintStmt();
-    std::unique_ptr<Expr> parseExpression();
-    std::unique_ptr<AssignStmt> parseAssignStmt();
-    std::unique_ptr<Expr> parseTerm();
-    std::unique_ptr<Expr> parseFactor();
-    std::unique_ptr<Stmt> parseDeclaration();
-    std::unique_ptr<IfStmt> parseIfStmt();
-    std::unique_ptr<Stmt> parseStatement();
-    std::unique_ptr<Expr> parseEquality();
-    std::unique_ptr<Expr> parseAddition();
-    std::unique_ptr<WhileStmt> parseWhileStmt();
-    std::unique_ptr<Stmt> parseBlockStmt();
-    std::unique_ptr<Expr> parseComparison();
+    NodeId parsePrintStmt();
+    NodeId parseExpression();
+    NodeId parseAssignStmt();
+    NodeId parseTerm();
+    NodeId parseFactor();
+    NodeId parsePrimary();
+    NodeId parseDeclaration();
+    NodeId parseIfStmt();
+    NodeId parseStatement();
+    NodeId parseEquality();
+    NodeId parseAddition();
+    NodeId parseWhileStmt();
+    NodeId parseBlockStmt();
+    NodeId parseComparison();
+    NodeId parseStoreElement();
+    NodeId parseCall();
+    NodeId parseArrayLiteral();
+    void listFrom(size_t first, Node& node);
     
     
     
-};
+};
\ No newline at end of file
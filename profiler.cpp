@@ -0,0 +1,102 @@
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+Profiler::Profiler(const Ast& program) : ast(program), stats(program.nodes.size()) {
+    stacks.push_back({0, kNoNode});
+}
+
+uint64_t Profiler::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::enter(NodeId stmt) {
+    uint32_t parent = frames.empty() ? 0 : frames.back().stack;
+    auto [it, added] = children.try_emplace(uint64_t(parent) << 32 | stmt, static_cast<uint32_t>(stacks.size()));
+    if (added) stacks.push_back({parent, stmt});
+    ++stats[stmt].hits;
+    frames.push_back({it->second, now()});
+}
+
+void Profiler::exit() {
+    if (frames.empty()) return;
+    Frame frame = frames.back();
+    frames.pop_back();
+    uint64_t elapsed = now() - frame.start;
+    uint64_t self = elapsed > frame.childNs ? elapsed - frame.childNs : 0;
+    Stack& stack = stacks[frame.stack];
+    stack.selfNs += self;
+    stats[stack.stmt].inclusiveNs += elapsed;
+    stats[stack.stmt].exclusiveNs += self;
+    if (!frames.empty()) frames.back().childNs += elapsed;
+}
+
+void Profiler::finish() {
+    while (!frames.empty()) exit();
+}
+
+std::string Profiler::label(NodeId stmt) const {
+    const Node& node = ast[stmt];
+    switch (node.kind) {
+        case NodeKind::Print: return "smile";
+        case NodeKind::Assign: return ast.nameOf(node) + " =";
+        case NodeKind::Decl: return std::string(declaredTypeName(node.varType)) + " " + ast.nameOf(node);
+        case NodeKind::StoreElement: return ast.nameOf(ast[node.c]) + "[] =";
+        case NodeKind::If: return "ana";
+        case NodeKind::While: return "fun";
+        default: return "{ }";
+    }
+}
+
+void Profiler::writeReport(std::ostream& out, size_t limit) const {
+    std::vector<NodeId> hot;
+    uint64_t totalNs = 0;
+    uint64_t totalHits = 0;
+    for (NodeId id = 0; id < stats.size(); ++id) {
+        if (!stats[id].hits) continue;
+        hot.push_back(id);
+        totalNs += stats[id].exclusiveNs;
+        totalHits += stats[id].hits;
+    }
+    std::sort(hot.begin(), hot.end(), [this](NodeId a, NodeId b) {
+        return stats[a].exclusiveNs != stats[b].exclusiveNs ? stats[a].exclusiveNs > stats[b].exclusiveNs : a < b;
+    });
+
+    char line[160];
+    std::snprintf(line, sizeof line, "profile: %.3f ms in %zu statements, %llu executed\n",
+                  totalNs / 1e6, hot.size(), static_cast<unsigned long long>(totalHits));
+    out << line;
+    std::snprintf(line, sizeof line, "%10s  %-20s %12s %12s %12s %7s\n",
+                  "line:col", "statement", "hits", "incl ms", "excl ms", "excl %");
+    out << line;
+    for (size_t i = 0; i < hot.size() && i < limit; ++i) {
+        const StatementStats& s = stats[hot[i]];
+        SourcePos at = ast.positionOf(hot[i]);
+        std::string where = std::to_string(at.line) + ":" + std::to_string(at.column);
+        std::snprintf(line, sizeof line, "%10s  %-20s %12llu %12.3f %12.3f %6.1f%%\n",
+                      where.c_str(), label(hot[i]).substr(0, 20).c_str(),
+                      static_cast<unsigned long long>(s.hits), s.inclusiveNs / 1e6, s.exclusiveNs / 1e6,
+                      totalNs ? 100.0 * s.exclusiveNs / totalNs : 0.0);
+        out << line;
+    }
+}
+
+void Profiler::writeFolded(std::ostream& out) const {
+    std::vector<std::string> frameNames;
+    for (uint32_t i = 1; i < stacks.size(); ++i) {
+        if (!stacks[i].selfNs) continue;
+        frameNames.clear();
+        for (uint32_t s = i; s != 0; s = stacks[s].parent) {
+            SourcePos at = ast.positionOf(stacks[s].stmt);
+            frameNames.push_back(label(stacks[s].stmt) + " (line " + std::to_string(at.line) + ":" +
+                                 std::to_string(at.column) + ")");
+        }
+        for (auto it = frameNames.rbegin(); it != frameNames.rend(); ++it) {
+            if (it != frameNames.rbegin()) out << ';';
+            out << *it;
+        }
+        out << ' ' << stacks[i].selfNs << '\n';
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Statement-level profile for --profile. An engine given a Profiler calls
+// enter() before and exit() after every statement except Blocks, so each
+// statement gets a hit count and its inclusive time (with everything nested
+// in it) and exclusive time (without). Engines without one skip all of this.
+//
+// Time spent in a 'fun' condition and in the loop machinery is exclusive
+// time of the 'fun' itself.
+class Profiler {
+public:
+    explicit Profiler(const Ast& program);
+
+    void enter(NodeId stmt);
+    void exit();
+    // Closes the statements an error left open
+    void finish();
+
+    // Statements by exclusive time, slowest first
+    void writeReport(std::ostream& out, size_t limit = 20) const;
+    // One "frame;frame;frame nanoseconds" line per distinct statement nesting,
+    // the input format of flamegraph.pl, inferno and speedscope
+    void writeFolded(std::ostream& out) const;
+
+private:
+    struct StatementStats {
+        uint64_t hits = 0;
+        uint64_t inclusiveNs = 0;
+        uint64_t exclusiveNs = 0;
+    };
+    // One node per distinct stack of statements; stacks[0] is the program
+    struct Stack {
+        uint32_t parent;
+        NodeId stmt;
+        uint64_t selfNs = 0;
+    };
+    struct Frame {
+        uint32_t stack;
+        uint64_t start;
+        uint64_t childNs = 0;
+    };
+
+    const Ast& ast;
+    std::vector<StatementStats> stats; // by NodeId
+    std::vector<Stack> stacks;
+    std::unordered_map<uint64_t, uint32_t> children; // parent stack << 32 | stmt
+    std::vector<Frame> frames;
+
+    static uint64_t now();
+    std::string label(NodeId stmt) const;
+};
@@ -0,0 +1,107 @@
+#include "quicken.h"
+#include "memory_account.h"
+#include <string>
+#include <type_traits>
+
+namespace {
+
+// One alternative of Value, named by the C++ type it holds
+template <typename T>
+bool holds(const Value& value) {
+    if constexpr (std::is_same_v<T, int>) return value.isInt();
+    else if constexpr (std::is_same_v<T, double>) return value.isDouble();
+    else return value.isString();
+}
+
+template <typename T>
+decltype(auto) read(const Value& value) {
+    if constexpr (std::is_same_v<T, int>) return value.asInt();
+    else if constexpr (std::is_same_v<T, double>) return value.asDouble();
+    else return value.str();
+}
+
+template <BinaryOp Op, typename L, typename R>
+bool fastPath(const Value& left, const Value& right, Value& out) {
+    if (!holds<L>(left) || !holds<R>(right)) return false;
+    decltype(auto) l = read<L>(left);
+    decltype(auto) r = read<R>(right);
+
+    if constexpr (Op == BinaryOp::Add) {
+        if constexpr (std::is_same_v<L, std::string>) requireMemory(l.size() + r.size());
+        out = l + r;
+    }
+    else if constexpr (Op == BinaryOp::Sub) out = l - r;
+    else if constexpr (Op == BinaryOp::Mul) out = l * r;
+    else if constexpr (Op == BinaryOp::Div) {
+        if (r == 0) return false;
+        out = static_cast<double>(l) / r;
+    }
+    else if constexpr (Op == BinaryOp::Mod) {
+        int rightInt = static_cast<int>(r);
+        if (rightInt == 0) return false;
+        out = static_cast<int>(l) % rightInt;
+    }
+    else if constexpr (Op == BinaryOp::Equal) {
+        // Different alternatives never compare equal
+        if constexpr (std::is_same_v<L, R>) out = static_cast<int>(l == r);
+        else out = 0;
+    }
+    else if constexpr (Op == BinaryOp::NotEqual) {
+        if constexpr (std::is_same_v<L, R>) out = static_cast<int>(l != r);
+        else out = 1;
+    }
+    else if constexpr (Op == BinaryOp::Less) out = static_cast<int>(l < r);
+    else if constexpr (Op == BinaryOp::LessEqual) out = static_cast<int>(l <= r);
+    else if constexpr (Op == BinaryOp::Greater) out = static_cast<int>(l > r);
+    else if constexpr (Op == BinaryOp::GreaterEqual) out = static_cast<int>(l >= r);
+    return true;
+}
+
+template <BinaryOp Op, typename L, typename R>
+BinaryFastPath pick() {
+    constexpr bool leftString = std::is_same_v<L, std::string>;
+    constexpr bool rightString = std::is_same_v<R, std::string>;
+    constexpr bool valid = Op == BinaryOp::Equal || Op == BinaryOp::NotEqual
+        || (!leftString && !rightString)
+        || (Op == BinaryOp::Add && leftString && rightString);
+    if constexpr (valid) return &fastPath<Op, L, R>;
+    else return nullptr;
+}
+
+template <BinaryOp Op>
+BinaryFastPath pickForTypes(const Value& left, const Value& right) {
+    // Alternative indices of Value: 0 = int, 1 = double, 2 = string; operators
+    // on arrays always fail, so they get no fast path
+    if (left.index() > 2 || right.index() > 2) return nullptr;
+    switch (left.index() * 3 + right.index()) {
+        case 0: return pick<Op, int, int>();
+        case 1: return pick<Op, int, double>();
+        case 2: return pick<Op, int, std::string>();
+        case 3: return pick<Op, double, int>();
+        case 4: return pick<Op, double, double>();
+        case 5: return pick<Op, double, std::string>();
+        case 6: return pick<Op, std::string, int>();
+        case 7: return pick<Op, std::string, double>();
+        case 8: return pick<Op, std::string, std::string>();
+    }
+    return nullptr;
+}
+
+} // namespace
+
+BinaryFastPath specializeBinary(BinaryOp op, const Value& left, const Value& right) {
+    switch (op) {
+        case BinaryOp::Add: return pickForTypes<BinaryOp::Add>(left, right);
+        case BinaryOp::Sub: return pickForTypes<BinaryOp::Sub>(left, right);
+        case BinaryOp::Mul: return pickForTypes<BinaryOp::Mul>(left, right);
+        case BinaryOp::Div: return pickForTypes<BinaryOp::Div>(left, right);
+        case BinaryOp::Mod: return pickForTypes<BinaryOp::Mod>(left, right);
+        case BinaryOp::Equal: return pickForTypes<BinaryOp::Equal>(left, right);
+        case BinaryOp::NotEqual: return pickForTypes<BinaryOp::NotEqual>(left, right);
+        case BinaryOp::Less: return pickForTypes<BinaryOp::Less>(left, right);
+        case BinaryOp::LessEqual: return pickForTypes<BinaryOp::LessEqual>(left, right);
+        case BinaryOp::Greater: return pickForTypes<BinaryOp::Greater>(left, right);
+        case BinaryOp::GreaterEqual: return pickForTypes<BinaryOp::GreaterEqual>(left, right);
+    }
+    return nullptr;
+}
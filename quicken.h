@@ -0,0 +1,26 @@
+#pragma once
+
+#include "value.h"
+#include <cstdint>
+
+// A BinaryOp specialized for one pair of operand alternatives (int+int,
+// double<double, string concat, ...). Returns false without touching out when
+// the guard fails: either an operand has another type or the divisor is zero.
+// The caller then takes the generic applyBinary path, which also raises the
+// usual errors.
+using BinaryFastPath = bool (*)(const Value& left, const Value& right, Value& out);
+
+// Picks the fast path for the operand types seen at a site, or nullptr when
+// that combination can only raise an error (e.g. string - string)
+BinaryFastPath specializeBinary(BinaryOp op, const Value& left, const Value& right);
+
+// A site that misses this many times stops being re-specialized
+constexpr uint8_t kMaxRespecializations = 4;
+
+struct QuickeningStats {
+    uint64_t hits = 0;             // fast path taken
+    uint64_t misses = 0;           // guard failed, generic path taken
+    uint64_t unquickened = 0;      // first executions and megamorphic sites
+    uint64_t specializations = 0;  // site rewrites, including re-specializations
+    uint64_t megamorphicSites = 0; // sites that gave up on specializing
+};
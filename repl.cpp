@@ -0,0 +1,249 @@
+#include "repl.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+Repl::Repl(const ReplOptions& options) : options(options) {
+    interpreter.setOutput(std::make_unique<FdSink>(STDOUT_FILENO, options.flushPolicy));
+    interpreter.setJit(options.useJit && kJitAvailable);
+    interpreter.memory().setLimit(options.memoryLimit);
+}
+
+bool Repl::execute(std::string_view code) {
+    try {
+        Ast program;
+        {
+            Lexer lexer(code);
+            auto tokens = lexer.tokenize();
+            Parser parser(tokens, lexer.symbols());
+            program = parser.parseProgram();
+        }
+        resolver.resolve(program);
+
+        // Later statements read what this one stores
+        Optimizer optimizer(options.optLevel);
+        optimizer.setKeepStores(true);
+        optimizer.optimize(program);
+
+        interpreter.interpret(program, resolver.slotCount());
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return false;
+    }
+}
+
+static bool startsWithElse(std::string_view line) {
+    size_t i = 0;
+    while (i < line.size() && std::isspace(static_cast<unsigned char>(line[i]))) ++i;
+    line.remove_prefix(i);
+    return line.substr(0, 4) == "elsa" && (line.size() == 4 || !std::isalnum(static_cast<unsigned char>(line[4])));
+}
+
+int Repl::run(std::istream& in, std::ostream& promptOut) {
+    StatementScanner scanner;
+    std::string pending;
+    int status = 0;
+    auto runPending = [&] {
+        if (!execute(pending)) status = 1;
+        pending.clear();
+        scanner.reset();
+    };
+    auto prompt = [&] {
+        if (options.prompts) promptOut << (scanner.empty() ? "> " : "... ") << std::flush;
+    };
+
+    std::string line;
+    prompt();
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        // 'ana (...) { ... }' was waiting to see whether an 'elsa' follows
+        if (scanner.awaitingElse() && !startsWithElse(line)) runPending();
+
+        scanner.feed(line);
+        if (scanner.empty()) {
+            pending.clear(); // nothing but blank lines so far
+        } else {
+            pending += line;
+            pending += '\n';
+            if (scanner.complete()) runPending();
+        }
+        prompt();
+    }
+    if (!scanner.empty()) runPending();
+    if (options.prompts) promptOut << "\n" << std::flush;
+    return status;
+}
+
+namespace {
+
+// Finds where each top-level statement in a buffer that fills up a read at a
+// time ends, scanning each byte once. A ';' or '}' at depth 0 ends a
+// statement unless the statement has an 'ana' at depth 0 and the next token
+// is 'elsa'; until that token has arrived the statement waits.
+class BoundaryScanner {
+public:
+    // Scans data up to size, atEnd once no more input will come, and stops
+    // after the next statement. Returns the end of the complete statements
+    // so far.
+    size_t scan(const char* data, size_t size, bool atEnd);
+    // The first count bytes have been dropped from the buffer
+    void shift(size_t count);
+
+private:
+    static constexpr size_t kNone = SIZE_MAX;
+    size_t pos = 0;
+    size_t complete = 0;
+    size_t candidate = kNone; // a statement ends here unless 'elsa' follows
+    size_t depth = 0;
+    bool inString = false;
+    bool hasIf = false;       // 'ana' at depth 0 in the current statement
+};
+
+size_t BoundaryScanner::scan(const char* data, size_t size, bool atEnd) {
+    while (pos < size) {
+        char c = data[pos];
+        if (inString) {
+            if (c == '"') inString = false;
+            ++pos;
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            ++pos;
+            continue;
+        }
+        size_t word = pos;
+        if (std::isalpha(static_cast<unsigned char>(c))) {
+            while (word < size && std::isalnum(static_cast<unsigned char>(data[word]))) ++word;
+            if (word == size && !atEnd) break; // the word may go on in the next read
+        }
+        std::string_view token(data + pos, word - pos);
+        if (candidate != kNone) {
+            bool ends = token != "elsa";
+            if (ends) {
+                complete = candidate;
+                hasIf = false;
+            }
+            candidate = kNone;
+            if (ends) return complete;
+        }
+
+        if (!token.empty()) {
+            if (depth == 0 && token == "ana") hasIf = true;
+            pos = word;
+            continue;
+        }
+        if (c == '"') {
+            inString = true;
+        }
+        else if (c == '\'') {
+            if (pos + 2 >= size && !atEnd) break;
+            size_t length = charLiteralLength(std::string_view(data + pos, size - pos));
+            if (pos + length > size && !atEnd) break;
+            pos = std::min(pos + length, size);
+            continue;
+        }
+        else if (c == '{') {
+            ++depth;
+        }
+        else if (c == '}' || c == ';') {
+            if (c == '}' && depth > 0) --depth;
+            if (depth == 0) {
+                if (hasIf) {
+                    candidate = pos + 1;
+                } else {
+                    complete = ++pos;
+                    return complete;
+                }
+            }
+        }
+        ++pos;
+    }
+    if (atEnd) complete = size;
+    return complete;
+}
+
+void BoundaryScanner::shift(size_t count) {
+    pos -= count;
+    complete -= count;
+    if (candidate != kNone) candidate -= count;
+}
+
+} // namespace
+
+int Repl::stream(int fd, size_t bufferSize) {
+    std::vector<char> buffer(std::max<size_t>(bufferSize, 1));
+    size_t used = 0;
+    BoundaryScanner scanner;
+    bool atEnd = false;
+    while (!atEnd) {
+        if (used == buffer.size()) buffer.resize(buffer.size() * 2); // one statement fills it
+        ssize_t got = ::read(fd, buffer.data() + used, buffer.size() - used);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: Could not read input: " << std::strerror(errno) << "\n";
+            return 1;
+        }
+        atEnd = got == 0;
+        used += static_cast<size_t>(got);
+
+        // One statement at a time, so what runs before an error does not
+        // depend on how the input was split into reads
+        size_t done = 0;
+        for (size_t end; (end = scanner.scan(buffer.data(), used, atEnd)) > done; done = end) {
+            if (!execute(std::string_view(buffer.data() + done, end - done))) return 1;
+        }
+        // Keep only the statement still arriving
+        std::memmove(buffer.data(), buffer.data() + done, used - done);
+        used -= done;
+        scanner.shift(done);
+    }
+    return 0;
+}
+
+void StatementScanner::feed(std::string_view line) {
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (inString) {
+            if (c == '"') inString = false;
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c))) continue;
+
+        started = true;
+        bool closes = false;
+        if (c == '"') {
+            inString = true;
+        }
+        else if (c == '\'') {
+            i += charLiteralLength(line.substr(i)) - 1;
+        }
+        else if (std::isalpha(static_cast<unsigned char>(c))) {
+            size_t start = i;
+            while (i + 1 < line.size() && std::isalnum(static_cast<unsigned char>(line[i + 1]))) ++i;
+            std::string_view word = line.substr(start, i - start + 1);
+            if (depth == 0 && (word == "ana" || word == "elsa" || word == "fun")) headIsIf = word == "ana";
+        }
+        else if (c == '{') {
+            ++depth;
+        }
+        else if (c == '}') {
+            if (depth > 0) --depth;
+            closes = depth == 0;
+        }
+        else if (c == ';') {
+            closes = depth == 0;
+            if (closes) headIsIf = false;
+        }
+        ended = closes;
+        mayTakeElse = closes && c == '}' && headIsIf;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "interpreter.h"
+#include "output.h"
+#include "resolver.h"
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+struct ReplOptions {
+    int optLevel = 1;
+    bool useJit = true;
+    FlushPolicy flushPolicy = FlushPolicy::EveryLine;
+    bool prompts = true; // "> " for a new statement, "... " for a continued one
+    size_t memoryLimit = 0; // bytes the session's variables may hold; 0 for no limit
+};
+
+// Interactive and streaming mode: every complete statement is lexed, parsed
+// and run as soon as it has been typed or has arrived. Only the new text is compiled each time; variables
+// live on in one Resolver (names to slots) and one Interpreter (values), so
+// a statement costs the same at the start of a session as after hours of it.
+// An error reports "Error: ..." and the session goes on with whatever the
+// failed statement assigned before it failed.
+class Repl {
+public:
+    explicit Repl(const ReplOptions& options);
+
+    // Reads statements until EOF. Returns 1 if any of them failed.
+    int run(std::istream& in, std::ostream& promptOut);
+
+    // Runs a script as it arrives on fd, typically a pipe from a generator.
+    // Input is read into a buffer of bufferSize bytes; each statement runs
+    // as soon as it is complete and is then dropped, so memory stays bounded
+    // however long the stream is (the buffer only grows for a single
+    // statement longer than itself). Stops at the first error, like a script
+    // run. Returns 1 on an error.
+    int stream(int fd, size_t bufferSize = kStreamBufferSize);
+
+    static constexpr size_t kStreamBufferSize = 64 * 1024;
+
+    // Runs one or more complete statements; false (after printing the error
+    // to stderr) if they failed
+    bool execute(std::string_view code);
+
+private:
+    ReplOptions options;
+    Resolver resolver;
+    Interpreter interpreter;
+};
+
+// Tracks whether the text typed so far ends in a complete statement: '{' and
+// '}' balanced outside string and character literals, and the last one ended
+// by ';' or by a '}' that cannot be followed by 'elsa'. After 'ana (...) {...}'
+// the next line decides: 'elsa' continues the statement, anything else starts
+// a new one.
+class StatementScanner {
+public:
+    void feed(std::string_view line);
+    void reset() { *this = StatementScanner(); }
+
+    bool complete() const { return depth == 0 && !inString && ended && !mayTakeElse; }
+    // The statement so far would be complete but for a possible 'elsa'
+    bool awaitingElse() const { return depth == 0 && !inString && ended && mayTakeElse; }
+    bool empty() const { return !started; }
+
+private:
+    size_t depth = 0;
+    bool inString = false;
+    bool started = false;
+    bool ended = false;       // the last significant character closed a statement
+    bool mayTakeElse = false; // ... and it was the '}' of an 'ana' branch
+    bool headIsIf = false;    // the last keyword at depth 0 was 'ana'
+};
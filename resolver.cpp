@@ -0,0 +1,114 @@
+#include "resolver.h"
+#include "type_checker.h"
+#include <algorithm>
+#include <stdexcept>
+
+void Resolver::resolve(Ast& program) {
+    ast = &program;
+    size_t known = names.size();
+    for (NodeId stmt : program.statements) {
+        resolveStmt(stmt);
+    }
+    // Inputs and the variables of earlier programs (the REPL) may hold anything
+    std::vector<TypeSet> start(names.size(), kUnsetType);
+    std::fill_n(start.begin(), known, kAnyType | kUnsetType);
+    TypeChecker().check(program, std::move(start));
+}
+
+void Resolver::declareInput(const std::string& name) {
+    slotFor(name);
+    declared.insert(name);
+}
+
+void Resolver::resolveStmt(NodeId id) {
+    Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+            resolveExpr(node.a);
+            break;
+        case NodeKind::Assign:
+        case NodeKind::Decl: {
+            resolveExpr(node.a);
+            const std::string& name = ast->nameOf(node);
+            node.b = slotFor(name);
+            declared.insert(name);
+            break;
+        }
+        case NodeKind::StoreElement:
+            // Changes an element of an existing array, so it declares nothing
+            resolveExpr(node.b);
+            resolveExpr(node.a);
+            resolveExpr(node.c);
+            break;
+        case NodeKind::If:
+            resolveExpr(node.a);
+            if (node.b != kNoNode) resolveStmt(node.b);
+            if (node.c != kNoNode) resolveStmt(node.c);
+            break;
+        case NodeKind::While:
+            // The first test runs before the body; later iterations and tests
+            // see everything the previous iteration assigned
+            resolveExpr(node.a);
+            declareAssignedIn(node.b);
+            resolveStmt(node.b);
+            break;
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                resolveStmt(*s);
+            }
+            break;
+        default:
+            throw std::runtime_error("Unknown statement type in execute");
+    }
+}
+
+void Resolver::resolveExpr(NodeId id) {
+    Node& node = (*ast)[id];
+    if (node.kind == NodeKind::Variable) {
+        const std::string& name = ast->nameOf(node);
+        if (!declared.count(name)) throw std::runtime_error("Undefined variable: " + name);
+        node.b = slotFor(name);
+    }
+    else if (node.kind == NodeKind::Binary || node.kind == NodeKind::Index) {
+        resolveExpr(node.a);
+        resolveExpr(node.b);
+    }
+    else if (node.kind == NodeKind::Call || node.kind == NodeKind::ArrayLiteral) {
+        for (const NodeId* e = ast->begin(node); e != ast->end(node); ++e) {
+            resolveExpr(*e);
+        }
+    }
+}
+
+void Resolver::declareAssignedIn(NodeId id) {
+    const Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Assign:
+        case NodeKind::Decl:
+            declared.insert(ast->nameOf(node));
+            break;
+        case NodeKind::If:
+            if (node.b != kNoNode) declareAssignedIn(node.b);
+            if (node.c != kNoNode) declareAssignedIn(node.c);
+            break;
+        case NodeKind::While:
+            declareAssignedIn(node.b);
+            break;
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                declareAssignedIn(*s);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+uint32_t Resolver::slotFor(const std::string& name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) return it->second;
+    uint32_t slot = static_cast<uint32_t>(names.size());
+    names.push_back(name);
+    slots.emplace(name, slot);
+    return slot;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ast.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Gives every variable name a fixed slot index so the engines can keep
+// variables in a contiguous array instead of a map keyed by name.
+//
+// A read of a name that is not assigned anywhere before it in the program
+// text (or anywhere in an enclosing 'fun' body, for loop-carried values) is
+// reported here. Reads that are only conditionally defined, e.g. a variable
+// declared inside an 'ana' that was not taken, are still checked at run time.
+// Operations that fail whatever types reach them are reported here too (see
+// TypeChecker).
+class Resolver {
+public:
+    void resolve(Ast& ast);
+    // A variable the host sets before the program runs (see happyscript.h);
+    // call before resolve(). It gets a slot even if the program never uses it.
+    void declareInput(const std::string& name);
+
+    size_t slotCount() const { return names.size(); }
+    const std::vector<std::string>& slotNames() const { return names; }
+
+private:
+    Ast* ast = nullptr;
+    std::unordered_map<std::string, uint32_t> slots;
+    std::vector<std::string> names;
+    std::unordered_set<std::string> declared;
+
+    void resolveStmt(NodeId id);
+    void resolveExpr(NodeId id);
+    void declareAssignedIn(NodeId id);
+    uint32_t slotFor(const std::string& name);
+};
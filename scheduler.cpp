@@ -0,0 +1,134 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Most scripts print little; the buffer grows for those that print more
+constexpr size_t kTaskOutputCapacity = 256;
+
+Scheduler::Scheduler(const SchedulerOptions& options) : sliceBudget(std::max<uint64_t>(options.sliceBudget, 1)) {
+    unsigned count = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < count; ++i) workers.emplace_back(&Scheduler::work, this);
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        for (Task* task : queue) finish(*task, TaskState::Cancelled, "Cancelled");
+        queue.clear();
+        // The ones on a worker stop after their slice
+        for (auto& entry : tasks) entry.second->cancelled = true;
+    }
+    ready.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+TaskId Scheduler::submit(std::unique_ptr<ProgramInstance> instance, std::chrono::nanoseconds timeout) {
+    if (!instance) throw std::runtime_error("No program");
+    auto task = std::make_unique<Task>();
+    auto sink = std::make_unique<StringSink>(kTaskOutputCapacity);
+    task->output = sink.get();
+    instance->setOutput(std::move(sink));
+    instance->setJit(false);
+    task->instance = std::move(instance);
+    task->submitted = Clock::now();
+    task->deadline = timeout > std::chrono::nanoseconds::zero()
+                         ? task->submitted + std::chrono::duration_cast<Clock::duration>(timeout)
+                         : Clock::time_point::max();
+
+    TaskId id;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        id = nextId++;
+        queue.push_back(task.get());
+        tasks.emplace(id, std::move(task));
+    }
+    ready.notify_one();
+    return id;
+}
+
+bool Scheduler::cancel(TaskId id) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = tasks.find(id);
+    if (found == tasks.end() || found->second->over) return false;
+    Task& task = *found->second;
+    task.cancelled = true;
+    // Not on a worker: it is in the queue and can end now
+    auto queued = std::find(queue.begin(), queue.end(), &task);
+    if (queued != queue.end()) {
+        queue.erase(queued);
+        finish(task, TaskState::Cancelled, "Cancelled");
+    }
+    return true;
+}
+
+TaskResult Scheduler::wait(TaskId id) {
+    std::unique_lock<std::mutex> guard(lock);
+    auto found = tasks.find(id);
+    if (found == tasks.end()) throw std::runtime_error("Unknown task: " + std::to_string(id));
+    Task* task = found->second.get();
+    ended.wait(guard, [task] { return task->over; });
+    TaskResult result = std::move(task->result);
+    tasks.erase(id);
+    return result;
+}
+
+void Scheduler::work() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        ready.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+        Task& task = *queue.front();
+        queue.pop_front();
+
+        guard.unlock();
+        bool over = runSlice(task);
+        guard.lock();
+        // Tasks waiting behind this one go first
+        if (!over) queue.push_back(&task);
+    }
+}
+
+bool Scheduler::runSlice(Task& task) {
+    // Read under the lock: cancel() writes it
+    auto stopped = [this, &task] {
+        std::lock_guard<std::mutex> guard(lock);
+        if (task.cancelled) finish(task, TaskState::Cancelled, "Cancelled");
+        else if (Clock::now() >= task.deadline) finish(task, TaskState::TimedOut, "Deadline exceeded");
+        return task.over;
+    };
+    if (stopped()) return true;
+
+    bool done;
+    try {
+        if (!task.started) {
+            task.instance->start();
+            task.started = true;
+        }
+        done = task.instance->resume(sliceBudget);
+    }
+    catch (const std::exception& e) {
+        ++task.result.slices;
+        std::lock_guard<std::mutex> guard(lock);
+        finish(task, TaskState::Failed, e.what());
+        return true;
+    }
+    ++task.result.slices;
+    if (done) {
+        std::lock_guard<std::mutex> guard(lock);
+        finish(task, TaskState::Finished, "");
+        return true;
+    }
+    return stopped();
+}
+
+// Called with the lock held
+void Scheduler::finish(Task& task, TaskState state, std::string error) {
+    task.result.state = state;
+    task.result.error = std::move(error);
+    task.result.output = task.output->take();
+    task.result.latency = Clock::now() - task.submitted;
+    task.result.instance = std::move(task.instance);
+    task.over = true;
+    ended.notify_all();
+}
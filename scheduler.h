@@ -0,0 +1,102 @@
+#pragma once
+
+// Runs many scripts on a few threads, each a slice at a time, so a script
+// that never ends cannot hold a thread:
+//
+//   Scheduler scheduler;                 // one worker per hardware thread
+//   auto instance = std::make_unique<ProgramInstance>(program);
+//   instance->set("n", 10);
+//   TaskId id = scheduler.submit(std::move(instance), std::chrono::milliseconds(50));
+//   TaskResult result = scheduler.wait(id);
+//
+// Ready scripts wait in one FIFO queue. A worker takes the first, resumes it
+// for one slice (ProgramInstance::resume with SchedulerOptions::sliceBudget
+// loop iterations) and puts it back at the end unless it finished, so every
+// script gets the same share. Deadlines and cancel() take effect between
+// slices. Scripts run without the JIT, whose native loops never stop in the
+// middle.
+
+#include "happyscript.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct SchedulerOptions {
+    unsigned workers = 0;          // 0: one per hardware thread
+    uint64_t sliceBudget = 10000;  // loop iterations per slice
+};
+
+using TaskId = uint64_t;
+
+enum class TaskState {
+    Finished,
+    Failed,    // a runtime error; see TaskResult::error
+    Cancelled,
+    TimedOut,
+};
+
+struct TaskResult {
+    TaskState state = TaskState::Finished;
+    std::string error;  // the runtime error, "Cancelled" or "Deadline exceeded"
+    std::string output; // what the script printed, even when it did not finish
+    uint32_t slices = 0;
+    std::chrono::nanoseconds latency{0}; // from submit() to the end
+    // Its variables may be read back; a script stopped in the middle keeps
+    // what it had assigned so far
+    std::unique_ptr<ProgramInstance> instance;
+};
+
+class Scheduler {
+public:
+    explicit Scheduler(const SchedulerOptions& options = {});
+    // Cancels whatever is still queued and waits for the workers
+    ~Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Queues a script whose inputs are already set; its output is captured
+    // in the result. A timeout of zero means no deadline.
+    TaskId submit(std::unique_ptr<ProgramInstance> instance,
+                  std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero());
+    // False if the task is unknown or already over
+    bool cancel(TaskId id);
+    // Blocks until the task is over and hands back its result; each id may
+    // be waited for once
+    TaskResult wait(TaskId id);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+        std::unique_ptr<ProgramInstance> instance;
+        StringSink* output = nullptr; // owned by instance
+        Clock::time_point submitted;
+        Clock::time_point deadline;
+        bool started = false;
+        bool cancelled = false;
+        bool over = false;
+        TaskResult result;
+    };
+
+    uint64_t sliceBudget;
+    std::mutex lock;
+    std::condition_variable ready; // the queue has a task, or stopping
+    std::condition_variable ended; // some task is over
+    std::deque<Task*> queue;
+    std::unordered_map<TaskId, std::unique_ptr<Task>> tasks;
+    TaskId nextId = 1;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void work();
+    // Runs one slice; true if the task is over
+    bool runSlice(Task& task);
+    void finish(Task& task, TaskState state, std::string error);
+};
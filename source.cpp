@@ -0,0 +1,77 @@
+#include "source.h"
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAPPYSCRIPT_HAVE_MMAP 1
+#endif
+
+SourceBuffer SourceBuffer::fromFile(const std::string& path) {
+#ifdef HAPPYSCRIPT_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Could not open file: " + path);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            ::close(fd);
+            ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            SourceBuffer buffer;
+            buffer.data = static_cast<const char*>(p);
+            buffer.size = static_cast<size_t>(st.st_size);
+            buffer.mapped = true;
+            return buffer;
+        }
+    }
+    ::close(fd);
+#endif
+    // Empty files, pipes and platforms without mmap are read the slow way
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open file: " + path);
+    return fromString(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()));
+}
+
+SourceBuffer SourceBuffer::fromString(std::string text) {
+    SourceBuffer buffer;
+    buffer.owned = std::move(text);
+    buffer.data = buffer.owned.data();
+    buffer.size = buffer.owned.size();
+    return buffer;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+SourceBuffer& SourceBuffer::operator=(SourceBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        mapped = other.mapped;
+        size = other.size;
+        owned = std::move(other.owned);
+        data = mapped ? other.data : owned.data();
+        other.data = nullptr;
+        other.size = 0;
+        other.mapped = false;
+    }
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+    release();
+}
+
+void SourceBuffer::release() {
+#ifdef HAPPYSCRIPT_HAVE_MMAP
+    if (mapped) ::munmap(const_cast<char*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
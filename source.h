@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Program text. Files are memory-mapped read-only so neither main() nor the
+// Lexer copies them; tokens are views straight into the mapping.
+class SourceBuffer {
+public:
+    // Throws std::runtime_error("Could not open file: <path>")
+    static SourceBuffer fromFile(const std::string& path);
+    static SourceBuffer fromString(std::string text);
+
+    SourceBuffer(SourceBuffer&& other) noexcept;
+    SourceBuffer& operator=(SourceBuffer&& other) noexcept;
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer();
+
+    std::string_view view() const { return {data, size}; }
+
+private:
+    SourceBuffer() = default;
+    void release();
+
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::string owned; // used when the input could not be mapped
+};
@@ -0,0 +1,334 @@
+#include "type_checker.h"
+#include "arrays.h"
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// What op yields for a single type on each side, or 0 where the engines throw
+TypeSet resultType(BinaryOp op, TypeSet left, TypeSet right) {
+    bool numbers = (left & kNumberTypes) && (right & kNumberTypes);
+    bool ints = left == kIntType && right == kIntType;
+    switch (op) {
+        case BinaryOp::Add:
+            if (left == kStringType && right == kStringType) return kStringType;
+            [[fallthrough]];
+        case BinaryOp::Sub:
+        case BinaryOp::Mul:
+            return numbers ? (ints ? kIntType : kDoubleType) : 0;
+        case BinaryOp::Div:
+            return numbers ? kDoubleType : 0;
+        case BinaryOp::Mod:
+            return numbers ? kIntType : 0;
+        case BinaryOp::Equal:
+        case BinaryOp::NotEqual:
+            return kIntType;
+        default:
+            return numbers ? kIntType : 0;
+    }
+}
+
+// resultType over every combination of the types in two sets, for all sets
+struct ResultTable {
+    TypeSet entries[size_t(BinaryOp::GreaterEqual) + 1][kAnyType + 1][kAnyType + 1] = {};
+
+    ResultTable() {
+        for (size_t op = 0; op <= size_t(BinaryOp::GreaterEqual); ++op) {
+            for (TypeSet left = 0; left <= kAnyType; ++left) {
+                for (TypeSet right = 0; right <= kAnyType; ++right) {
+                    for (TypeSet l = kIntType; l <= kFloatArrayType; l <<= 1) {
+                        for (TypeSet r = kIntType; r <= kFloatArrayType; r <<= 1) {
+                            if ((left & l) && (right & r)) entries[op][left][right] |= resultType(BinaryOp(op), l, r);
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+const ResultTable kResults;
+
+// What a builtin yields for a single type per argument (second is ignored by
+// builtins that take one), or 0 where callBuiltin throws its type error
+TypeSet builtinResult(Builtin builtin, TypeSet first, TypeSet second) {
+    bool array = first & kArrayTypes;
+    bool numbers = (first & kNumberTypes) && (second & kNumberTypes);
+    bool ints = first == kIntArrayType;
+    switch (builtin) {
+        case Builtin::Len:
+            return array ? kIntType : 0;
+        case Builtin::Sum:
+        case Builtin::Min:
+        case Builtin::Max:
+            return array ? (ints ? kIntType : kDoubleType) : 0;
+        case Builtin::Dot:
+            if (!array || !(second & kArrayTypes)) return 0;
+            return ints && second == kIntArrayType ? kIntType : kDoubleType;
+        case Builtin::Scale:
+            if (!array || !(second & kNumberTypes)) return 0;
+            return ints && second == kIntType ? kIntArrayType : kFloatArrayType;
+        case Builtin::Add:
+            if (!array || !(second & kArrayTypes)) return 0;
+            return ints && second == kIntArrayType ? kIntArrayType : kFloatArrayType;
+        case Builtin::Less:
+        case Builtin::Greater:
+        case Builtin::Equal:
+            return array && second != kStringType ? kIntArrayType : 0;
+        case Builtin::Fill:
+            if (!numbers) return 0;
+            return second == kIntType ? kIntArrayType : kFloatArrayType;
+        case Builtin::Range:
+            return first & kNumberTypes ? kIntArrayType : 0;
+    }
+    return 0;
+}
+
+// The message elementAt or storeElement raises when the types reaching a
+// failing Index or StoreElement rule it out
+std::string indexFailure(TypeSet array, TypeSet index) {
+    if (!(array & kArrayTypes)) return "Only arrays can be indexed";
+    if (!(index & kNumberTypes)) return "Array index must be numeric";
+    return "Array elements must be numeric";
+}
+
+// The message applyBinary raises when op fails on its operand types
+std::string failure(BinaryOp op) {
+    if (op == BinaryOp::Mod) return "Modulo operator requires integer operands";
+    if (op >= BinaryOp::Less) return std::string("Operator '") + binaryOpSymbol(op) + "' requires numeric operands";
+    return "Invalid expression";
+}
+
+} // namespace
+
+void TypeChecker::infer(const Ast& program, std::vector<TypeSet> start) {
+    ast = &program;
+    types.assign(program.nodes.size(), 0);
+    failures.clear();
+    slots = std::move(start);
+    changes.clear();
+    nesting = 0;
+    seen.assign(slots.size(), 0);
+    round = 0;
+    for (NodeId stmt : program.statements) {
+        this->stmt(stmt);
+    }
+}
+
+void TypeChecker::check(const Ast& program, std::vector<TypeSet> start) {
+    infer(program, std::move(start));
+    // A failure seen in an early round of a 'fun' body can go away once more
+    // types reach it. Nodes are numbered in source order, children before
+    // their parents, so the lowest one left comes first in the program text.
+    NodeId first = kNoNode;
+    for (NodeId id : failures) {
+        if ((types[id] & kFails) && id < first) first = id;
+    }
+    if (first != kNoNode) {
+        const Node& node = program[first];
+        if (node.kind == NodeKind::Binary) throw std::runtime_error(failure(node.op));
+        if (node.kind == NodeKind::Decl) {
+            throw std::runtime_error(std::string("Type mismatch assigning to ") + declaredTypeName(node.varType) + " variable");
+        }
+        if (node.kind == NodeKind::Index) throw std::runtime_error(indexFailure(types[node.a], types[node.b]));
+        if (node.kind == NodeKind::StoreElement) throw std::runtime_error(indexFailure(types[node.c], types[node.b]));
+        if (node.kind == NodeKind::Call) throw std::runtime_error(builtinTypeError(static_cast<Builtin>(node.c)));
+        if (node.kind == NodeKind::ArrayLiteral) throw std::runtime_error("Array elements must be numeric");
+        throw std::runtime_error("Condition must be numeric");
+    }
+}
+
+void TypeChecker::stmt(NodeId id) {
+    const Node& node = (*ast)[id];
+    switch (node.kind) {
+        case NodeKind::Print:
+            expr(node.a);
+            break;
+        case NodeKind::Assign:
+            // Stores the value as it is; a value that cannot exist means the
+            // statement never finishes
+            set(node.b, expr(node.a));
+            break;
+        case NodeKind::Decl: {
+            TypeSet value = expr(node.a);
+            TypeSet stored = 0;
+            if (node.varType == TokenType::IntType) stored = (value & kNumberTypes) ? kIntType : 0;
+            else if (node.varType == TokenType::FloatType) stored = (value & kNumberTypes) ? kDoubleType : 0;
+            else if (node.varType == TokenType::IntArrayType) stored = (value & kArrayTypes) ? kIntArrayType : 0;
+            else if (node.varType == TokenType::FloatArrayType) stored = (value & kArrayTypes) ? kFloatArrayType : 0;
+            else stored = value & kStringType;
+            if (value && !stored) fail(id);
+            else mark(id, 0);
+            set(node.b, stored);
+            break;
+        }
+        case NodeKind::If: {
+            condition(id, node.a);
+            ++nesting;
+            size_t start = changes.size();
+            if (node.b != kNoNode) stmt(node.b);
+            std::vector<SlotType> taken = undoSince(start);
+            if (node.c != kNoNode) stmt(node.c);
+            // Join: a slot only the else branch assigned may also still hold
+            // what it held before the 'ana'
+            ++round;
+            for (const SlotType& entry : taken) seen[entry.first] = round;
+            std::vector<SlotType> before;
+            for (size_t i = start; i < changes.size(); ++i) {
+                if (seen[changes[i].first] != round) before.push_back(changes[i]);
+                seen[changes[i].first] = round;
+            }
+            if (--nesting == 0) changes.clear();
+            for (const SlotType& entry : taken) set(entry.first, slots[entry.first] | entry.second);
+            for (const SlotType& entry : before) set(entry.first, slots[entry.first] | entry.second);
+            break;
+        }
+        case NodeKind::While: {
+            // Every test sees the entry state joined with what any number of
+            // iterations can leave behind; sets only grow, so this settles
+            // after a few rounds
+            for (;;) {
+                ++nesting;
+                size_t start = changes.size();
+                condition(id, node.a);
+                stmt(node.b);
+                std::vector<SlotType> after = undoSince(start);
+                --nesting;
+                bool grew = false;
+                for (const SlotType& entry : after) {
+                    TypeSet joined = slots[entry.first] | entry.second;
+                    if (joined == slots[entry.first]) continue;
+                    set(entry.first, joined);
+                    grew = true;
+                }
+                if (!grew) break;
+            }
+            break;
+        }
+        case NodeKind::StoreElement: {
+            // Leaves the slot's types alone. Fails only where the message is
+            // certain: storeElement checks the array, then the index, then
+            // the value, and only then the range.
+            TypeSet index = expr(node.b);
+            TypeSet value = expr(node.a);
+            TypeSet array = expr(node.c);
+            bool fails = array && index && value &&
+                         (!(array & kArrayTypes) ||
+                          (!(array & ~kArrayTypes) &&
+                           (!(index & kNumberTypes) || (!(index & ~kNumberTypes) && !(value & kNumberTypes)))));
+            if (fails) fail(id);
+            else mark(id, 0);
+            break;
+        }
+        case NodeKind::Block:
+            for (const NodeId* s = ast->begin(node); s != ast->end(node); ++s) {
+                stmt(*s);
+            }
+            break;
+        default:
+            throw std::runtime_error("Unknown statement type in execute");
+    }
+}
+
+void TypeChecker::set(uint32_t slot, TypeSet type) {
+    if (nesting) changes.emplace_back(slot, slots[slot]);
+    slots[slot] = type;
+}
+
+// The types the changes since start left behind, one entry per change,
+// after putting back what the slots held before them
+std::vector<TypeChecker::SlotType> TypeChecker::undoSince(size_t start) {
+    std::vector<SlotType> changed;
+    changed.reserve(changes.size() - start);
+    for (size_t i = start; i < changes.size(); ++i) changed.emplace_back(changes[i].first, slots[changes[i].first]);
+    for (size_t i = changes.size(); i-- > start;) slots[changes[i].first] = changes[i].second;
+    changes.resize(start);
+    return changed;
+}
+
+void TypeChecker::condition(NodeId stmt, NodeId cond) {
+    TypeSet value = expr(cond);
+    if (value && !(value & kNumberTypes)) fail(stmt);
+    else mark(stmt, 0);
+}
+
+TypeSet TypeChecker::expr(NodeId id) {
+    const Node& node = (*ast)[id];
+    TypeSet result = 0;
+    switch (node.kind) {
+        case NodeKind::Number:
+        case NodeKind::String: {
+            // The optimizer's folded constants can be of either kind
+            const Value& value = ast->constants[node.a];
+            result = value.isInt() ? kIntType : value.isDouble() ? kDoubleType : kStringType;
+            break;
+        }
+        case NodeKind::Variable:
+            // Keeps kUnsetType for the compiler; reading an unset variable throws
+            mark(id, slots[node.b]);
+            return slots[node.b] & kAnyType;
+        case NodeKind::Binary: {
+            TypeSet left = expr(node.a);
+            TypeSet right = expr(node.b);
+            result = kResults.entries[static_cast<size_t>(node.op)][left][right];
+            if (left && right && !result) fail(id);
+            else mark(id, result);
+            return result;
+        }
+        case NodeKind::Index: {
+            TypeSet array = expr(node.a);
+            TypeSet index = expr(node.b);
+            if (index & kNumberTypes) {
+                if (array & kIntArrayType) result |= kIntType;
+                if (array & kFloatArrayType) result |= kDoubleType;
+            }
+            // Out of range is never certain, so only a type error fails
+            bool fails = array && index && (!(array & kArrayTypes) || (!(array & ~kArrayTypes) && !(index & kNumberTypes)));
+            if (fails) fail(id);
+            else mark(id, result);
+            return result;
+        }
+        case NodeKind::Call: {
+            Builtin builtin = static_cast<Builtin>(node.c);
+            TypeSet args[2] = {kIntType, kIntType};
+            bool reached = true;
+            for (uint32_t i = 0; i < node.b; ++i) {
+                args[i] = expr(ast->lists[node.a + i]);
+                reached = reached && args[i];
+            }
+            for (TypeSet l = kIntType; l <= kFloatArrayType; l <<= 1) {
+                for (TypeSet r = kIntType; r <= kFloatArrayType; r <<= 1) {
+                    if ((args[0] & l) && (args[1] & r)) result |= builtinResult(builtin, l, r);
+                }
+            }
+            if (reached && !result) fail(id);
+            else mark(id, result);
+            return result;
+        }
+        case NodeKind::ArrayLiteral: {
+            // An int[] when every element may be an int, a float[] when any
+            // may be a double; an empty literal is an int[]
+            bool reached = true;
+            bool numbers = true;
+            bool ints = true;
+            bool doubles = false;
+            for (const NodeId* e = ast->begin(node); e != ast->end(node); ++e) {
+                TypeSet element = expr(*e);
+                reached = reached && element;
+                numbers = numbers && (element & kNumberTypes);
+                ints = ints && (element & kIntType);
+                doubles = doubles || (element & kDoubleType);
+            }
+            if (numbers) result = (ints ? kIntArrayType : 0) | (doubles ? kFloatArrayType : 0);
+            if (reached && !numbers) fail(id);
+            else mark(id, result);
+            return result;
+        }
+        case NodeKind::Hoisted:
+            result = expr(node.a);
+            break;
+        default:
+            throw std::runtime_error("Invalid expression");
+    }
+    mark(id, result);
+    return result;
+}
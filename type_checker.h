@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// The types a value may have at some point of the program, as a bit set
+using TypeSet = uint8_t;
+constexpr TypeSet kIntType = 1;
+constexpr TypeSet kDoubleType = 2;
+constexpr TypeSet kStringType = 4;
+constexpr TypeSet kIntArrayType = 8;
+constexpr TypeSet kFloatArrayType = 16;
+constexpr TypeSet kUnsetType = 32; // a variable not assigned yet
+constexpr TypeSet kNumberTypes = kIntType | kDoubleType;
+constexpr TypeSet kArrayTypes = kIntArrayType | kFloatArrayType;
+constexpr TypeSet kAnyType = kIntType | kDoubleType | kStringType | kArrayTypes;
+
+// Static types for a resolved program, following the engines' rules exactly:
+// int op int stays int except '/', which always yields double; mixed
+// numbers promote to double; '%' truncates both sides to int; comparisons
+// yield int; 'int'/'float' declarations convert. Assignments store whatever
+// they are given, so a variable's type can change as the program runs:
+// every variable gets the set of types it may hold at each point, with
+// 'ana' branches joined and 'fun' bodies iterated until nothing changes.
+//
+// check() reports an operation that fails whatever values reach it
+// (string + number, a string condition, 'int x = "a"', sum(5), ...) before the
+// program runs, with the message the engines would raise, even in code that
+// never runs, like the Resolver's undefined-variable check. Operations that
+// fail only for some of the types that may reach them are left to run time.
+class TypeChecker {
+public:
+    // start: what each slot may hold when the program begins, one entry
+    // per slot the Resolver handed out
+    void infer(const Ast& program, std::vector<TypeSet> start);
+    // infer(), then throws std::runtime_error for the first failing operation
+    void check(const Ast& program, std::vector<TypeSet> start);
+
+    // Types an expression may produce. For a Variable this includes
+    // kUnsetType when it may be read before it is assigned.
+    TypeSet typeOf(NodeId expr) const {
+        return expr < types.size() ? TypeSet(types[expr] & (kAnyType | kUnsetType)) : TypeSet(kAnyType | kUnsetType);
+    }
+
+private:
+    // Per node: the expression's types, or kFails on a statement or
+    // expression that always raises
+    static constexpr uint8_t kFails = 0x80;
+
+    using SlotType = std::pair<uint32_t, TypeSet>;
+
+    const Ast* ast = nullptr;
+    std::vector<uint8_t> types;
+    std::vector<NodeId> failures; // marked kFails at some point
+    std::vector<TypeSet> slots; // at the current point of the walk
+    // Inside 'ana' and 'fun': every change to slots with the type it
+    // replaced, so joins only visit what a branch or body assigned
+    std::vector<SlotType> changes;
+    size_t nesting = 0;
+    std::vector<uint32_t> seen; // per slot, for joins
+    uint32_t round = 0;
+
+    void stmt(NodeId id);
+    TypeSet expr(NodeId id);
+    void condition(NodeId stmt, NodeId cond);
+    void set(uint32_t slot, TypeSet type);
+    std::vector<SlotType> undoSince(size_t start);
+    void mark(NodeId id, uint8_t bits) { types[id] = bits; }
+    void fail(NodeId id) {
+        types[id] = kFails;
+        failures.push_back(id);
+    }
+};
@@ -0,0 +1,217 @@
+#include "value.h"
+#include "memory_account.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Applies op to two numeric operands with the usual C++ promotions.
+// Returns false when either side is a string.
+template <typename Op>
+bool numericBinary(const Value& left, const Value& right, Op op, Value& out) {
+    if (left.isInt()) {
+        if (right.isInt()) { out = op(left.asInt(), right.asInt()); return true; }
+        if (right.isDouble()) { out = op(left.asInt(), right.asDouble()); return true; }
+    }
+    if (left.isDouble()) {
+        if (right.isInt()) { out = op(left.asDouble(), right.asInt()); return true; }
+        if (right.isDouble()) { out = op(left.asDouble(), right.asDouble()); return true; }
+    }
+    return false;
+}
+
+template <typename Op>
+Value comparison(const Value& left, const Value& right, Op op, BinaryOp which) {
+    Value out;
+    if (numericBinary(left, right, [&](auto l, auto r) { return static_cast<int>(op(l, r)); }, out))
+        return out;
+    throw std::runtime_error(std::string("Operator '") + binaryOpSymbol(which) + "' requires numeric operands");
+}
+
+int toModuloOperand(const Value& value) {
+    if (value.isInt()) return value.asInt();
+    if (value.isDouble()) return static_cast<int>(value.asDouble());
+    throw std::runtime_error("Modulo operator requires integer operands");
+}
+
+bool isZero(const Value& value) {
+    if (value.isInt()) return value.asInt() == 0;
+    if (value.isDouble()) return value.asDouble() == 0.0;
+    return false;
+}
+
+// What a buffer's contents hold on the heap
+size_t heapBytes(const std::string& text) {
+    static const size_t inlineCapacity = std::string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+template <typename T>
+size_t heapBytes(const std::vector<T>& elements) {
+    return elements.capacity() * sizeof(T);
+}
+
+} // namespace
+
+template <typename T>
+void Value::adopt(uint64_t tag, T contents) {
+    MemoryAccount* account = MemoryAccount::active();
+    size_t bytes = sizeof(Buffer<T>) + heapBytes(contents);
+    if (account) account->charge(bytes);
+    Buffer<T>* created;
+    try {
+        created = new Buffer<T>(std::move(contents));
+    }
+    catch (...) {
+        if (account) account->credit(bytes);
+        throw;
+    }
+    if (account) {
+        created->account = account;
+        created->charged = bytes;
+    }
+    bits = tag | reinterpret_cast<uintptr_t>(static_cast<Shared*>(created));
+}
+
+Value::Value(std::string text) {
+    adopt(kStringTag, std::move(text));
+}
+
+Value::Value(std::vector<int> elements) {
+    adopt(kIntArrayTag, std::move(elements));
+}
+
+Value::Value(std::vector<double> elements) {
+    adopt(kFloatArrayTag, std::move(elements));
+}
+
+void Value::destroy() {
+    MemoryAccount* account = shared()->account;
+    size_t charged = shared()->charged;
+    if (isString()) delete buffer<std::string>();
+    else if (isIntArray()) delete buffer<std::vector<int>>();
+    else delete buffer<std::vector<double>>();
+    if (account) account->credit(charged);
+}
+
+template <typename T>
+T& Value::unshared() {
+    // acquire pairs with the release in another thread's last release()
+    if (shared()->refs.load(std::memory_order_acquire) != 1) {
+        requireMemory(heapBytes(buffer<T>()->contents));
+        *this = Value(T(buffer<T>()->contents));
+    }
+    return buffer<T>()->contents;
+}
+template std::vector<int>& Value::unshared<std::vector<int>>();
+template std::vector<double>& Value::unshared<std::vector<double>>();
+
+void Value::append(const Value& other) {
+    // acquire pairs with the release in another thread's last release()
+    if (shared()->refs.load(std::memory_order_acquire) == 1) {
+        std::string& contents = buffer<std::string>()->contents;
+        size_t before = contents.capacity();
+        size_t needed = contents.size() + other.str().size();
+        // Growth is charged to the running engine, if the buffer is its own
+        MemoryAccount* account = MemoryAccount::active();
+        if (account != shared()->account) account = nullptr;
+        // The string doubles its capacity, or grows to fit
+        if (account && needed > before) account->require(std::max(needed, 2 * before) - before);
+        contents.append(other.str());
+        if (account && contents.capacity() != before)
+            account->recharge(shared()->charged, sizeof(Buffer<std::string>) + heapBytes(contents));
+        return;
+    }
+    // Shared (a literal, or another variable holds it): copy once, with room
+    // to grow, and own the result from then on
+    requireMemory(2 * (str().size() + other.str().size()));
+    std::string grown;
+    grown.reserve(2 * (str().size() + other.str().size()));
+    grown.append(str());
+    grown.append(other.str());
+    *this = Value(std::move(grown));
+}
+
+bool operator==(const Value& a, const Value& b) {
+    if (a.isDouble()) return b.isDouble() && a.asDouble() == b.asDouble();
+    if (a.isString()) return b.isString() && (a.bits == b.bits || a.str() == b.str());
+    if (a.isIntArray()) return b.isIntArray() && (a.bits == b.bits || a.ints() == b.ints());
+    // Element by element, so an array holding NaN is not equal to itself
+    if (a.isFloatArray()) return b.isFloatArray() && a.floats() == b.floats();
+    return a.bits == b.bits;
+}
+
+BinaryOp binaryOpFromSymbol(const std::string& symbol) {
+    if (symbol == "+") return BinaryOp::Add;
+    if (symbol == "-") return BinaryOp::Sub;
+    if (symbol == "*") return BinaryOp::Mul;
+    if (symbol == "/") return BinaryOp::Div;
+    if (symbol == "%") return BinaryOp::Mod;
+    if (symbol == "==") return BinaryOp::Equal;
+    if (symbol == "!=") return BinaryOp::NotEqual;
+    if (symbol == "<") return BinaryOp::Less;
+    if (symbol == "<=") return BinaryOp::LessEqual;
+    if (symbol == ">") return BinaryOp::Greater;
+    if (symbol == ">=") return BinaryOp::GreaterEqual;
+    throw std::runtime_error("Unknown operator: " + symbol);
+}
+
+const char* binaryOpSymbol(BinaryOp op) {
+    switch (op) {
+        case BinaryOp::Add: return "+";
+        case BinaryOp::Sub: return "-";
+        case BinaryOp::Mul: return "*";
+        case BinaryOp::Div: return "/";
+        case BinaryOp::Mod: return "%";
+        case BinaryOp::Equal: return "==";
+        case BinaryOp::NotEqual: return "!=";
+        case BinaryOp::Less: return "<";
+        case BinaryOp::LessEqual: return "<=";
+        case BinaryOp::Greater: return ">";
+        case BinaryOp::GreaterEqual: return ">=";
+    }
+    return "?";
+}
+
+Value applyBinary(BinaryOp op, const Value& left, const Value& right) {
+    Value out;
+    switch (op) {
+        case BinaryOp::Add:
+            if (left.isString() && right.isString()) {
+                requireMemory(left.str().size() + right.str().size());
+                return left.str() + right.str();
+            }
+            if (numericBinary(left, right, [](auto l, auto r) { return l + r; }, out)) return out;
+            break;
+        case BinaryOp::Sub:
+            if (numericBinary(left, right, [](auto l, auto r) { return l - r; }, out)) return out;
+            break;
+        case BinaryOp::Mul:
+            if (numericBinary(left, right, [](auto l, auto r) { return l * r; }, out)) return out;
+            break;
+        case BinaryOp::Div:
+            if (!left.isNumber() || !right.isNumber()) break;
+            if (isZero(right)) throw std::runtime_error("Division by zero");
+            numericBinary(left, right, [](auto l, auto r) { return static_cast<double>(l) / r; }, out);
+            return out;
+        case BinaryOp::Mod: {
+            int leftInt = toModuloOperand(left);
+            int rightInt = toModuloOperand(right);
+            if (rightInt == 0) throw std::runtime_error("Modulo by zero");
+            return leftInt % rightInt;
+        }
+        case BinaryOp::Equal: return static_cast<int>(left == right);
+        case BinaryOp::NotEqual: return static_cast<int>(left != right);
+        case BinaryOp::Less: return comparison(left, right, [](auto l, auto r) { return l < r; }, op);
+        case BinaryOp::LessEqual: return comparison(left, right, [](auto l, auto r) { return l <= r; }, op);
+        case BinaryOp::Greater: return comparison(left, right, [](auto l, auto r) { return l > r; }, op);
+        case BinaryOp::GreaterEqual: return comparison(left, right, [](auto l, auto r) { return l >= r; }, op);
+    }
+    // Mixed string/number operands and arrays fall through the interpreter's ladder
+    throw std::runtime_error("Invalid expression");
+}
+
+bool isTruthy(const Value& value) {
+    if (value.isInt()) return value.asInt() != 0;
+    if (value.isDouble()) return value.asDouble() != 0.0;
+    throw std::runtime_error("Condition must be numeric");
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+class MemoryAccount;
+
+// Runtime value shared by the tree-walking interpreter and the bytecode VM:
+// an int, a double, a string or an array in 8 bytes. Doubles are stored as
+// their own bit pattern; everything else lives in the payload of quiet NaNs
+// that no arithmetic produces (NaN-boxing):
+//
+//   0xFFFC'0000'iiii'iiii  int
+//   0xFFFD'pppp'pppp'pppp  string: pointer to a reference-counted buffer
+//   0xFFFE'pppp'pppp'pppp  int[]: same, holding a std::vector<int>
+//   0xFFFF'pppp'pppp'pppp  float[]: same, holding a std::vector<double>
+//   anything below         double
+//
+// A double NaN is stored as 0x7FF8... or 0xFFF8..., keeping its sign, so it
+// prints as before. Copies of a string or an array share one buffer, so
+// reading a variable or a literal never copies characters or elements. The
+// buffer is treated as immutable except by append() and the mutable element
+// accessors, which only write in place when no other Value can see it.
+// Buffers made while an engine runs are charged to its MemoryAccount (see
+// memory_account.h).
+class Value {
+public:
+    Value() : bits(kIntTag) {} // int 0
+    Value(int value) : bits(kIntTag | static_cast<uint32_t>(value)) {}
+    Value(double value) {
+        std::memcpy(&bits, &value, sizeof bits);
+        if (bits >= kIntTag) bits = kNegativeNaN;
+    }
+    Value(std::string text);
+    Value(const char* text) : Value(std::string(text)) {}
+    Value(std::vector<int> elements);
+    Value(std::vector<double> elements);
+
+    Value(const Value& other) : bits(other.bits) { retain(); }
+    Value(Value&& other) noexcept : bits(other.bits) { other.bits = kIntTag; }
+    Value& operator=(const Value& other) {
+        other.retain();
+        release();
+        bits = other.bits;
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            release();
+            bits = other.bits;
+            other.bits = kIntTag;
+        }
+        return *this;
+    }
+    ~Value() { release(); }
+
+    bool isInt() const { return (bits >> 48) == (kIntTag >> 48); }
+    bool isDouble() const { return bits < kIntTag; }
+    bool isString() const { return (bits >> 48) == (kStringTag >> 48); }
+    bool isIntArray() const { return (bits >> 48) == (kIntArrayTag >> 48); }
+    bool isFloatArray() const { return bits >= kFloatArrayTag; }
+    bool isArray() const { return bits >= kIntArrayTag; }
+    bool isNumber() const { return bits < kStringTag; }
+    // 0 = int, 1 = double, 2 = string, 3 = int[], 4 = float[]
+    int index() const { return isDouble() ? 1 : isInt() ? 0 : isString() ? 2 : isIntArray() ? 3 : 4; }
+
+    // Unchecked: only after the matching is...()
+    int asInt() const { return static_cast<int>(static_cast<uint32_t>(bits)); }
+    double asDouble() const {
+        double value;
+        std::memcpy(&value, &bits, sizeof value);
+        return value;
+    }
+    const std::string& str() const { return buffer<std::string>()->contents; }
+    const std::vector<int>& ints() const { return buffer<std::vector<int>>()->contents; }
+    const std::vector<double>& floats() const { return buffer<std::vector<double>>()->contents; }
+    // The elements to write to, copied first unless this is the only reference
+    std::vector<int>& mutableInts() { return unshared<std::vector<int>>(); }
+    std::vector<double>& mutableFloats() { return unshared<std::vector<double>>(); }
+
+    // *this = *this + other for two strings, in place when this is the only
+    // reference
+    void append(const Value& other);
+
+    // Same alternative and same value: 1 == 1.0 is false
+    friend bool operator==(const Value& a, const Value& b);
+    friend bool operator!=(const Value& a, const Value& b) { return !(a == b); }
+
+private:
+    // Every heap alternative starts with its reference count and what it
+    // was charged for
+    struct Shared {
+        std::atomic<uint32_t> refs{1};
+        MemoryAccount* account = nullptr;
+        size_t charged = 0;
+    };
+    template <typename T>
+    struct Buffer : Shared {
+        explicit Buffer(T contents) : contents(std::move(contents)) {}
+        T contents;
+    };
+
+    static constexpr uint64_t kIntTag = 0xFFFC000000000000ull;
+    static constexpr uint64_t kStringTag = 0xFFFD000000000000ull;
+    static constexpr uint64_t kIntArrayTag = 0xFFFE000000000000ull;
+    static constexpr uint64_t kFloatArrayTag = 0xFFFF000000000000ull;
+    static constexpr uint64_t kPayload = 0x0000FFFFFFFFFFFFull;
+    static constexpr uint64_t kNegativeNaN = 0xFFF8000000000000ull;
+
+    uint64_t bits;
+
+    template <typename T>
+    void adopt(uint64_t tag, T contents);
+    Shared* shared() const { return reinterpret_cast<Shared*>(bits & kPayload); }
+    template <typename T>
+    Buffer<T>* buffer() const { return static_cast<Buffer<T>*>(shared()); }
+    template <typename T>
+    T& unshared();
+    void retain() const {
+        if (bits >= kStringTag) shared()->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() {
+        if (bits >= kStringTag && shared()->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) destroy();
+    }
+    void destroy();
+};
+static_assert(sizeof(void*) == 8, "Value keeps pointers in 48 bits");
+
+enum class BinaryOp : uint8_t {
+    Add, Sub, Mul, Div, Mod,
+    Equal, NotEqual,
+    Less, LessEqual, Greater, GreaterEqual,
+};
+
+// Maps the operator spelling produced by the parser ("+", "<=", ...) to its opcode
+BinaryOp binaryOpFromSymbol(const std::string& symbol);
+const char* binaryOpSymbol(BinaryOp op);
+
+// Same semantics as Interpreter::evaluate: int op int stays int (except '/'),
+// mixed int/double promotes to double, '+' concatenates two strings,
+// comparisons yield int 0/1 and '==' compares alternatives as well as values
+// (two arrays are equal when they have the same type and elements). Arrays
+// take no other operator; see arrays.h for what works on them.
+Value applyBinary(BinaryOp op, const Value& left, const Value& right);
+
+// Truthiness of an 'ana'/'fun' condition; throws for strings
+bool isTruthy(const Value& value);
+
+// Equal..GreaterEqual on two ints or two doubles
+template <typename T>
+inline bool compareNumbers(BinaryOp relation, T l, T r) {
+    switch (relation) {
+        case BinaryOp::Equal: return l == r;
+        case BinaryOp::NotEqual: return l != r;
+        case BinaryOp::Less: return l < r;
+        case BinaryOp::LessEqual: return l <= r;
+        case BinaryOp::Greater: return l > r;
+        default: return l >= r;
+    }
+}
+
+// isTruthy(applyBinary(relation, left, right)) for Equal..GreaterEqual,
+// without building the 0/1 in between: how the engines branch on a
+// comparison
+inline bool compareValues(BinaryOp relation, const Value& left, const Value& right) {
+    if (left.isInt() && right.isInt()) return compareNumbers(relation, left.asInt(), right.asInt());
+    if (left.isDouble() && right.isDouble()) return compareNumbers(relation, left.asDouble(), right.asDouble());
+    // Mixed types, strings and the errors they raise
+    return isTruthy(applyBinary(relation, left, right));
+}
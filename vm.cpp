@@ -0,0 +1,407 @@
+#include "vm.h"
+#include "arrays.h"
+#include <stdexcept>
+#include <unistd.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HAPPYSCRIPT_COMPUTED_GOTO 1
+#endif
+
+void VM::run(const Chunk& chunk) {
+    start(chunk);
+    resume(0);
+}
+
+void VM::start(const Chunk& chunk) {
+    if (!output) setOutput(std::make_unique<FdSink>(STDOUT_FILENO, FdSink::defaultPolicy(STDOUT_FILENO)));
+    reset(chunk);
+    running = &chunk;
+    resumePc = 0;
+}
+
+bool VM::resume(uint64_t budget) {
+    if (!running) throw std::runtime_error("No program to resume");
+    bool finished;
+    try {
+        MemoryScope scope(account.get());
+        finished = execute(*running, resumePc, budget);
+    }
+    catch (...) {
+        running = nullptr;
+        // Whatever was printed before the error goes out before the message
+        output->flush();
+        throw;
+    }
+    if (finished) {
+        running = nullptr;
+        output->flush();
+    }
+    return finished;
+}
+
+void VM::bind(uint32_t slot, Value value) {
+    for (auto& binding : bindings) {
+        if (binding.first == slot) {
+            binding.second = std::move(value);
+            return;
+        }
+    }
+    bindings.emplace_back(slot, std::move(value));
+}
+
+void VM::reset(const Chunk& chunk) {
+    slots.assign(chunk.slotNames.size(), Value{});
+    defined.assign(chunk.slotNames.size(), 0);
+    for (const auto& [slot, value] : bindings) {
+        if (slot >= slots.size()) throw std::runtime_error("Input slot out of range");
+        slots[slot] = value;
+        defined[slot] = 1;
+    }
+    stack.clear();
+    stack.reserve(chunk.maxStack);
+    storage.set(*account, (slots.capacity() + stack.capacity()) * sizeof(Value) + defined.capacity());
+    if (chunk.program) loops.reset(*chunk.program);
+    hotLoops.clear();
+    hotLoops.resize(chunk.jitLoops.size());
+}
+
+bool VM::execute(const Chunk& chunk, uint32_t pc, uint64_t budget) {
+    const Instruction* code = chunk.code.data();
+    const Instruction* ip = code + pc;
+
+    auto pop = [this]() {
+        Value v = std::move(stack.back());
+        stack.pop_back();
+        return v;
+    };
+    auto binary = [this](BinaryOp op) {
+        Value right = std::move(stack.back());
+        stack.pop_back();
+        stack.back() = applyBinary(op, stack.back(), right);
+    };
+    // The typed operators overwrite the left operand in place
+    auto intBinary = [this](auto op) {
+        Value& left = stack[stack.size() - 2];
+        left = op(left.asInt(), stack.back().asInt());
+        stack.pop_back();
+    };
+    auto doubleBinary = [this](auto op) {
+        Value& left = stack[stack.size() - 2];
+        left = op(left.asDouble(), stack.back().asDouble());
+        stack.pop_back();
+    };
+    auto store = [this](uint32_t slot, Value value) {
+        slots[slot] = std::move(value);
+        defined[slot] = 1;
+    };
+
+#ifdef HAPPYSCRIPT_COMPUTED_GOTO
+    // Must list labels in OpCode declaration order
+    static void* const labels[] = {
+        &&op_Constant, &&op_LoadVar, &&op_LoadAssigned, &&op_StoreVar, &&op_AddToVar,
+        &&op_DeclInt, &&op_DeclFloat, &&op_DeclString, &&op_DeclIntArray, &&op_DeclFloatArray,
+        &&op_Add, &&op_Sub, &&op_Mul, &&op_Div, &&op_Mod,
+        &&op_Equal, &&op_NotEqual, &&op_Less, &&op_LessEqual, &&op_Greater, &&op_GreaterEqual,
+        &&op_IntAdd, &&op_IntSub, &&op_IntMul, &&op_IntMod,
+        &&op_DoubleAdd, &&op_DoubleSub, &&op_DoubleMul, &&op_DoubleDiv,
+        &&op_IntCompare, &&op_DoubleCompare, &&op_ToDouble, &&op_ToInt,
+        &&op_Index, &&op_Call, &&op_MakeArray, &&op_StoreElement,
+        &&op_Print, &&op_Jump, &&op_LoopBack, &&op_JumpIfFalse,
+        &&op_JumpUnless, &&op_JumpUnlessVarConst, &&op_JumpUnlessVarVar,
+        &&op_EnterLoop, &&op_ClosedForm, &&op_LoadHoisted, &&op_StoreHoisted, &&op_LoopHead,
+        &&op_ProfileEnter, &&op_ProfileExit,
+        &&op_Halt,
+    };
+#define DISPATCH() goto *labels[static_cast<uint8_t>(ip->op)]
+#define CASE(name) op_##name:
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+    DISPATCH();
+#else
+#define DISPATCH() goto dispatch
+#define CASE(name) case OpCode::name:
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+dispatch:
+    switch (ip->op) {
+#endif
+
+    CASE(Constant) {
+        stack.push_back(chunk.constants[ip->operand]);
+        NEXT();
+    }
+    CASE(LoadVar) {
+        if (!defined[ip->operand])
+            throw std::runtime_error("Undefined variable: " + chunk.slotNames[ip->operand]);
+        // falls through
+    }
+    CASE(LoadAssigned) {
+        stack.push_back(slots[ip->operand]);
+        NEXT();
+    }
+    CASE(StoreVar) {
+        store(ip->operand, pop());
+        NEXT();
+    }
+    // The Value locals below sit in their own block: a computed goto out of
+    // a scope does not run destructors, so NEXT() must come after them
+    CASE(AddToVar) {
+        {
+            Value right = pop();
+            // Drop the operand copy first so a string buffer can be uniquely owned
+            stack.pop_back();
+            Value& target = slots[ip->operand];
+            if (target.isInt() && right.isInt()) target = target.asInt() + right.asInt();
+            else if (target.isDouble() && right.isDouble()) target = target.asDouble() + right.asDouble();
+            else if (target.isString() && right.isString()) target.append(right);
+            else target = applyBinary(BinaryOp::Add, target, right);
+        }
+        NEXT();
+    }
+    CASE(DeclInt) {
+        {
+            Value val = pop();
+            if (val.isInt()) store(ip->operand, std::move(val));
+            else if (val.isDouble()) store(ip->operand, static_cast<int>(val.asDouble()));
+            else throw std::runtime_error("Type mismatch assigning to int variable");
+        }
+        NEXT();
+    }
+    CASE(DeclFloat) {
+        {
+            Value val = pop();
+            if (val.isInt()) store(ip->operand, static_cast<double>(val.asInt()));
+            else if (val.isDouble()) store(ip->operand, std::move(val));
+            else throw std::runtime_error("Type mismatch assigning to float variable");
+        }
+        NEXT();
+    }
+    CASE(DeclString) {
+        if (!stack.back().isString())
+            throw std::runtime_error("Type mismatch assigning to string variable");
+        store(ip->operand, pop());
+        NEXT();
+    }
+    CASE(DeclIntArray) {
+        {
+            Value val = pop();
+            store(ip->operand, declareArray(TokenType::IntArrayType, val));
+        }
+        NEXT();
+    }
+    CASE(DeclFloatArray) {
+        {
+            Value val = pop();
+            store(ip->operand, declareArray(TokenType::FloatArrayType, val));
+        }
+        NEXT();
+    }
+    CASE(Add) { binary(BinaryOp::Add); NEXT(); }
+    CASE(Sub) { binary(BinaryOp::Sub); NEXT(); }
+    CASE(Mul) { binary(BinaryOp::Mul); NEXT(); }
+    CASE(Div) { binary(BinaryOp::Div); NEXT(); }
+    CASE(Mod) { binary(BinaryOp::Mod); NEXT(); }
+    CASE(Equal) { binary(BinaryOp::Equal); NEXT(); }
+    CASE(NotEqual) { binary(BinaryOp::NotEqual); NEXT(); }
+    CASE(Less) { binary(BinaryOp::Less); NEXT(); }
+    CASE(LessEqual) { binary(BinaryOp::LessEqual); NEXT(); }
+    CASE(Greater) { binary(BinaryOp::Greater); NEXT(); }
+    CASE(GreaterEqual) { binary(BinaryOp::GreaterEqual); NEXT(); }
+    // Typed forms: the compiler proved the operand types, so no checks but
+    // the run-time errors of the values themselves
+    CASE(IntAdd) { intBinary([](int l, int r) { return l + r; }); NEXT(); }
+    CASE(IntSub) { intBinary([](int l, int r) { return l - r; }); NEXT(); }
+    CASE(IntMul) { intBinary([](int l, int r) { return l * r; }); NEXT(); }
+    CASE(IntMod) {
+        if (stack.back().asInt() == 0) throw std::runtime_error("Modulo by zero");
+        intBinary([](int l, int r) { return l % r; });
+        NEXT();
+    }
+    CASE(DoubleAdd) { doubleBinary([](double l, double r) { return l + r; }); NEXT(); }
+    CASE(DoubleSub) { doubleBinary([](double l, double r) { return l - r; }); NEXT(); }
+    CASE(DoubleMul) { doubleBinary([](double l, double r) { return l * r; }); NEXT(); }
+    CASE(DoubleDiv) {
+        if (stack.back().asDouble() == 0.0) throw std::runtime_error("Division by zero");
+        doubleBinary([](double l, double r) { return l / r; });
+        NEXT();
+    }
+    CASE(IntCompare) {
+        BinaryOp relation = static_cast<BinaryOp>(ip->operand);
+        intBinary([relation](int l, int r) { return static_cast<int>(compareNumbers(relation, l, r)); });
+        NEXT();
+    }
+    CASE(DoubleCompare) {
+        Value& left = stack[stack.size() - 2];
+        left = static_cast<int>(compareNumbers(static_cast<BinaryOp>(ip->operand), left.asDouble(), stack.back().asDouble()));
+        stack.pop_back();
+        NEXT();
+    }
+    CASE(ToDouble) {
+        stack.back() = static_cast<double>(stack.back().asInt());
+        NEXT();
+    }
+    CASE(ToInt) {
+        stack.back() = static_cast<int>(stack.back().asDouble());
+        NEXT();
+    }
+    CASE(Index) {
+        {
+            Value index = pop();
+            stack.back() = elementAt(stack.back(), index);
+        }
+        NEXT();
+    }
+    CASE(Call) {
+        {
+            // The arguments are the top arity values, first one deepest
+            Builtin builtin = static_cast<Builtin>(ip->operand);
+            size_t arity = builtinInfo(builtin).arity;
+            Value result = callBuiltin(builtin, stack.data() + stack.size() - arity);
+            stack.resize(stack.size() - arity);
+            stack.push_back(std::move(result));
+        }
+        NEXT();
+    }
+    CASE(MakeArray) {
+        {
+            Value array = makeArray(stack.data() + stack.size() - ip->operand, ip->operand);
+            stack.resize(stack.size() - ip->operand);
+            stack.push_back(std::move(array));
+        }
+        NEXT();
+    }
+    CASE(StoreElement) {
+        if (!defined[ip->operand])
+            throw std::runtime_error("Undefined variable: " + chunk.slotNames[ip->operand]);
+        storeElement(slots[ip->operand], stack[stack.size() - 2], stack.back());
+        stack.pop_back();
+        stack.pop_back();
+        NEXT();
+    }
+    CASE(Print) {
+        output->print(stack.back());
+        stack.pop_back();
+        NEXT();
+    }
+    CASE(Jump) {
+        ip = code + ip->operand;
+        DISPATCH();
+    }
+    CASE(LoopBack) {
+        // A budget of 0 wraps around and never runs out
+        if (--budget == 0) {
+            resumePc = ip->operand;
+            return false;
+        }
+        ip = code + ip->operand;
+        DISPATCH();
+    }
+    CASE(JumpIfFalse) {
+        bool condVal = isTruthy(stack.back());
+        stack.pop_back();
+        if (condVal) NEXT();
+        ip = code + ip->operand;
+        DISPATCH();
+    }
+    CASE(JumpUnless) {
+        const Chunk::Branch& branch = chunk.branches[ip->operand];
+        bool holds = compareValues(branch.relation, stack[stack.size() - 2], stack.back());
+        stack.pop_back();
+        stack.pop_back();
+        if (holds) NEXT();
+        ip = code + branch.target;
+        DISPATCH();
+    }
+    CASE(JumpUnlessVarConst) {
+        const Chunk::Branch& branch = chunk.branches[ip->operand];
+        if (!defined[branch.left])
+            throw std::runtime_error("Undefined variable: " + chunk.slotNames[branch.left]);
+        if (compareValues(branch.relation, slots[branch.left], chunk.constants[branch.right])) NEXT();
+        ip = code + branch.target;
+        DISPATCH();
+    }
+    CASE(JumpUnlessVarVar) {
+        const Chunk::Branch& branch = chunk.branches[ip->operand];
+        if (!defined[branch.left])
+            throw std::runtime_error("Undefined variable: " + chunk.slotNames[branch.left]);
+        if (!defined[branch.right])
+            throw std::runtime_error("Undefined variable: " + chunk.slotNames[branch.right]);
+        if (compareValues(branch.relation, slots[branch.left], slots[branch.right])) NEXT();
+        ip = code + branch.target;
+        DISPATCH();
+    }
+    CASE(EnterLoop) {
+        loops.enter(ip->operand);
+        NEXT();
+    }
+    CASE(ClosedForm) {
+        if (!loops.tryClosedForm(ip->operand, slots, defined)) NEXT();
+        ip = code + chunk.loopExits[ip->operand];
+        DISPATCH();
+    }
+    CASE(LoadHoisted) {
+        const Value* cached = loops.cached(ip->operand);
+        if (!cached) NEXT();
+        stack.push_back(*cached);
+        ip = code + chunk.hoistEnds[ip->operand];
+        DISPATCH();
+    }
+    CASE(StoreHoisted) {
+        loops.fill(ip->operand, stack.back());
+        NEXT();
+    }
+    CASE(LoopHead) {
+        HotLoop& hot = hotLoops[ip->operand];
+        if (hot.code) {
+            CompiledLoop::Result result;
+            if (hot.code->run(slots, defined, result)) {
+                ++jitCounters.nativeEntries;
+                if (result.exit == CompiledLoop::Exit::Finished) {
+                    ip = code + chunk.jitLoops[ip->operand].exitPc;
+                    DISPATCH();
+                }
+                if (result.exit == CompiledLoop::Exit::Statement) {
+                    ++jitCounters.sideExits;
+                    ip = code + hot.exitPcs[result.index];
+                    DISPATCH();
+                }
+                NEXT(); // Exit::Condition: evaluate it in the VM
+            }
+            // A variable changed type since compilation
+            hot.code.reset();
+            hot.iterations = 0;
+        } else if (jitEnabled && !profiler && hot.attempts < kMaxJitAttempts && ++hot.iterations >= kJitThreshold) {
+            compileHotLoop(chunk, hot, ip->operand);
+        }
+        NEXT();
+    }
+    CASE(ProfileEnter) {
+        if (profiler) profiler->enter(ip->operand);
+        NEXT();
+    }
+    CASE(ProfileExit) {
+        if (profiler) profiler->exit();
+        NEXT();
+    }
+    CASE(Halt) {
+        return true;
+    }
+
+#ifndef HAPPYSCRIPT_COMPUTED_GOTO
+    }
+#endif
+#undef CASE
+#undef NEXT
+#undef DISPATCH
+}
+
+void VM::compileHotLoop(const Chunk& chunk, HotLoop& hot, uint32_t index) {
+    hot.iterations = 0;
+    ++hot.attempts;
+    hot.code = compileLoop(*chunk.program, chunk.jitLoops[index].loop, slots, defined);
+    if (!hot.code) return;
+    ++jitCounters.compiledLoops;
+    // A side exit resumes at the start of the statement it stopped in front of
+    hot.exitPcs.clear();
+    for (const CompiledLoop::SideExit& exit : hot.code->sideExits()) {
+        hot.exitPcs.push_back(chunk.pcOf(exit.stmt));
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "compiler.h"
+#include "jit.h"
+#include "loops.h"
+#include "memory_account.h"
+#include "output.h"
+#include "profiler.h"
+#include "value.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Stack machine executing a Chunk produced by Compiler
+class VM {
+public:
+    void run(const Chunk& chunk);
+
+    // A run in slices, for a scheduler (see scheduler.h). start() sets up
+    // like run() but executes nothing; each resume() carries on until the
+    // program ends (true) or has taken budget loop back-edges (false), 0
+    // meaning no limit. Straight-line code between back-edges is bounded by
+    // the program's length, so every slice is too, apart from single
+    // operations on huge arrays or strings. Native loops (see jit.h) do not
+    // come back to the VM between iterations: turn the JIT off for runs
+    // that must stop.
+    void start(const Chunk& chunk);
+    bool resume(uint64_t budget);
+
+    // Variables set before the program starts, for every later run()
+    void bind(uint32_t slot, Value value);
+    // A variable after run(), or nullptr if the program never assigned it
+    const Value* variable(uint32_t slot) const {
+        return slot < defined.size() && defined[slot] ? &slots[slot] : nullptr;
+    }
+
+    // Where 'smile' writes; buffered stdout unless replaced
+    void setOutput(std::unique_ptr<OutputSink> sink) {
+        output = std::move(sink);
+        if (output) output->chargeTo(*account);
+    }
+
+    // The strings, arrays and slots the program holds; setLimit() on it
+    // makes a run that would go past the limit fail
+    MemoryAccount& memory() { return *account; }
+    const MemoryAccount& memory() const { return *account; }
+
+    // Native code for hot loops (see jit.h); on by default where supported
+    void setJit(bool enabled) { jitEnabled = enabled; }
+    const JitStats& jitStats() const { return jitCounters; }
+
+    // Receives the ProfileEnter/ProfileExit of a Chunk compiled with
+    // Compiler::setProfiling; profiled runs do not use the JIT
+    void setProfiler(Profiler* statementProfiler) { profiler = statementProfiler; }
+
+private:
+    std::shared_ptr<MemoryAccount> account = MemoryAccount::create();
+    MemoryCharge storage; // slots, defined and stack
+    std::vector<Value> stack;
+    std::vector<Value> slots;
+    std::vector<uint8_t> defined;
+    std::vector<std::pair<uint32_t, Value>> bindings;
+    LoopRuntime loops;
+    std::unique_ptr<OutputSink> output;
+    bool jitEnabled = kJitAvailable;
+    std::vector<HotLoop> hotLoops; // per Chunk::jitLoops entry
+    JitStats jitCounters;
+    Profiler* profiler = nullptr;
+    const Chunk* running = nullptr; // started and not finished
+    uint32_t resumePc = 0;
+
+    void reset(const Chunk& chunk);
+    // Runs from pc; false if the budget ran out (see resume)
+    bool execute(const Chunk& chunk, uint32_t pc, uint64_t budget);
+    void compileHotLoop(const Chunk& chunk, HotLoop& hot, uint32_t index);
+};